@@ -0,0 +1,788 @@
+/* GIMP - The GNU Image Manipulation Program
+ * Copyright (C) 2023 Samuel Oldham
+ * Contact sheet plug-in (C) 2023 Samuel Oldham
+ * e-mail: so9010sami@gmail.com
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Throughput benchmark for the parts of the plug-in that run outside GIMP:
+ * folder scan, decoding, EXIF, the worker queue, composition and export.
+ * It makes a synthetic folder of the size, formats and resolution asked
+ * for, runs each stage over it on its own and then the whole pipeline the
+ * way run () does for file output, and prints the results as JSON.
+ *
+ *   make bench BENCH_ARGS="-n 500 -s 6000x4000 -f jpeg,png"
+ *
+ * With --soak it then links the folder's images under that many names
+ * and runs them all through the pipeline, and fails unless the resident
+ * size stays flat once the first sheets are done. Only this pipeline is
+ * soaked, not run ()'s GIMP side: the sheet images, layers and PDB calls.
+ *
+ *   make bench BENCH_ARGS="-n 60 -s 1200x800 -S 100000"
+ */
+
+#include <errno.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/resource.h>
+#include <unistd.h>
+
+#include <glib.h>
+#include <glib/gstdio.h>
+#include <gdk-pixbuf/gdk-pixbuf.h>
+#include <gexiv2/gexiv2.h>
+
+#include "folder-scan.h"
+#include "image-probe.h"
+#include "layout.h"
+#include "memory-budget.h"
+#include "metadata.h"
+#include "scratch.h"
+#include "sheet.h"
+#include "sheet-writer.h"
+#include "thumbnail.h"
+
+/* A sheet the size of the plug-in's default, 11.7 x 8.3 in at 300 dpi */
+#define BENCH_SHEET_WIDTH   3510
+#define BENCH_SHEET_HEIGHT  2490
+#define BENCH_GAP           4
+#define BENCH_CAPTION_SIZE  25
+
+/* A soak run may grow by this much past its size after the first tenth
+ * of its sheets, in kB, plus a twentieth of that size, and still be flat */
+#define BENCH_SOAK_SLACK    8192
+
+/* Plus this many bytes for each file after that point, for its entry in
+ * the metadata index, which keeps one per file for as long as the run */
+#define BENCH_SOAK_PER_FILE 256
+
+typedef struct
+{
+  gint         count;
+  gchar       *size;
+  gchar       *formats;
+  gchar       *folder;
+  gint         rows;
+  gint         columns;
+  gint         sidecars;
+  gboolean     keep;
+  gchar       *output;
+  gint         memory_limit;
+  gchar       *filter;
+  gchar       *layout;
+  gint         soak;
+  gint         read_ahead;
+} BenchOptions;
+
+typedef struct
+{
+  const gchar *name;
+  guint        images;
+  gdouble      seconds;
+  glong        peak_rss_kb;
+} BenchStage;
+
+typedef struct
+{
+  guint        images;
+  guint        sheets;
+  glong        settled_rss_kb;    /* After the first tenth of the sheets */
+  glong        final_rss_kb;
+  gboolean     flat;
+} BenchSoak;
+
+static BenchOptions options =
+{
+  200,
+  "3000x2000",
+  "jpeg",
+  NULL,
+  5, 6,
+  1,
+  FALSE,
+  NULL,
+  0,
+  "lanczos3",
+  "grid",
+  0,
+  16
+};
+
+static GOptionEntry entries[] =
+{
+  { "count",    'n', 0, G_OPTION_ARG_INT,      &options.count,    "Images to generate (200)", "N" },
+  { "size",     's', 0, G_OPTION_ARG_STRING,   &options.size,     "Image size (3000x2000)", "WxH" },
+  { "formats",  'f', 0, G_OPTION_ARG_STRING,   &options.formats,  "Formats to mix, of jpeg, png and tiff (jpeg)", "LIST" },
+  { "folder",   'd', 0, G_OPTION_ARG_FILENAME, &options.folder,   "Use this folder instead of generating one", "DIR" },
+  { "rows",     'r', 0, G_OPTION_ARG_INT,      &options.rows,     "Rows per sheet (5)", "N" },
+  { "columns",  'c', 0, G_OPTION_ARG_INT,      &options.columns,  "Columns per sheet (6)", "N" },
+  { "sidecars", 'x', 0, G_OPTION_ARG_INT,      &options.sidecars, "Non-image files per image, for the scan (1)", "N" },
+  { "keep",     'k', 0, G_OPTION_ARG_NONE,     &options.keep,     "Keep the generated folder", NULL },
+  { "output",   'o', 0, G_OPTION_ARG_FILENAME, &options.output,   "Write the JSON here instead of stdout", "FILE" },
+  { "memory",   'm', 0, G_OPTION_ARG_INT,      &options.memory_limit, "Memory limit of the total stage in MB (none)", "MB" },
+  { "filter",   'q', 0, G_OPTION_ARG_STRING,   &options.filter,   "Scaling filter, box or lanczos3 (lanczos3)", "NAME" },
+  { "layout",   'L', 0, G_OPTION_ARG_STRING,   &options.layout,   "Layout, grid, justified or masonry (grid)", "NAME" },
+  { "read-ahead", 'a', 0, G_OPTION_ARG_INT,    &options.read_ahead, "Files read ahead of the decoders in the total stage, 0 for none (16)", "N" },
+  { "soak",     'S', 0, G_OPTION_ARG_INT,      &options.soak,     "Then check memory stays flat over this many files (none)", "N" },
+  { NULL }
+};
+
+/* Resets the peak resident size so each stage reports its own. Linux
+ * only, elsewhere the peak is the run's so far. */
+static void
+bench_reset_peak (void)
+{
+  g_file_set_contents ("/proc/self/clear_refs", "5", 1, NULL);
+}
+
+/* A size in kB from /proc/self/status, -1 when there is none */
+static glong
+bench_status_kb (const gchar *field)
+{
+  gchar *status = NULL;
+  glong  kb     = -1;
+
+  if (g_file_get_contents ("/proc/self/status", &status, NULL, NULL))
+    {
+      const gchar *line = strstr (status, field);
+
+      if (line != NULL)
+        kb = strtol (line + strlen (field), NULL, 10);
+      g_free (status);
+    }
+
+  return kb;
+}
+
+static glong
+bench_peak_rss (void)
+{
+  glong          peak = bench_status_kb ("VmHWM:");
+  struct rusage  usage;
+
+  if (peak < 0 && getrusage (RUSAGE_SELF, &usage) == 0)
+    peak = usage.ru_maxrss;
+
+  return peak;
+}
+
+static void
+bench_begin (BenchStage  *stage,
+             const gchar *name,
+             gint64      *start)
+{
+  stage->name = name;
+  bench_reset_peak ();
+  *start = g_get_monotonic_time ();
+}
+
+static void
+bench_end (BenchStage *stage,
+           guint       images,
+           gint64      start)
+{
+  stage->images      = images;
+  stage->seconds     = (g_get_monotonic_time () - start) / (gdouble) G_USEC_PER_SEC;
+  stage->peak_rss_kb = bench_peak_rss ();
+
+  g_printerr ("  %-10s %6u images  %8.3f s  %9.1f images/s  %8ld kB peak\n",
+              stage->name, stage->images, stage->seconds,
+              stage->seconds > 0 ? stage->images / stage->seconds : 0,
+              stage->peak_rss_kb);
+}
+
+/* Fills pixbuf with smooth gradients and some noise, so it compresses
+ * about as well as a photograph rather than a flat colour */
+static void
+bench_paint (GdkPixbuf *pixbuf,
+             GRand     *rand)
+{
+  guchar *pixels = gdk_pixbuf_get_pixels (pixbuf);
+  gint    stride = gdk_pixbuf_get_rowstride (pixbuf);
+  gint    width  = gdk_pixbuf_get_width (pixbuf);
+  gint    height = gdk_pixbuf_get_height (pixbuf);
+  guint   hue    = g_rand_int_range (rand, 0, 256);
+  gint    x;
+  gint    y;
+
+  for (y = 0; y < height; y++)
+    {
+      guchar *p = pixels + (gsize) y * stride;
+
+      for (x = 0; x < width; x++, p += 3)
+        {
+          guint noise = g_rand_int (rand) & 0x0f;
+
+          p[0] = (x * 255 / width + hue + noise) & 0xff;
+          p[1] = (y * 255 / height + noise) & 0xff;
+          p[2] = ((x + y) * 127 / (width + height) + hue / 2 + noise) & 0xff;
+        }
+    }
+}
+
+/* Writes the caption values the plug-in reads */
+static void
+bench_tag (const gchar *path,
+           gint         i)
+{
+  GExiv2Metadata *metadata = gexiv2_metadata_new ();
+  static const gchar *const f_numbers[] = { "14/10", "28/10", "40/10", "56/10", "80/10" };
+  static const gchar *const exposures[] = { "1/60", "1/125", "1/250", "1/1000" };
+  gchar focal[16];
+  gchar iso[16];
+
+  g_snprintf (focal, sizeof (focal), "%d/1", 24 + (i % 8) * 10);
+  g_snprintf (iso, sizeof (iso), "%d", 100 << (i % 5));
+
+  if (gexiv2_metadata_open_path (metadata, path, NULL))
+    {
+      gexiv2_metadata_try_set_tag_string (metadata, "Exif.Photo.FNumber",
+                                          f_numbers[i % G_N_ELEMENTS (f_numbers)], NULL);
+      gexiv2_metadata_try_set_tag_string (metadata, "Exif.Photo.ExposureTime",
+                                          exposures[i % G_N_ELEMENTS (exposures)], NULL);
+      gexiv2_metadata_try_set_tag_string (metadata, "Exif.Photo.FocalLength", focal, NULL);
+      gexiv2_metadata_try_set_tag_string (metadata, "Exif.Photo.ISOSpeedRatings", iso, NULL);
+      gexiv2_metadata_save_file (metadata, path, NULL);
+    }
+
+  g_object_unref (metadata);
+}
+
+/* Makes count images in folder, cycling through formats, every fourth one
+ * portrait, with sidecars next to them */
+static gboolean
+bench_generate (const gchar *folder,
+                gint         width,
+                gint         height,
+                gchar      **formats)
+{
+  GRand     *rand = g_rand_new_with_seed (0x5eed);
+  GdkPixbuf *landscape;
+  GdkPixbuf *portrait;
+  guint      n_formats = g_strv_length (formats);
+  gint       i;
+  gint       j;
+
+  landscape = gdk_pixbuf_new (GDK_COLORSPACE_RGB, FALSE, 8, width, height);
+  portrait  = gdk_pixbuf_new (GDK_COLORSPACE_RGB, FALSE, 8, height, width);
+
+  for (i = 0; i < options.count; i++)
+    {
+      const gchar *format = formats[i % n_formats];
+      GdkPixbuf   *pixbuf = (i % 4 == 3) ? portrait : landscape;
+      GError      *error  = NULL;
+      gchar       *name;
+      gchar       *path;
+      gboolean     saved;
+
+      // A few different pictures are enough, the codecs do not cache
+      if (i < 8)
+        bench_paint (pixbuf, rand);
+
+      name = g_strdup_printf ("IMG_%05d.%s", i,
+                              strcmp (format, "jpeg") == 0 ? "jpg" :
+                              strcmp (format, "tiff") == 0 ? "tif" : format);
+      path = g_build_filename (folder, name, NULL);
+
+      if (strcmp (format, "jpeg") == 0)
+        saved = gdk_pixbuf_save (pixbuf, path, "jpeg", &error, "quality", "90", NULL);
+      else
+        saved = gdk_pixbuf_save (pixbuf, path, format, &error, NULL);
+
+      if (! saved)
+        {
+          g_printerr ("contactsheet-bench: could not write %s: %s\n", path, error->message);
+          g_clear_error (&error);
+          g_free (path);
+          g_free (name);
+          break;
+        }
+
+      if (strcmp (format, "png") != 0)
+        bench_tag (path, i);
+
+      for (j = 0; j < options.sidecars; j++)
+        {
+          gchar *sidecar = g_strdup_printf ("%s.%s", path, j % 2 ? "wav" : "xmp");
+
+          g_file_set_contents (sidecar, "<x:xmpmeta/>", -1, NULL);
+          g_free (sidecar);
+        }
+
+      g_free (path);
+      g_free (name);
+    }
+
+  g_object_unref (portrait);
+  g_object_unref (landscape);
+  g_rand_free (rand);
+
+  return i == options.count;
+}
+
+static void
+bench_remove_tree (const gchar *folder)
+{
+  GDir        *dir = g_dir_open (folder, 0, NULL);
+  const gchar *name;
+
+  while (dir != NULL && (name = g_dir_read_name (dir)) != NULL)
+    {
+      gchar *path = g_build_filename (folder, name, NULL);
+
+      g_unlink (path);
+      g_free (path);
+    }
+
+  if (dir != NULL)
+    g_dir_close (dir);
+  g_rmdir (folder);
+}
+
+/* Makes count distinct paths in dir for the files, taken round and round.
+ * Hard links where the filesystem allows, symbolic links where it does
+ * not, so everything kept per path sees a new file each time. */
+static GPtrArray *
+bench_link_files (GPtrArray   *files,
+                  const gchar *dir,
+                  guint        count)
+{
+  GPtrArray *links = g_ptr_array_new_full (count, g_free);
+  guint      i;
+
+  for (i = 0; i < count; i++)
+    {
+      gchar *file = g_canonicalize_filename (g_ptr_array_index (files, i % files->len), NULL);
+      gchar *base = g_path_get_basename (file);
+      gchar *name = g_strdup_printf ("%06u-%s", i, base);
+      gchar *path = g_build_filename (dir, name, NULL);
+
+      g_free (name);
+      g_free (base);
+
+      if (link (file, path) != 0 && symlink (file, path) != 0)
+        {
+          g_printerr ("contactsheet-bench: could not link %s: %s\n",
+                      path, g_strerror (errno));
+          g_free (path);
+          g_free (file);
+          g_ptr_array_free (links, TRUE);
+          return NULL;
+        }
+
+      g_ptr_array_add (links, path);
+      g_free (file);
+    }
+
+  return links;
+}
+
+/* Composes the thumbnails onto sheets the way run () does in direct mode,
+ * in the cells of plan, handing each full sheet to writer when there is one.
+ * Without captions there is no text, as in a run with every caption value
+ * turned off. The resident size after each sheet is added to rss when it
+ * is not NULL. */
+static guint
+bench_compose (GPtrArray        *files,
+               const LayoutPlan *plan,
+               ThumbQueue       *queue,
+               GdkPixbuf       **thumbs,
+               ExifInfo         *exifs,
+               SheetWriter      *writer,
+               const gchar      *folder,
+               gboolean          captions,
+               GArray           *rss)
+{
+  SheetStyle  style = { "Sans", BENCH_CAPTION_SIZE, { 0, 0, 0 }, { 255, 255, 255 } };
+  SheetText  *text  = captions ? sheet_text_new (&style) : NULL;
+  Scratch    *scratch = scratch_new (16 << 10);
+  GdkPixbuf  *pixbuf = NULL;
+  Sheet      *sheet  = NULL;
+  guint       n_sheets = 0;
+  guint       i;
+
+  for (i = 0; i < files->len; i++)
+    {
+      const LayoutCell *cell = &plan->cells[i];
+      GdkPixbuf        *thumb;
+      ExifInfo          exif;
+      gchar             caption[256];
+
+      if (sheet == NULL)
+        {
+          pixbuf = gdk_pixbuf_new (GDK_COLORSPACE_RGB, FALSE, 8,
+                                   BENCH_SHEET_WIDTH, BENCH_SHEET_HEIGHT);
+          sheet = sheet_new_for_pixbuf (pixbuf, &style, text);
+        }
+
+      if (queue != NULL)
+        thumb = thumb_queue_pop (queue, i, &exif);
+      else
+        {
+          thumb = thumbs[i] ? g_object_ref (thumbs[i]) : NULL;
+          exif  = exifs[i];
+        }
+
+      caption[0] = '\0';
+      if (captions)
+        g_snprintf (caption, sizeof (caption), "%s - f/%.2g, %d",
+                    scratch_basename (scratch, g_ptr_array_index (files, i)),
+                    exif.f_number, exif.iso_speed);
+
+      sheet_add_cell (sheet, cell->x, cell->y, cell->width, cell->height, thumb, caption);
+      g_clear_object (&thumb);
+
+      if (i + 1 == plan->sheet_first[n_sheets + 1])
+        {
+          g_clear_pointer (&sheet, sheet_free);
+
+          if (writer != NULL)
+            sheet_writer_push (writer, pixbuf,
+                               scratch_printf (scratch, "%s" G_DIR_SEPARATOR_S "sheet_%u.png",
+                                               folder, n_sheets));
+          else
+            g_object_unref (pixbuf);
+
+          pixbuf = NULL;
+          n_sheets++;
+          scratch_reset (scratch);
+
+          if (rss != NULL)
+            {
+              glong kb = bench_status_kb ("VmRSS:");
+
+              g_array_append_val (rss, kb);
+            }
+        }
+    }
+
+  scratch_free (scratch);
+  g_clear_pointer (&text, sheet_text_free);
+
+  return n_sheets;
+}
+
+static void
+bench_report (FILE            *out,
+              BenchStage      *stages,
+              guint            n_stages,
+              const BenchSoak *soak,
+              gint             width,
+              gint             height)
+{
+  guint i;
+
+  fprintf (out, "{\n");
+  fprintf (out, "  \"images\": %d,\n", options.count);
+  fprintf (out, "  \"width\": %d,\n  \"height\": %d,\n", width, height);
+  fprintf (out, "  \"formats\": \"%s\",\n", options.formats);
+  fprintf (out, "  \"sheet\": { \"rows\": %d, \"columns\": %d, \"layout\": \"%s\" },\n",
+           options.rows, options.columns, options.layout);
+  fprintf (out, "  \"threads\": %u,\n", g_get_num_processors ());
+  fprintf (out, "  \"memory_limit_mb\": %d,\n", options.memory_limit);
+  fprintf (out, "  \"read_ahead\": %d,\n", options.read_ahead);
+  fprintf (out, "  \"resample\": { \"filter\": \"%s\", \"kernels\": \"%s\" },\n",
+           options.filter, resample_kernel_name ());
+  if (soak != NULL)
+    fprintf (out, "  \"soak\": { \"images\": %u, \"sheets\": %u, \"settled_rss_kb\": %ld, "
+                  "\"final_rss_kb\": %ld, \"flat\": %s },\n",
+             soak->images, soak->sheets, soak->settled_rss_kb, soak->final_rss_kb,
+             soak->flat ? "true" : "false");
+  fprintf (out, "  \"stages\": [\n");
+
+  for (i = 0; i < n_stages; i++)
+    fprintf (out, "    { \"name\": \"%s\", \"images\": %u, \"seconds\": %.6f, "
+                  "\"images_per_second\": %.3f, \"peak_rss_kb\": %ld }%s\n",
+             stages[i].name, stages[i].images, stages[i].seconds,
+             stages[i].seconds > 0 ? stages[i].images / stages[i].seconds : 0,
+             stages[i].peak_rss_kb,
+             i + 1 < n_stages ? "," : "");
+
+  fprintf (out, "  ]\n}\n");
+}
+
+int
+main (int    argc,
+      char **argv)
+{
+  GOptionContext *context;
+  GError         *error = NULL;
+  BenchStage      stages[10];
+  BenchSoak       soak = { 0, };
+  guint           n_stages = 0;
+  gint64          start;
+  gint            width;
+  gint            height;
+  gchar         **formats;
+  gchar          *folder;
+  gchar          *out_dir;
+  gchar          *soak_dir;
+  GPtrArray      *files;
+  GPtrArray      *many = NULL;
+  GdkPixbuf     **thumbs;
+  ExifInfo       *exifs;
+  ThumbQueue     *queue;
+  SheetWriter    *writer;
+  FILE           *out = stdout;
+  guint           i;
+  ImageProbe     *probes;
+  LayoutSettings  layout;
+  LayoutPlan     *plan;
+  GArray         *targets;
+  ResampleFilter  filter;
+
+  context = g_option_context_new ("- contact sheet throughput benchmark");
+  g_option_context_add_main_entries (context, entries, NULL);
+  if (! g_option_context_parse (context, &argc, &argv, &error))
+    {
+      g_printerr ("contactsheet-bench: %s\n", error->message);
+      return 1;
+    }
+  g_option_context_free (context);
+
+  if (sscanf (options.size, "%dx%d", &width, &height) != 2 ||
+      width <= 0 || height <= 0 || options.count <= 0 ||
+      options.rows <= 0 || options.columns <= 0 || options.read_ahead < 0)
+    {
+      g_printerr ("contactsheet-bench: bad size, count, rows, columns or read-ahead\n");
+      return 1;
+    }
+
+  if (strcmp (options.filter, "box") == 0)
+    filter = RESAMPLE_BOX;
+  else if (strcmp (options.filter, "lanczos3") == 0)
+    filter = RESAMPLE_LANCZOS3;
+  else
+    {
+      g_printerr ("contactsheet-bench: unknown filter %s\n", options.filter);
+      return 1;
+    }
+
+  if (strcmp (options.layout, "grid") == 0)
+    layout.kind = LAYOUT_GRID;
+  else if (strcmp (options.layout, "justified") == 0)
+    layout.kind = LAYOUT_JUSTIFIED;
+  else if (strcmp (options.layout, "masonry") == 0)
+    layout.kind = LAYOUT_MASONRY;
+  else
+    {
+      g_printerr ("contactsheet-bench: unknown layout %s\n", options.layout);
+      return 1;
+    }
+
+  gexiv2_initialize ();
+  formats = g_strsplit (options.formats, ",", -1);
+
+  if (options.folder != NULL)
+    folder = g_strdup (options.folder);
+  else
+    {
+      folder = g_dir_make_tmp ("contactsheet-bench-XXXXXX", &error);
+      if (folder == NULL)
+        {
+          g_printerr ("contactsheet-bench: %s\n", error->message);
+          return 1;
+        }
+
+      g_printerr ("contactsheet-bench: generating %d %dx%d images in %s\n",
+                  options.count, width, height, folder);
+      bench_begin (&stages[n_stages], "generate", &start);
+      if (! bench_generate (folder, width, height, formats))
+        return 1;
+      bench_end (&stages[n_stages++], options.count, start);
+    }
+
+  out_dir = g_dir_make_tmp ("contactsheet-bench-out-XXXXXX", NULL);
+
+  layout.width   = BENCH_SHEET_WIDTH;
+  layout.height  = BENCH_SHEET_HEIGHT;
+  layout.gap_x   = BENCH_GAP;
+  layout.gap_y   = BENCH_GAP;
+  layout.rows    = options.rows;
+  layout.columns = options.columns;
+  layout.rotate  = TRUE;
+  {
+    SheetStyle  style = { "Sans", BENCH_CAPTION_SIZE, { 0, 0, 0 }, { 255, 255, 255 } };
+    SheetText  *text  = sheet_text_new (&style);
+
+    layout.caption_height = sheet_text_get_height (text);
+    sheet_text_free (text);
+  }
+
+  bench_begin (&stages[n_stages], "scan", &start);
+  files = folder_scan (folder, FALSE, NULL);
+  bench_end (&stages[n_stages++], files->len, start);
+
+  // Headers only, on every core, then every cell placed
+  bench_begin (&stages[n_stages], "probe", &start);
+  probes = image_probe_files (files);
+  plan   = layout_plan_new (&layout, probes, files->len);
+  g_free (probes);
+  bench_end (&stages[n_stages++], files->len, start);
+
+  thumbs = g_new0 (GdkPixbuf *, MAX (files->len, 1));
+  exifs  = g_new0 (ExifInfo, MAX (files->len, 1));
+
+  // One core, so the per image cost of each step shows on its own
+  bench_begin (&stages[n_stages], "decode", &start);
+  for (i = 0; i < files->len; i++)
+    thumbs[i] = thumbnail_load (g_ptr_array_index (files, i), &plan->cells[i].thumb, FALSE,
+                                filter);
+  bench_end (&stages[n_stages++], files->len, start);
+
+  bench_begin (&stages[n_stages], "exif", &start);
+  for (i = 0; i < files->len; i++)
+    metadata_read (g_ptr_array_index (files, i), &exifs[i]);
+  bench_end (&stages[n_stages++], files->len, start);
+
+  bench_begin (&stages[n_stages], "compose", &start);
+  bench_compose (files, plan, NULL, thumbs, exifs, NULL, out_dir, TRUE, NULL);
+  bench_end (&stages[n_stages++], files->len, start);
+
+  // Every caption value off, the sheets then have no text at all
+  bench_begin (&stages[n_stages], "bare", &start);
+  bench_compose (files, plan, NULL, thumbs, exifs, NULL, out_dir, FALSE, NULL);
+  bench_end (&stages[n_stages++], files->len, start);
+
+  for (i = 0; i < files->len; i++)
+    g_clear_object (&thumbs[i]);
+  g_free (thumbs);
+
+  bench_begin (&stages[n_stages], "encode", &start);
+  {
+    GdkPixbuf *sheet = gdk_pixbuf_new (GDK_COLORSPACE_RGB, FALSE, 8,
+                                       BENCH_SHEET_WIDTH, BENCH_SHEET_HEIGHT);
+    gchar     *path  = g_build_filename (out_dir, "encode.png", NULL);
+    guint      n     = MAX (plan->n_sheets, 1);
+
+    gdk_pixbuf_fill (sheet, 0xffffffff);
+    writer = sheet_writer_new (SHEET_OUTPUT_PNG, 300, SHEET_WRITER_DEPTH);
+    for (i = 0; i < n; i++)
+      sheet_writer_push (writer, g_object_ref (sheet), path);
+    sheet_writer_free (writer);
+
+    g_unlink (path);
+    g_free (path);
+    g_object_unref (sheet);
+    bench_end (&stages[n_stages++], files->len, start);
+  }
+
+  // All of it together, as an export run does, on every core unless -m limits it
+  bench_begin (&stages[n_stages], "total", &start);
+  {
+    MetadataIndex *metadata = metadata_index_open (out_dir);
+    MemoryBudget   budget;
+
+    memory_budget_split ((gsize) options.memory_limit << 20,
+                         (gsize) BENCH_SHEET_WIDTH * BENCH_SHEET_HEIGHT * 4, 0,
+                         &budget);
+
+    targets = g_array_sized_new (FALSE, FALSE, sizeof (ThumbTarget), plan->n_cells);
+    for (i = 0; i < plan->n_cells; i++)
+      g_array_append_val (targets, plan->cells[i].thumb);
+
+    queue  = thumb_queue_new (files, (const ThumbTarget *) targets->data, FALSE, filter, metadata,
+                              budget.queue_budget, options.read_ahead);
+    g_array_free (targets, TRUE);
+    writer = sheet_writer_new (SHEET_OUTPUT_PNG, 300, budget.writer_depth);
+    bench_compose (files, plan, queue, NULL, NULL, writer, out_dir, TRUE, NULL);
+    sheet_writer_free (writer);
+    thumb_queue_free (queue);
+    metadata_index_free (metadata);
+  }
+  bench_end (&stages[n_stages++], files->len, start);
+
+  /* The folder's images linked under that many names, through all of it
+   * but the encoder. Each name is a new file to the metadata index, the
+   * probes and the queue. Once the first sheets are done the queue and
+   * the caches are as full as they get, from there on the resident size
+   * should only grow by the index's entries. */
+  soak_dir = g_build_filename (out_dir, "soak", NULL);
+  if (options.soak > 0 && files->len > 0 && g_mkdir (soak_dir, 0700) == 0 &&
+      (many = bench_link_files (files, soak_dir, options.soak)) != NULL)
+    {
+      MetadataIndex *metadata = metadata_index_open (soak_dir);
+      GArray        *rss      = g_array_new (FALSE, FALSE, sizeof (glong));
+      LayoutPlan    *soak_plan;
+      glong          allowed;
+
+      g_printerr ("contactsheet-bench: soaking over %d files\n", options.soak);
+      bench_begin (&stages[n_stages], "soak", &start);
+      probes    = image_probe_files (many);
+      soak_plan = layout_plan_new (&layout, probes, many->len);
+      g_free (probes);
+
+      targets = g_array_sized_new (FALSE, FALSE, sizeof (ThumbTarget), soak_plan->n_cells);
+      for (i = 0; i < soak_plan->n_cells; i++)
+        g_array_append_val (targets, soak_plan->cells[i].thumb);
+
+      queue = thumb_queue_new (many, (const ThumbTarget *) targets->data, FALSE, filter, metadata,
+                               0, options.read_ahead);
+      g_array_free (targets, TRUE);
+      soak.sheets = bench_compose (many, soak_plan, queue, NULL, NULL, NULL, out_dir, TRUE, rss);
+      thumb_queue_free (queue);
+      metadata_index_free (metadata);
+      bench_end (&stages[n_stages++], many->len, start);
+
+      soak.images         = many->len;
+      soak.settled_rss_kb = g_array_index (rss, glong, rss->len / 10);
+      soak.final_rss_kb   = g_array_index (rss, glong, rss->len - 1);
+      allowed             = BENCH_SOAK_SLACK + soak.settled_rss_kb / 20 +
+                            (glong) many->len * 9 / 10 * BENCH_SOAK_PER_FILE / 1024;
+      soak.flat           = soak.final_rss_kb - soak.settled_rss_kb <= allowed;
+
+      g_printerr ("  %-10s %8ld kB after %u sheets, %8ld kB after %u: %s\n",
+                  "rss", soak.settled_rss_kb, rss->len / 10 + 1,
+                  soak.final_rss_kb, rss->len, soak.flat ? "flat" : "GROWING");
+
+      g_array_free (rss, TRUE);
+      layout_plan_free (soak_plan);
+      g_ptr_array_free (many, TRUE);
+    }
+  else if (options.soak > 0 && files->len > 0)
+    {
+      // No links to soak over, which fails the run rather than passing it
+      soak.images = options.soak;
+    }
+  bench_remove_tree (soak_dir);
+  g_free (soak_dir);
+
+  if (options.output != NULL)
+    {
+      out = fopen (options.output, "w");
+      if (out == NULL)
+        {
+          g_printerr ("contactsheet-bench: could not write %s\n", options.output);
+          out = stdout;
+        }
+    }
+  bench_report (out, stages, n_stages, soak.images > 0 ? &soak : NULL, width, height);
+  if (out != stdout)
+    fclose (out);
+
+  bench_remove_tree (out_dir);
+  if (options.folder == NULL && ! options.keep)
+    bench_remove_tree (folder);
+
+  g_free (exifs);
+  layout_plan_free (plan);
+  g_ptr_array_free (files, TRUE);
+  g_strfreev (formats);
+  g_free (out_dir);
+  g_free (folder);
+
+  return soak.images > 0 && ! soak.flat ? 1 : 0;
+}
@@ -0,0 +1,230 @@
+/* GIMP - The GNU Image Manipulation Program
+ * Copyright (C) 2023 Samuel Oldham
+ * Contact sheet plug-in (C) 2023 Samuel Oldham
+ * e-mail: so9010sami@gmail.com
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Colour conversion of thumbnails to the sheet's profile.
+ */
+
+#include "color-profile.h"
+
+typedef enum
+{
+  COLOR_RGB_U8,
+  COLOR_RGBA_U8,
+  COLOR_RGB_U16,
+  COLOR_RGBA_U16,
+  COLOR_N_FORMATS
+} ColorFormat;
+
+/* Source encoding in the image's space, and what it becomes in sRGB */
+static const struct
+{
+  const gchar *src;
+  const gchar *dst;
+} color_formats[COLOR_N_FORMATS] =
+{
+  { "R'G'B' u8",   "R'G'B' u8"  },
+  { "R'G'B'A u8",  "R'G'B'A u8" },
+  { "R'G'B' u16",  "R'G'B' u8"  },
+  { "R'G'B'A u16", "R'G'B'A u8" },
+};
+
+/* Conversions out of one space, made the first time each is needed */
+typedef struct
+{
+  const Babl *fish[COLOR_N_FORMATS];
+} ColorTransform;
+
+static GMutex      color_mutex;
+static GHashTable *color_spaces;          /* ICC profile GBytes -> space, NULL for none */
+static GHashTable *color_transforms;      /* Space -> ColorTransform */
+
+/* Creates the tables, and starts babl for callers that have not brought
+ * up GEGL, such as the dialog's preview. Called with color_mutex held. */
+static void
+color_profile_init (void)
+{
+  if (color_spaces != NULL)
+    return;
+
+  babl_init ();
+
+  color_spaces     = g_hash_table_new_full (g_bytes_hash, g_bytes_equal,
+                                            (GDestroyNotify) g_bytes_unref, NULL);
+  color_transforms = g_hash_table_new_full (g_direct_hash, g_direct_equal,
+                                            NULL, g_free);
+}
+
+/* The profile a loader left on pixbuf as its "icc-profile" option, as
+ * gdk-pixbuf's PNG, JPEG and TIFF loaders and jpeg-load do. NULL when
+ * there is none. */
+GBytes *
+color_profile_get_icc (GdkPixbuf *pixbuf)
+{
+  const gchar *text = gdk_pixbuf_get_option (pixbuf, "icc-profile");
+  guchar      *data;
+  gsize        length;
+
+  if (text == NULL)
+    return NULL;
+
+  data = g_base64_decode (text, &length);
+  if (length == 0)
+    {
+      g_free (data);
+      return NULL;
+    }
+
+  return g_bytes_new_take (data, length);
+}
+
+/* The babl space of icc, or NULL when there is nothing to convert: the
+ * profile is sRGB already, or babl can not use it. Each profile is only
+ * parsed the first time it is seen, and complained about once. */
+const Babl *
+color_profile_space (GBytes *icc)
+{
+  const Babl *space;
+  gpointer    value;
+
+  g_mutex_lock (&color_mutex);
+
+  color_profile_init ();
+
+  if (g_hash_table_lookup_extended (color_spaces, icc, NULL, &value))
+    {
+      space = value;
+    }
+  else
+    {
+      const gchar *error = NULL;
+      gsize        length;
+      const gchar *data  = g_bytes_get_data (icc, &length);
+
+      space = babl_space_from_icc (data, (gint) length,
+                                   BABL_ICC_INTENT_RELATIVE_COLORIMETRIC, &error);
+      if (space == NULL)
+        g_printerr ("contactsheet: leaving images with an unusable colour profile "
+                    "unconverted: %s\n", error ? error : "unknown error");
+      else if (space == babl_space ("sRGB"))
+        space = NULL;
+
+      g_hash_table_insert (color_spaces, g_bytes_ref (icc), (gpointer) space);
+    }
+
+  g_mutex_unlock (&color_mutex);
+
+  return space;
+}
+
+static const Babl *
+color_profile_fish (const Babl  *space,
+                    ColorFormat  format)
+{
+  ColorTransform *transform;
+  const Babl     *fish;
+
+  g_mutex_lock (&color_mutex);
+
+  color_profile_init ();
+
+  transform = g_hash_table_lookup (color_transforms, space);
+  if (transform == NULL)
+    {
+      transform = g_new0 (ColorTransform, 1);
+      g_hash_table_insert (color_transforms, (gpointer) space, transform);
+    }
+
+  if (transform->fish[format] == NULL)
+    transform->fish[format] =
+      babl_fish (babl_format_with_space (color_formats[format].src, space),
+                 babl_format (color_formats[format].dst));
+  fish = transform->fish[format];
+
+  g_mutex_unlock (&color_mutex);
+
+  return fish;
+}
+
+/* Converts src, pixels of depth in space laid out like dst, into dst as
+ * 8-bit sRGB. The work is babl's, which has SIMD paths for 8 and 16 bit
+ * RGB and picks the best the CPU runs. */
+void
+color_profile_convert (const Babl    *space,
+                       ResampleDepth  depth,
+                       gboolean       has_alpha,
+                       const guchar  *src,
+                       gint           src_stride,
+                       GdkPixbuf     *dst)
+{
+  ColorFormat format;
+
+  if (depth == RESAMPLE_U16)
+    format = has_alpha ? COLOR_RGBA_U16 : COLOR_RGB_U16;
+  else
+    format = has_alpha ? COLOR_RGBA_U8 : COLOR_RGB_U8;
+
+  babl_process_rows (color_profile_fish (space, format),
+                     src, src_stride,
+                     gdk_pixbuf_get_pixels (dst), gdk_pixbuf_get_rowstride (dst),
+                     gdk_pixbuf_get_width (dst), gdk_pixbuf_get_height (dst));
+}
+
+/* Converts an 8-bit pixbuf in space to sRGB, taking over the reference.
+ * With a NULL space, or no pixbuf, pixbuf is handed back as it is. */
+GdkPixbuf *
+color_profile_convert_pixbuf (GdkPixbuf  *pixbuf,
+                              const Babl *space)
+{
+  GdkPixbuf *converted;
+
+  if (space == NULL || pixbuf == NULL)
+    return pixbuf;
+
+  converted = gdk_pixbuf_new (GDK_COLORSPACE_RGB,
+                              gdk_pixbuf_get_has_alpha (pixbuf), 8,
+                              gdk_pixbuf_get_width (pixbuf),
+                              gdk_pixbuf_get_height (pixbuf));
+  if (converted == NULL)
+    return pixbuf;
+
+  color_profile_convert (space, RESAMPLE_U8, gdk_pixbuf_get_has_alpha (pixbuf),
+                         gdk_pixbuf_read_pixels (pixbuf),
+                         gdk_pixbuf_get_rowstride (pixbuf),
+                         converted);
+  g_object_unref (pixbuf);
+
+  return converted;
+}
+
+/* Drops every cached space and conversion, at the end of a run */
+void
+color_profile_clear (void)
+{
+  g_mutex_lock (&color_mutex);
+
+  if (color_spaces != NULL)
+    {
+      g_clear_pointer (&color_transforms, g_hash_table_unref);
+      g_clear_pointer (&color_spaces, g_hash_table_unref);
+      babl_exit ();
+    }
+
+  g_mutex_unlock (&color_mutex);
+}
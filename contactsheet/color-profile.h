@@ -0,0 +1,52 @@
+/* GIMP - The GNU Image Manipulation Program
+ * Copyright (C) 2023 Samuel Oldham
+ * Contact sheet plug-in (C) 2023 Samuel Oldham
+ * e-mail: so9010sami@gmail.com
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#ifndef __CONTACTSHEET_COLOR_PROFILE_H__
+#define __CONTACTSHEET_COLOR_PROFILE_H__
+
+#include <glib.h>
+#include <gdk-pixbuf/gdk-pixbuf.h>
+#include <babl/babl.h>
+
+#include "resample.h"
+
+/* Brings thumbnails from the colour space embedded in their file to the
+ * sheet's, sRGB. It is done after they are shrunk, so only the cell's
+ * pixels are converted rather than the whole image's. The babl space for
+ * each distinct profile, and the conversions out of it, are made once
+ * and kept until color_profile_clear (). Profiles babl can not use, and
+ * images without one, are left as they are. Safe on any thread. */
+
+GBytes     *color_profile_get_icc        (GdkPixbuf     *pixbuf);
+
+const Babl *color_profile_space          (GBytes        *icc);
+
+void        color_profile_convert        (const Babl    *space,
+                                          ResampleDepth  depth,
+                                          gboolean       has_alpha,
+                                          const guchar  *src,
+                                          gint           src_stride,
+                                          GdkPixbuf     *dst);
+
+GdkPixbuf  *color_profile_convert_pixbuf (GdkPixbuf     *pixbuf,
+                                          const Babl    *space);
+
+void        color_profile_clear          (void);
+
+#endif /* __CONTACTSHEET_COLOR_PROFILE_H__ */
@@ -27,14 +27,45 @@
 #include <glib.h>
 
 #include <gexiv2/gexiv2.h>
+#include <cairo-pdf.h>
+
+#ifdef G_OS_UNIX
+#include <glib-unix.h>
+#include <signal.h>
+#endif
+
+#include "color-profile.h"
+#include "folder-scan.h"
+#include "folder-watch.h"
+#include "image-probe.h"
+#include "layout.h"
+#include "manifest.h"
+#include "memory-budget.h"
+#include "preview.h"
+#include "resample.h"
+#include "sheet.h"
+#include "scratch.h"
+#include "sheet-writer.h"
+#include "thumbnail.h"
+#include "trace.h"
 
 #define PLUG_IN_PROC        "plug-in-contactsheet"
+#define PLUG_IN_MERGE_PROC  "plug-in-contactsheet-merge"
 #define PLUG_IN_BINARY      "contactsheet"
 #define PLUG_IN_ROLE        "gimp-contactsheet"
 
 #define NAME_LEN            256
 #define SHEET_RES           300
 
+/* Images arriving in a watched folder within this many ms are written out together */
+#define WATCH_WRITE_DELAY   150
+
+/* Raster sheets bigger than this are composed a row of cells at a time */
+#define SHEET_BAND_BYTES    (256 << 20)
+
+#define PREVIEW_WIDTH       320
+#define PREVIEW_HEIGHT      240
+
 /* Variables to set in dialog box */
 typedef struct
 {
@@ -62,8 +93,79 @@ typedef struct
   gboolean        ISO;
   gboolean        exposure;
 
+  gboolean        cache_thumbnails;       /* Keep thumbnails in ~/.cache/thumbnails between runs */
+  gboolean        keep_layers;            /* A layer per image and caption instead of drawing into the background */
+  gint            output;                 /* SheetOutput, open the sheets or write them next to file_prefix */
+  gboolean        recursive;              /* Take images from the subfolders too */
+  gint            memory_limit;           /* Megabytes the run tries to stay under, 0 for no limit */
+  gint            resample;               /* ResampleFilter the images are shrunk with */
+  gchar           tiers[NAME_LEN];        /* Lower resolutions exported sheets are also written at, "72,150" */
+  gint            shard_index;            /* Which slice of the folder's sheets this run makes */
+  gint            shard_count;            /* How many processes share the folder, 0 or 1 for one */
+  gint            layout;                 /* LayoutKind, how the cells are placed */
+  gboolean        watch;                  /* Keep adding the images that arrive to the sheets until stopped */
+  gint            read_ahead;             /* Files read ahead of the decoders, 0 for none */
+
 } SheetVals;
 
+/* The sheet being filled, a GIMP image or, when it only goes to disk, a pixbuf */
+typedef struct
+{
+  gint32          image_ID;               /* -1 when the sheet is not a GIMP image */
+  gint32          layer_ID;               /* Background layer of image_ID */
+  GdkPixbuf      *pixbuf;                 /* In-memory sheet, NULL for a GIMP image */
+  Sheet          *sheet;                  /* Direct compositing, NULL when layers are kept */
+  cairo_t        *document;               /* PDF every sheet is a page of, kept across sheets */
+
+  /* A sheet too big to hold whole is composed in bands, pixbuf holding
+   * the one starting at sheet row band_top, and written as it goes */
+  SheetStream    *stream;
+  gint            band_height;            /* 0 when whole sheets are held */
+  gint            band_top;
+  gint            width;
+  gint            height;
+  const SheetStyle *style;
+  SheetText      *text;
+} SheetTarget;
+
+/* The dialog entries the preview is drawn from */
+typedef struct
+{
+  GtkWidget      *file_entry;
+  GtkWidget      *width;
+  GtkWidget      *gap;
+  GtkWidget      *row_column;
+  GtkWidget      *caption_text_size;
+  GtkWidget      *sheet_res;
+  guchar          foreground[3];
+  SheetPreview   *preview;
+} SheetDialog;
+
+/* The last sheet of a watched folder, which the images that arrive are
+ * added to. It is held whole, with the thumbnail and caption values of
+ * each of its images, so a new image costs one decode even when the
+ * others have to be laid out and drawn again. */
+typedef struct
+{
+  GPtrArray      *files;                  /* On the sheet, in the order they came */
+  GArray         *probes;                 /* ImageProbe of each */
+  GArray         *exifs;                  /* ExifInfo of each */
+  GPtrArray      *thumbs;                 /* GdkPixbuf of each, NULL when unreadable */
+  GArray         *decoded;                /* ThumbTarget each thumbnail was made for */
+  LayoutPlan     *plan;                   /* Of files, which all fit on the one sheet */
+  GdkPixbuf      *pixbuf;
+  Sheet          *sheet;                  /* Drawing into pixbuf */
+  GHashTable     *known;                  /* Every file on a sheet so far */
+  const LayoutSettings *layout;
+  const SheetStyle *style;
+  SheetText      *text;
+  SheetWriter    *writer;
+  Manifest       *manifest;
+  MetadataIndex  *metadata;
+  guint           write_id;               /* Pending write of the sheet, 0 when there is none */
+  guint           n_added;
+} SheetWatch;
+
 // Declare local functions
 static void       query               (void);
 static void       run                 (const gchar      *name,
@@ -72,24 +174,120 @@ static void       run                 (const gchar      *name,
                                        gint             *nreturn_vals,
                                        GimpParam       **return_vals);
 
-static gboolean   is_image_file       (GFile *file);
-
-static gint32     add_image           (const gchar    *file,
-                                       guint32        *image_ID_dst,
-                                       guint32        *layer_ID,
-                                       gint            dst_width, 
-                                       gint            dst_height);
+static void       finish_sheet        (gint32          image_ID,
+                                       gboolean        display);
 
-static gint32     add_caption         (const gchar    *file_dir,
-                                       guint32 *image_ID_dst,
-                                       guint32 *layer_ID,
-                                       gint     dst_width);
+static void       begin_sheet         (SheetTarget    *target,
+                                       SheetWriter    *writer,
+                                       guint           width,
+                                       guint           height,
+                                       const SheetStyle *style,
+                                       SheetText      *text);
+
+static void       end_sheet           (SheetTarget    *target,
+                                       SheetWriter    *writer,
+                                       gboolean        display,
+                                       GArray         *sheets);
+
+static void       begin_band          (SheetTarget    *target);
+static void       end_band            (SheetTarget    *target,
+                                       gint            bottom);
+static void       next_band           (SheetTarget    *target,
+                                       gint            top);
+
+static guint      watch_folder        (GPtrArray      *files,
+                                       const LayoutPlan *plan,
+                                       const LayoutSettings *layout,
+                                       const SheetStyle *style,
+                                       SheetText      *text,
+                                       SheetWriter    *writer,
+                                       Manifest       *manifest,
+                                       MetadataIndex  *metadata,
+                                       const gchar    *skip_prefix,
+                                       gboolean        interactive);
+static void       watch_append        (SheetWatch     *watch,
+                                       const gchar    *file);
+static void       watch_file_added    (const gchar    *file,
+                                       gpointer        user_data);
+static void       watch_draw          (SheetWatch     *watch,
+                                       const LayoutPlan *old);
+static gboolean   watch_write         (gpointer        user_data);
+#ifdef G_OS_UNIX
+static gboolean   watch_stop          (gpointer        user_data);
+#endif
+static void       watch_dialog_run    (void);
+
+static gchar     *sheet_output_path   (guint           number);
+static gchar     *manifest_path       (gint            shard_index);
+static GimpPDBStatusType merge_shards (const gchar    *folder,
+                                       const gchar    *prefix,
+                                       gint            shard_count,
+                                       gint           *n_sheets);
+static gchar    **sheet_output_paths  (guint           number);
+static GArray    *parse_tiers         (const gchar    *text,
+                                       gint            sheet_res);
+
+static gchar     *output_path         (gchar          *name);
+
+static Manifest  *open_manifest       (const SheetStyle *style);
+
+static gboolean  *plan_sheets         (Manifest       *manifest,
+                                       GPtrArray      *files,
+                                       const LayoutPlan *plan,
+                                       GPtrArray      *todo,
+                                       GArray         *targets);
+
+static cairo_t   *begin_document      (gdouble         width,
+                                       gdouble         height);
+
+static gboolean   end_document        (cairo_t        *document);
+
+static GdkPixbuf *drawable_to_pixbuf  (gint32          drawable_ID);
+
+static GdkPixbuf *drawable_resample   (gint32          image_ID,
+                                       gint32          drawable_ID,
+                                       gint            width,
+                                       gint            height);
+
+static CaptionFields caption_fields  (void);
+
+static void       format_caption      (const ExifInfo *exif,
+                                       gchar          *captionBuffer,
+                                       gsize           size);
+
+static void       report_throughput   (guint           n_images,
+                                       guint           n_sheets,
+                                       gdouble         seconds);
+
+static GdkPixbuf *load_fallback       (const gchar    *file,
+                                       const ThumbTarget *target);
+
+static Sheet     *begin_direct_sheet  (gint32          layer_ID,
+                                       const SheetStyle *style,
+                                       SheetText      *text);
+
+static gint32     add_caption         (const gchar    *caption,
+                                       const SheetStyle *style,
+                                       gint32          image_ID_dst,
+                                       gint            dst_width);
+
+static gint32     add_thumbnail       (GdkPixbuf      *pixbuf,
+                                       const gchar    *name,
+                                       gint32          image_ID_dst,
+                                       gint            dst_width);
 
 static gint32     create_new_image    (guint           file_num,
                                        guint           width,
                                        guint           height,
                                        gint32         *layer_ID);
 
+static void       update_preview      (GtkWidget      *widget,
+                                       SheetDialog    *dialog);
+static void       caption_font_set    (GimpFontSelectButton *button,
+                                       const gchar    *font_name,
+                                       gboolean        dialog_closing,
+                                       SheetDialog    *dialog);
+
 static gboolean   contact_sheet_dialog(gint32                image_ID);
 
 GimpPlugInInfo PLUG_IN_INFO =
@@ -124,435 +322,1826 @@ static SheetVals sheetvals =
   TRUE,
   TRUE,
   TRUE,
-  TRUE
+  TRUE,
+
+  TRUE,           /* Cache thumbnails */
+  FALSE,          /* Keep layers */
+  SHEET_OUTPUT_DISPLAY,
+  FALSE,          /* Recursive */
+  0,              /* Memory limit */
+  RESAMPLE_LANCZOS3,
+  "",             /* No extra resolutions */
+  0, 0,           /* Not sharded */
+  LAYOUT_GRID,
+  FALSE,          /* Watch */
+  16              /* Read ahead */
+};
+
+
+static gint sheet_number = 0;
+static GArray *sheet_tiers = NULL;         /* The tiers as dpi, parsed once a run starts */
+
+/* Declared here so run() can check a non-interactive call against it */
+static const GimpParamDef args[] =
+{
+  { GIMP_PDB_INT32,    "run-mode",     "The run mode { RUN-INTERACTIVE (0), RUN-NONINTERACTIVE (1) }" },
+  { GIMP_PDB_IMAGE,    "image",        "Input image (unused)" },
+  { GIMP_PDB_DRAWABLE, "drawable",     "Input drawable" },
+
+  { GIMP_PDB_FLOAT,    "sheet-res",     "Resolution of the sheet" },
+  { GIMP_PDB_FLOAT,    "sheet-width",   "Contact sheet Width" },
+  { GIMP_PDB_FLOAT,    "sheet-height",  "Contact sheet height" },
+  { GIMP_PDB_INT32,    "w-h-type",      "Data type for width and height, {PIXEL (0), INCH (1), MM (2), POINT (3)}" },
+  { GIMP_PDB_FLOAT,    "gap-vert",      "Vertical gaps between images" },
+  { GIMP_PDB_FLOAT,    "gap-horiz",     "Horizontal gaps between images" },
+  { GIMP_PDB_INT32,    "vg-hg-type",    "Data type for gaps, {PIXEL (0), INCH (1), MM (2), POINT (3)}" },
+  { GIMP_PDB_INT32,    "row",           "Number of rows" },
+  { GIMP_PDB_INT32,    "column",        "Number of columns" },
+  { GIMP_PDB_INT32,    "rotate-images", "Rotate to horizontal { FALSE (0), TRUE (1) }" },
+  { GIMP_PDB_INT32,    "flatten",       "Flatten to one layer { FALSE (0), TRUE (1) }" },
+  { GIMP_PDB_STRING,   "fontname",      "Font name for the whole sheet" },
+  { GIMP_PDB_FLOAT,    "caption-size",  "Size of the captions" },
+  { GIMP_PDB_INT32,    "cs-type",       "Data type for font, {PIXEL (0), INCH (1), MM (2), POINT (3)}" },
+
+  { GIMP_PDB_STRING,   "file-dir-tree", "File directory to the folder containing the files" },
+
+  { GIMP_PDB_INT32,    "file-name",     "Show file name { FALSE (0), TRUE (1) }" },
+  { GIMP_PDB_INT32,    "aperture",      "show aperture { FALSE (0), TRUE (1) }" },
+  { GIMP_PDB_INT32,    "focal-length",  "Show focal length { FALSE (0), TRUE (1) }" },
+  { GIMP_PDB_INT32,    "ISO",           "Show ISO speed { FALSE (0), TRUE (1) }" },
+  { GIMP_PDB_INT32,    "exposure",      "Show exposure time { FALSE (0), TRUE (1) }" },
+
+  { GIMP_PDB_STRING,   "file-prefix",   "Name the sheets are given, a number is appended" },
+  { GIMP_PDB_INT32,    "cache-thumbnails", "Keep thumbnails in ~/.cache/thumbnails { FALSE (0), TRUE (1) }" },
+  { GIMP_PDB_INT32,    "keep-layers",   "A layer per image and caption, for editing { FALSE (0), TRUE (1) }" },
+  { GIMP_PDB_INT32,    "output",        "Where the sheets go, written as file-prefix_N when not opened, or as the pages of "
+                                        "file-prefix.pdf, and then no images are returned "
+                                        "{ DISPLAY (0), PNG (1), JPEG (2), TIFF (3), PDF (4) }" },
+  { GIMP_PDB_INT32,    "recursive",     "Include the images in subfolders { FALSE (0), TRUE (1) }" },
+  { GIMP_PDB_INT32,    "memory-limit",  "Megabytes the run tries to stay under by decoding and queueing less, 0 for no limit" },
+  { GIMP_PDB_INT32,    "resample",      "How images are shrunk to their cell { BOX (0), LANCZOS3 (1) }" },
+  { GIMP_PDB_STRING,   "tiers",         "Lower resolutions every PNG, JPEG or TIFF sheet is also written at, "
+                                        "comma separated, as file-prefix_RESdpi_N; empty for none" },
+  { GIMP_PDB_INT32,    "shard-index",   "Which of shard-count slices of the sheets this run makes, from 0" },
+  { GIMP_PDB_INT32,    "shard-count",   "Split the sheets into this many slices made by separate runs, each leaving "
+                                        "file-prefix.shard-I-of-N.manifest for plug-in-contactsheet-merge; "
+                                        "PNG, JPEG and TIFF only, 0 or 1 for the whole folder" },
+  { GIMP_PDB_INT32,    "layout",        "How the cells are placed: rows by columns, rows of equal height filling "
+                                        "the width, or columns of equal width "
+                                        "{ GRID (0), JUSTIFIED (1), MASONRY (2) }" },
+  { GIMP_PDB_INT32,    "watch",         "Then keep watching the folder, adding each image written to it to the "
+                                        "last sheet and starting new ones as they fill, until stopped; "
+                                        "PNG, JPEG and TIFF only { FALSE (0), TRUE (1) }" },
+  { GIMP_PDB_INT32,    "read-ahead",    "How many files past those being decoded are read from the disk early, "
+                                        "in the order they lie on it; 0 for none" },
 };
 
+static const GimpParamDef merge_args[] =
+{
+  { GIMP_PDB_INT32,    "run-mode",      "The run mode { RUN-NONINTERACTIVE (1) }" },
+  { GIMP_PDB_STRING,   "file-dir-tree", "File directory to the folder containing the files" },
+  { GIMP_PDB_STRING,   "file-prefix",   "Name the sheets were given" },
+  { GIMP_PDB_INT32,    "shard-count",   "How many shards the sheets were split into" },
+};
+
+MAIN()
+
+static void
+query (void)
+{
+  static const GimpParamDef return_vals[] =
+  {
+    { GIMP_PDB_IMAGE,      "new-image",  "First sheet" },
+    { GIMP_PDB_INT32,      "num-sheets", "Number of sheets made" },
+    { GIMP_PDB_INT32ARRAY, "sheet-ids",  "Every sheet made, in order" }
+  };
+  static const GimpParamDef merge_return_vals[] =
+  {
+    { GIMP_PDB_INT32,      "num-sheets", "Number of sheets the shards made together" }
+  };
+
+  gimp_install_procedure (
+    PLUG_IN_PROC,
+    "Contact sheet creator",
+    "Creates a contact sheet from a folder of images."
+    "You set the colour of the text with the forground colour,"
+    "and the background with the background color."
+    "There are options to control size, gaps, etc.",
+    "Samuel Oldham",
+    "Samuel Oldham",
+    "2023",
+    "Contact sheet",
+    NULL,
+    GIMP_PLUGIN,
+    G_N_ELEMENTS (args),
+    G_N_ELEMENTS (return_vals),
+    args, return_vals);
+
+  gimp_plugin_menu_register (PLUG_IN_PROC,
+                             "<Image>/File/Create");
+
+  gimp_install_procedure (
+    PLUG_IN_MERGE_PROC,
+    "Checks a sharded contact sheet run is complete",
+    "Combines the manifests left by every shard of a plug-in-contactsheet run "
+    "split with shard-count into file-prefix.manifest, and fails unless each "
+    "sheet was made and is on disk. Sheets a longer earlier run left past the "
+    "end are deleted.",
+    "Samuel Oldham",
+    "Samuel Oldham",
+    "2023",
+    NULL,
+    NULL,
+    GIMP_PLUGIN,
+    G_N_ELEMENTS (merge_args),
+    G_N_ELEMENTS (merge_return_vals),
+    merge_args, merge_return_vals);
+}
+
+static void
+run (const gchar      *name,
+     gint              nparams,
+     const GimpParam  *param,
+     gint             *nreturn_vals,
+     GimpParam       **return_vals)
+{
+  static GimpParam  values[4];
+  GimpPDBStatusType status = GIMP_PDB_SUCCESS;
+  gint32            image_ID;
+  gdouble           sheet_width;
+  gdouble           sheet_height;
+  gdouble           gap_vert;
+  gdouble           gap_horiz;
+
+  gboolean          captions;
+
+  gchar            *filed;
+  GPtrArray        *files;
+  ThumbQueue       *queue;
+  MetadataIndex    *metadata = NULL;
+  Manifest         *manifest = NULL;
+  GPtrArray        *todo;
+  GArray           *targets;
+  ImageProbe       *probes;
+  LayoutSettings    layout;
+  LayoutPlan       *plan;
+  gboolean         *reuse = NULL;
+  guint             n_composed = 0;
+  guint             n_reused = 0;
+  guint             sheet = 0;
+  guint             first_sheet = 0;
+  guint             total_sheets = 0;
+  gboolean          started = FALSE;
+  Scratch          *scratch;
+  guint             i;
+
+  GArray           *sheets;
+  gint64            start_time;
+  gdouble           seconds;
+  
+  GimpRunMode run_mode = param[0].data.d_int32;
+
+  *nreturn_vals = 4;
+  *return_vals  = values;
+
+  values[0].type                 = GIMP_PDB_STATUS;
+  values[0].data.d_status        = status;
+  values[1].type                 = GIMP_PDB_IMAGE;
+  values[1].data.d_int32         = -1;
+  values[2].type                 = GIMP_PDB_INT32;
+  values[2].data.d_int32         = 0;
+  values[3].type                 = GIMP_PDB_INT32ARRAY;
+  values[3].data.d_int32array    = NULL;
+
+  if (strcmp (name, PLUG_IN_MERGE_PROC) == 0)
+  {
+    *nreturn_vals = 2;
+    values[1].type = GIMP_PDB_INT32;
+    values[1].data.d_int32 = 0;
+
+    if (nparams != G_N_ELEMENTS (merge_args) || param[3].data.d_int32 < 1 ||
+        param[1].data.d_string == NULL || param[2].data.d_string == NULL)
+      values[0].data.d_status = GIMP_PDB_CALLING_ERROR;
+    else
+      values[0].data.d_status = merge_shards (param[1].data.d_string, param[2].data.d_string,
+                                              param[3].data.d_int32, &values[1].data.d_int32);
+    return;
+  }
+
+  switch (run_mode)
+  {
+    case GIMP_RUN_INTERACTIVE:
+      /* Try and get data*/
+      gimp_get_data (PLUG_IN_PROC, &sheetvals);
+
+      /*  First acquire information with a dialog  */
+      if (! contact_sheet_dialog (param[1].data.d_int32))
+      {
+        return;
+      }
+    break;
+    
+    case GIMP_RUN_NONINTERACTIVE:
+      // The font, folder and prefix have no sensible default to fall back on
+      if (nparams != G_N_ELEMENTS (args) ||
+          param[14].data.d_string == NULL ||
+          param[17].data.d_string == NULL ||
+          param[23].data.d_string == NULL)
+      {
+        status = GIMP_PDB_CALLING_ERROR;
+        break;
+      }
+
+      sheetvals.sheet_res     = param[3].data.d_float;
+      sheetvals.sheet_width   = param[4].data.d_float;
+      sheetvals.sheet_height  = param[5].data.d_float;
+      sheetvals.w_h_type      = param[6].data.d_int32;
+      sheetvals.gap_vert      = param[7].data.d_float;
+      sheetvals.gap_horiz     = param[8].data.d_float;
+      sheetvals.vg_hg_type    = param[9].data.d_int32;
+      sheetvals.row           = param[10].data.d_int32;
+      sheetvals.column        = param[11].data.d_int32;
+      sheetvals.rotate_images = param[12].data.d_int32 ? TRUE : FALSE;
+      sheetvals.flatten       = param[13].data.d_int32 ? TRUE : FALSE;
+      g_strlcpy (sheetvals.fontname, param[14].data.d_string, NAME_LEN);
+      sheetvals.caption_size  = param[15].data.d_float;
+      sheetvals.cs_type       = param[16].data.d_int32;
+      g_strlcpy (sheetvals.file_dir_tree, param[17].data.d_string, NAME_LEN);
+      sheetvals.file_name     = param[18].data.d_int32 ? TRUE : FALSE;
+      sheetvals.aperture      = param[19].data.d_int32 ? TRUE : FALSE;
+      sheetvals.focal_length  = param[20].data.d_int32 ? TRUE : FALSE;
+      sheetvals.ISO           = param[21].data.d_int32 ? TRUE : FALSE;
+      sheetvals.exposure      = param[22].data.d_int32 ? TRUE : FALSE;
+      g_strlcpy (sheetvals.file_prefix, param[23].data.d_string, NAME_LEN);
+      sheetvals.cache_thumbnails = param[24].data.d_int32 ? TRUE : FALSE;
+      sheetvals.keep_layers   = param[25].data.d_int32 ? TRUE : FALSE;
+      sheetvals.output        = param[26].data.d_int32;
+      sheetvals.recursive     = param[27].data.d_int32 ? TRUE : FALSE;
+      sheetvals.memory_limit  = param[28].data.d_int32;
+      sheetvals.resample      = param[29].data.d_int32;
+      g_strlcpy (sheetvals.tiers, param[30].data.d_string ? param[30].data.d_string : "", NAME_LEN);
+      sheetvals.shard_index   = param[31].data.d_int32;
+      sheetvals.shard_count   = param[32].data.d_int32;
+      sheetvals.layout        = param[33].data.d_int32;
+      sheetvals.watch         = param[34].data.d_int32 ? TRUE : FALSE;
+      sheetvals.read_ahead    = param[35].data.d_int32;
+
+      if (sheetvals.sheet_res <= 0 || sheetvals.row <= 0 || sheetvals.column <= 0 ||
+          sheetvals.output < SHEET_OUTPUT_DISPLAY || sheetvals.output > SHEET_OUTPUT_PDF ||
+          sheetvals.memory_limit < 0 || sheetvals.read_ahead < 0 ||
+          sheetvals.resample < RESAMPLE_BOX || sheetvals.resample > RESAMPLE_LANCZOS3 ||
+          sheetvals.layout < LAYOUT_GRID || sheetvals.layout > LAYOUT_MASONRY ||
+          sheetvals.shard_count < 0 || sheetvals.shard_index < 0 ||
+          sheetvals.shard_index >= MAX (sheetvals.shard_count, 1) ||
+          (sheetvals.shard_count > 1 &&
+           (sheetvals.output == SHEET_OUTPUT_DISPLAY || sheetvals.output == SHEET_OUTPUT_PDF)) ||
+          ! g_file_test (sheetvals.file_dir_tree, G_FILE_TEST_IS_DIR))
+      {
+        status = GIMP_PDB_CALLING_ERROR;
+      }
+    break;
+
+    case GIMP_RUN_WITH_LAST_VALS:
+      gimp_get_data (PLUG_IN_PROC, &sheetvals);
+    break;
+
+    default:
+      break;
+  }
+
+  // Typed into the dialog or passed in, either way only known good once a run starts
+  if (status == GIMP_PDB_SUCCESS)
+  {
+    sheet_tiers = parse_tiers (sheetvals.tiers, sheetvals.sheet_res);
+    if (sheet_tiers == NULL)
+    {
+      g_message ("Extra resolutions have to be whole numbers below the sheet's %d dpi, "
+                 "separated by commas", sheetvals.sheet_res);
+      status = GIMP_PDB_CALLING_ERROR;
+    }
+  }
+
+  // A watched folder's last sheet is held in memory and rewritten as it fills
+  if (status == GIMP_PDB_SUCCESS && sheetvals.watch &&
+      (sheetvals.output == SHEET_OUTPUT_DISPLAY || sheetvals.output == SHEET_OUTPUT_PDF ||
+       sheetvals.keep_layers || sheetvals.shard_count > 1))
+  {
+    g_message ("Only PNG, JPEG and TIFF sheets without layers can keep watching the folder, "
+               "and not when the run is split into shards");
+    status = GIMP_PDB_CALLING_ERROR;
+  }
+  
+  if (status == GIMP_PDB_SUCCESS && sheetvals.file_dir_tree[0] != 'N')
+    {
+      gint32          image_ID_dst;
+      gint32          layer_ID_src;
+
+      SheetStyle      style;
+      SheetText      *text = NULL;
+      SheetTarget     target;
+      SheetWriter    *writer = NULL;
+      gchar          *output_stem = NULL;
+      MemoryBudget    budget;
+
+      gint64          span;
+      gint            progress = -1;
+      gsize           sheet_bytes;
+      gsize           tier_bytes = 0;
+      gboolean        fits;
+
+      gegl_init (NULL, NULL);
+      trace_open ();
+      gimp_progress_init ("Composing images");
+
+      start_time = g_get_monotonic_time ();
+      sheets = g_array_new (FALSE, FALSE, sizeof (gint32));
+
+      sheet_width = gimp_units_to_pixels (sheetvals.sheet_width, sheetvals.w_h_type, sheetvals.sheet_res);
+      sheet_height = gimp_units_to_pixels (sheetvals.sheet_height, sheetvals.w_h_type, sheetvals.sheet_res);
+      
+      gap_vert = gimp_units_to_pixels (sheetvals.gap_vert, sheetvals.vg_hg_type, sheetvals.sheet_res);
+      gap_horiz = gimp_units_to_pixels (sheetvals.gap_horiz, sheetvals.vg_hg_type, sheetvals.sheet_res);
+
+      captions = (sheetvals.file_name || sheetvals.aperture || sheetvals.focal_length || sheetvals.ISO || sheetvals.exposure);
+
+      // Captions take the context's foreground, like text layers do
+      {
+        GimpRGB foreground;
+
+        gimp_context_get_foreground (&foreground);
+        gimp_rgb_get_uchar (&foreground,
+                            &style.foreground[0], &style.foreground[1], &style.foreground[2]);
+
+        style.fontname     = sheetvals.fontname;
+        style.caption_size = gimp_units_to_pixels (sheetvals.caption_size, sheetvals.cs_type, sheetvals.sheet_res);
+        style.background[0] = style.background[1] = style.background[2] = 255;
+      }
+
+      /* The caption is a single line, so its height only depends on the
+       * font. Measure it once so the layout knows what is left for images. */
+      layout.caption_height = 0;
+      if (captions)
+      {
+        text = sheet_text_new (&style);
+        layout.caption_height = sheet_text_get_height (text);
+      }
+
+      // Sheets from an earlier run written into the folder itself are not images to put on this one
+      if (sheetvals.output != SHEET_OUTPUT_DISPLAY)
+      {
+        gchar *first = sheet_output_path (0);
+        gchar *dirname = g_path_get_dirname (first);
+        gchar *output_dir = g_canonicalize_filename (dirname, NULL);
+        gchar *folder = g_canonicalize_filename (sheetvals.file_dir_tree, NULL);
+
+        if (g_strcmp0 (output_dir, folder) == 0)
+        {
+          gchar *basename = g_path_get_basename (sheetvals.file_prefix);
+
+          output_stem = g_strconcat (basename, "_", NULL);
+          g_free (basename);
+        }
+
+        g_mkdir_with_parents (output_dir, 0755);
+
+        g_free (folder);
+        g_free (output_dir);
+        g_free (dirname);
+        g_free (first);
+      }
+
+      // Collect the images first so they can be decoded ahead of composing
+      span = TRACE_START ();
+      files = folder_scan (sheetvals.file_dir_tree, sheetvals.recursive, output_stem);
+      TRACE_END ("main", "scan", span, sheetvals.file_dir_tree, 0, 0);
+
+      // The probes and the workers read RAW files through gexiv2 whether or not there are captions
+      gexiv2_initialize ();
+
+      /* Every cell of every sheet is placed up front from the image
+       * headers alone, so the workers decode each image straight to the
+       * size it has on the sheet */
+      span = TRACE_START ();
+      probes = image_probe_files (files);
+
+      layout.kind    = sheetvals.layout;
+      layout.width   = sheet_width;
+      layout.height  = sheet_height;
+      layout.gap_x   = gap_vert;
+      layout.gap_y   = gap_horiz;
+      layout.rows    = sheetvals.row;
+      layout.columns = sheetvals.column;
+      layout.rotate  = sheetvals.rotate_images;
+      plan = layout_plan_new (&layout, probes, files->len);
+      g_free (probes);
+      TRACE_END ("main", "layout", span, NULL, 0, 0);
+
+      /* A shard only takes the files of its own sheets, which keep the
+       * numbers they have in the whole folder, so every shard can write
+       * next to the others without asking them. Each shard lays out the
+       * whole folder, where a sheet starts depends on every image before. */
+      if (sheetvals.shard_count > 1)
+      {
+        guint last;
+        guint first_file;
+        guint end_file;
+
+        total_sheets = plan->n_sheets;
+        first_sheet  = (guint64) total_sheets * sheetvals.shard_index / sheetvals.shard_count;
+        last         = (guint64) total_sheets * (sheetvals.shard_index + 1) / sheetvals.shard_count;
+        first_file   = plan->sheet_first[first_sheet];
+        end_file     = plan->sheet_first[last];
+
+        g_ptr_array_remove_range (files, end_file, files->len - end_file);
+        g_ptr_array_remove_range (files, 0, first_file);
+        layout_plan_crop (plan, first_sheet, last);
+        sheet_number = first_sheet;
+      }
+
+      /* Under a memory limit fewer sheets wait for the writer, fewer
+       * files are decoded at once and ahead, and GEGL caches less */
+      sheet_bytes = (gsize) sheet_width * sheet_height * 4;
+      if (sheetvals.output != SHEET_OUTPUT_DISPLAY && sheetvals.output != SHEET_OUTPUT_PDF)
+      {
+        // The writer holds one copy at a lower resolution at a time, the biggest counts
+        for (i = 0; i < sheet_tiers->len; i++)
+        {
+          gdouble scale = (gdouble) g_array_index (sheet_tiers, gint, i) / sheetvals.sheet_res;
+
+          tier_bytes = MAX (tier_bytes, (gsize) (sheet_width * scale + 1) * (gsize) (sheet_height * scale + 1) * 4);
+        }
+      }
+      fits = memory_budget_split ((gsize) sheetvals.memory_limit << 20, sheet_bytes, tier_bytes, &budget);
+
+      /* A raster sheet that is huge, or will not fit, is composed a band
+       * of cells at a time and streamed to disk, so only a band is ever
+       * held. Sheets that become GIMP images are held by GIMP and cannot be. */
+      target.band_height = 0;
+      if ((sheetvals.output == SHEET_OUTPUT_PNG  ||
+           sheetvals.output == SHEET_OUTPUT_JPEG ||
+           sheetvals.output == SHEET_OUTPUT_TIFF) &&
+          ! sheetvals.keep_layers &&
+          (! fits || sheet_bytes > SHEET_BAND_BYTES))
+      {
+        target.band_height = MIN (plan->max_cell_height + (gint) (2 * gap_horiz) + 2,
+                                  (gint) sheet_height);
+        sheet_bytes = (gsize) sheet_width * target.band_height * 4;
+        fits = memory_budget_split ((gsize) sheetvals.memory_limit << 20, sheet_bytes, 0, &budget);
+      }
+      if (! fits)
+      {
+        g_printerr ("%s: a %d MB memory limit is too small for %.0f x %.0f sheets, "
+                    "it will be exceeded\n",
+                    PLUG_IN_BINARY, sheetvals.memory_limit, sheet_width, sheet_height);
+      }
+      if (budget.tile_cache > 0)
+      {
+        g_object_set (gegl_config (), "tile-cache-size", (guint64) budget.tile_cache, NULL);
+      }
+
+      // Caption values are read by the workers too, reusing the last run's index where files are unchanged
+      if (captions)
+      {
+        metadata = metadata_index_open (sheetvals.file_dir_tree);
+      }
+
+      /* Sheets written by the last run from the same files and settings
+       * are kept, only the files of the others are decoded */
+      todo = files;
+      targets = g_array_sized_new (FALSE, FALSE, sizeof (ThumbTarget), plan->n_cells);
+      if (sheetvals.output != SHEET_OUTPUT_DISPLAY && sheetvals.output != SHEET_OUTPUT_PDF)
+      {
+        span = TRACE_START ();
+        manifest = open_manifest (&style);
+        todo = g_ptr_array_new ();
+        reuse = plan_sheets (manifest, files, plan, todo, targets);
+        if (sheetvals.shard_count > 1)
+        {
+          manifest_set_total (manifest, total_sheets);
+        }
+        TRACE_END ("main", "plan", span, NULL, 0, 0);
+      }
+      else
+      {
+        for (i = 0; i < plan->n_cells; i++)
+        {
+          g_array_append_val (targets, plan->cells[i].thumb);
+        }
+      }
+
+      queue = thumb_queue_new (todo, (const ThumbTarget *) targets->data,
+                               sheetvals.cache_thumbnails,
+                               sheetvals.resample,
+                               metadata,
+                               budget.queue_budget,
+                               sheetvals.read_ahead);
+      g_array_free (targets, TRUE);
+
+      // Finished sheets are encoded on their own thread while the next one is composed
+      // A PDF is drawn as it goes instead, cairo writes each page out when it is shown
+      target.document = NULL;
+      target.stream   = NULL;
+      if (sheetvals.output == SHEET_OUTPUT_PDF)
+      {
+        target.document = begin_document (sheet_width, sheet_height);
+      }
+      else if (sheetvals.output != SHEET_OUTPUT_DISPLAY)
+      {
+        writer = sheet_writer_new (sheetvals.output, sheetvals.sheet_res,
+                                   budget.writer_depth);
+
+        // Shrunk from each finished sheet, the images are not decoded again
+        for (i = 0; i < sheet_tiers->len; i++)
+        {
+          sheet_writer_add_tier (writer, g_array_index (sheet_tiers, gint, i),
+                                 sheetvals.resample);
+        }
+      }
+
+      // What each file needs only until its sheet is done, given back all at once
+      scratch = scratch_new (16 << 10);
+
+      for (i = 0; i < files->len; i++)
+      {
+        const LayoutCell *cell = &plan->cells[i];
+        gint32            added_image;
+        GdkPixbuf        *pixbuf;
+        ExifInfo          exif;
+        gchar            *basename;
+
+        if (! started)
+        {
+          // Left as the last run wrote it
+          if (reuse != NULL && reuse[sheet])
+          {
+            i = plan->sheet_first[++sheet] - 1;
+            sheet_number++;
+            n_reused++;
+            continue;
+          }
+
+          // Unless layers are kept, cells are drawn straight into the background layer
+          begin_sheet (&target, writer, (guint) sheet_width, (guint) sheet_height, &style, text);
+          started = TRUE;
+        }
+
+        filed = g_ptr_array_index (files, i);
+        basename = scratch_basename (scratch, filed);
+        filename = basename;
+
+        // Decoded on a worker, anything it could not read goes through GIMP
+        pixbuf = thumb_queue_pop (queue, n_composed++, &exif);
+        span = TRACE_START ();
+
+        if (target.sheet != NULL)
+        {
+          gchar caption[256];
+
+          if (pixbuf == NULL)
+          {
+            pixbuf = load_fallback (filed, &cell->thumb);
+          }
+
+          caption[0] = '\0';
+          if (captions)
+          {
+            format_caption (&exif, caption, sizeof (caption));
+          }
+
+          // A banded sheet hands the rows above a cell on once the cell reaches past the band
+          if (target.stream != NULL &&
+              cell->y + cell->height > target.band_top + gdk_pixbuf_get_height (target.pixbuf))
+          {
+            next_band (&target, cell->y);
+          }
+
+          sheet_add_cell (target.sheet, cell->x, cell->y - target.band_top,
+                          cell->width, cell->height,
+                          pixbuf, caption);
+          TRACE_END ("main", "compose", span, filed, 0, 0);
+
+          g_clear_object (&pixbuf);
+        }
+        else
+        {
+          image_ID_dst = target.image_ID;
+
+          // Scaled the same way as the workers' thumbnails, then made a layer like theirs
+          if (pixbuf == NULL)
+          {
+            pixbuf = load_fallback (filed, &cell->thumb);
+          }
+
+          added_image = -1;
+          if (pixbuf != NULL)
+          {
+            added_image = add_thumbnail (pixbuf,
+                                         basename,
+                                         image_ID_dst,
+                                         cell->width);
+            g_object_unref (pixbuf);
+
+            gimp_item_transform_translate (added_image,
+                                           cell->x,
+                                           cell->y);
+          }
+
+          // Kept layers are there to be edited, so each caption stays a text layer
+          if (captions)
+          {
+            gchar  caption[256];
+            gint32 added_caption;
+            gint   thumb_height = added_image != -1 ? gimp_drawable_height (added_image) : 0;
+
+            format_caption (&exif, caption, sizeof (caption));
+            if (caption[0] != '\0')
+            {
+              added_caption = add_caption (caption, &style, image_ID_dst, cell->width);
+
+              gimp_item_transform_translate (added_caption,
+                                             cell->x,
+                                             cell->y + thumb_height);
+            }
+          }
+        }
+
+        filename = "";
+
+        // Every whole percent, each update is a round trip to the core
+        if ((gint) (100 * (i + 1) / files->len) != progress)
+        {
+          progress = 100 * (i + 1) / files->len;
+          gimp_progress_update (progress / 100.0);
+        }
+
+        // The plan closes every sheet, the last one too
+        if (i + 1 == plan->sheet_first[sheet + 1])
+        {
+          end_sheet (&target, writer, run_mode != GIMP_RUN_NONINTERACTIVE, sheets);
+          scratch_reset (scratch);
+          started = FALSE;
+          sheet++;
+        }
+      }
+      scratch_free (scratch);
+
+      // Then every image the folder gets goes on the last sheet, or a new one once it is full
+      if (sheetvals.watch)
+      {
+        n_composed += watch_folder (files, plan, &layout, &style, text, writer, manifest, metadata,
+                                    output_stem, run_mode != GIMP_RUN_NONINTERACTIVE);
+      }
+
+      thumb_queue_free (queue);
+      if (todo != files)
+        g_ptr_array_free (todo, TRUE);
+      g_free (reuse);
+      layout_plan_free (plan);
+      if (metadata != NULL)
+      {
+        metadata_index_save (metadata, sheetvals.shard_count <= 1);
+        metadata_index_free (metadata);
+      }
+
+      g_free (output_stem);
+      g_clear_pointer (&text, sheet_text_free);
+
+      // Waits for the last sheets to reach the disk
+      if (writer != NULL && sheet_writer_free (writer) > 0)
+      {
+        status = GIMP_PDB_EXECUTION_ERROR;
+      }
+      if (target.document != NULL && ! end_document (target.document))
+      {
+        status = GIMP_PDB_EXECUTION_ERROR;
+      }
+
+      // Only a run that wrote everything may vouch for its sheets next time
+      if (manifest != NULL)
+      {
+        if (status == GIMP_PDB_SUCCESS)
+        {
+          // Shards leave the sheets past the end to plug-in-contactsheet-merge
+          if (sheetvals.shard_count <= 1)
+          {
+            manifest_remove_stale (manifest, sheet_number);
+          }
+          manifest_save (manifest);
+        }
+        manifest_free (manifest);
+
+        if (n_reused > 0)
+        {
+          g_printerr ("%s: %u of %u sheets unchanged since the last run\n",
+                      PLUG_IN_BINARY, n_reused, sheet_number - first_sheet);
+        }
+      }
+      g_ptr_array_free (files, TRUE);
+
+      seconds = (g_get_monotonic_time () - start_time) / (gdouble) G_USEC_PER_SEC;
+      report_throughput (n_composed, sheet_number - first_sheet - n_reused, seconds);
+      trace_close ();
+
+      if (sheets->len > 0)
+      {
+        values[1].data.d_int32 = g_array_index (sheets, gint32, 0);
+      }
+      values[2].data.d_int32      = sheets->len;
+      values[3].data.d_int32array = (gint32 *) g_array_free (sheets, FALSE);
+
+      if (run_mode == GIMP_RUN_INTERACTIVE){
+        gimp_set_data (PLUG_IN_PROC, &sheetvals, sizeof (SheetVals));
+      }
+    }
+
+  if (sheet_tiers != NULL)
+  {
+    g_array_free (sheet_tiers, TRUE);
+    sheet_tiers = NULL;
+  }
+  color_profile_clear ();
+    
+  values[0].data.d_status = status;
+}
+
+// Flattens a filled sheet, turns its undo back on and opens it when there is a display to show it on
+static void
+finish_sheet (gint32   image_ID,
+              gboolean display)
+{
+  if (sheetvals.flatten)
+  {
+    TRACE_PDB (gimp_image_flatten (image_ID));
+  }
+
+  TRACE_PDB (gimp_image_undo_enable (image_ID));
+
+  if (display)
+  {
+    TRACE_PDB (gimp_display_new (image_ID));
+  }
+}
+
+/* Starts the next sheet. Sheets that only go to disk and have no layers
+ * are composed in memory and never become GIMP images, or a band at a
+ * time when they are too big to hold. */
+static void
+begin_sheet (SheetTarget      *target,
+             SheetWriter      *writer,
+             guint             width,
+             guint             height,
+             const SheetStyle *style,
+             SheetText        *text)
+{
+  target->image_ID = -1;
+  target->layer_ID = -1;
+  target->pixbuf   = NULL;
+  target->sheet    = NULL;
+  target->band_top = 0;
+
+  if (target->band_height > 0)
+  {
+    gchar **paths = sheet_output_paths (sheet_number);
+
+    target->stream = sheet_writer_begin_stream (writer, (const gchar * const *) paths,
+                                                width, height);
+    target->width  = width;
+    target->height = height;
+    target->style  = style;
+    target->text   = text;
+    g_strfreev (paths);
+
+    begin_band (target);
+    return;
+  }
+
+  if (target->document != NULL && ! sheetvals.keep_layers)
+  {
+    target->sheet = sheet_new_for_cairo (target->document, style, text);
+    return;
+  }
+
+  if (sheetvals.output != SHEET_OUTPUT_DISPLAY && ! sheetvals.keep_layers)
+  {
+    target->pixbuf = gdk_pixbuf_new (GDK_COLORSPACE_RGB, FALSE, 8, width, height);
+    target->sheet  = sheet_new_for_pixbuf (target->pixbuf, style, text);
+    return;
+  }
+
+  target->image_ID = create_new_image (sheet_number, width, height,
+                                       &target->layer_ID);
+  if (! sheetvals.keep_layers)
+  {
+    target->sheet = begin_direct_sheet (target->layer_ID, style, text);
+  }
+}
+
+/* Hands a filled sheet on: as the next page of the PDF, to the writer
+ * when exporting, which frees it once encoded, otherwise to the list of
+ * images returned */
+static void
+end_sheet (SheetTarget *target,
+           SheetWriter *writer,
+           gboolean     display,
+           GArray      *sheets)
+{
+  gint64 span = TRACE_START ();
+  guint  pdb_calls = TRACE_PDB_CALLS ();
+
+  g_clear_pointer (&target->sheet, sheet_free);
+
+  if (target->document != NULL)
+  {
+    // Layered sheets can only go in as a picture of the whole page
+    if (target->image_ID != -1)
+    {
+      GdkPixbuf *pixbuf = drawable_to_pixbuf (TRACE_PDB (gimp_image_flatten (target->image_ID)));
+
+      TRACE_PDB (gimp_image_delete (target->image_ID));
+      gdk_cairo_set_source_pixbuf (target->document, pixbuf, 0, 0);
+      cairo_paint (target->document);
+      g_object_unref (pixbuf);
+    }
+
+    cairo_show_page (target->document);
+  }
+  else if (target->stream != NULL)
+  {
+    // Whatever is below the last row of cells goes out as blank bands
+    end_band (target, MIN (target->band_top + gdk_pixbuf_get_height (target->pixbuf),
+                           target->height));
+    while (target->band_top < target->height)
+    {
+      begin_band (target);
+      end_band (target, MIN (target->band_top + target->band_height, target->height));
+    }
+
+    sheet_stream_end (target->stream);
+    target->stream = NULL;
+  }
+  else if (writer != NULL)
+  {
+    gchar **paths = sheet_output_paths (sheet_number);
+
+    if (target->pixbuf == NULL)
+    {
+      target->pixbuf = drawable_to_pixbuf (TRACE_PDB (gimp_image_flatten (target->image_ID)));
+      TRACE_PDB (gimp_image_delete (target->image_ID));
+    }
+
+    sheet_writer_push_tiers (writer, target->pixbuf, (const gchar * const *) paths);
+    g_strfreev (paths);
+  }
+  else
+  {
+    finish_sheet (target->image_ID, display);
+    g_array_append_val (sheets, target->image_ID);
+  }
+
+  TRACE_END ("main", "end_sheet", span, NULL, 0, TRACE_PDB_CALLS () - pdb_calls);
+
+  target->image_ID = -1;
+  target->pixbuf   = NULL;
+  sheet_number++;
+}
+
+/* Starts the band of a banded sheet that begins at band_top */
+static void
+begin_band (SheetTarget *target)
+{
+  target->pixbuf = gdk_pixbuf_new (GDK_COLORSPACE_RGB, FALSE, 8, target->width,
+                                   MIN (target->band_height, target->height - target->band_top));
+  target->sheet  = sheet_new_for_pixbuf (target->pixbuf, target->style, target->text);
+}
+
+/* Hands the band's rows above sheet row bottom to the writer, the next
+ * band starts there */
+static void
+end_band (SheetTarget *target,
+          gint         bottom)
+{
+  g_clear_pointer (&target->sheet, sheet_free);
+  sheet_stream_push_band (target->stream, target->pixbuf, bottom - target->band_top);
+  g_clear_object (&target->pixbuf);
+  target->band_top = bottom;
+}
+
+/* Moves a banded sheet on to a band starting at sheet row top, for a cell
+ * that reaches below the current one. The rows above top are handed on
+ * and whatever cells already drew below it is carried into the new band. */
+static void
+next_band (SheetTarget *target,
+           gint         top)
+{
+  GdkPixbuf *band     = g_object_ref (target->pixbuf);
+  gint       band_top = target->band_top;
+  gint       carried;
+
+  end_band (target, top);
+  begin_band (target);
+
+  carried = MIN (band_top + gdk_pixbuf_get_height (band) - top,
+                 gdk_pixbuf_get_height (target->pixbuf));
+  if (carried > 0)
+  {
+    gdk_pixbuf_copy_area (band, 0, top - band_top, target->width, carried,
+                          target->pixbuf, 0, 0);
+  }
+
+  g_object_unref (band);
+}
+
+/* Keeps adding the images that turn up in the folder to the sheets until
+ * the user stops it: the run's last sheet is taken up again and filled,
+ * then new ones are started. Returns how many images were added. */
+static guint
+watch_folder (GPtrArray            *files,
+              const LayoutPlan     *plan,
+              const LayoutSettings *layout,
+              const SheetStyle     *style,
+              SheetText            *text,
+              SheetWriter          *writer,
+              Manifest             *manifest,
+              MetadataIndex        *metadata,
+              const gchar          *skip_prefix,
+              gboolean              interactive)
+{
+  SheetWatch   watch;
+  FolderWatch *folder;
+  guint        first = files->len;
+  guint        i;
+
+  watch.files    = g_ptr_array_new_with_free_func (g_free);
+  watch.probes   = g_array_new (FALSE, FALSE, sizeof (ImageProbe));
+  watch.exifs    = g_array_new (FALSE, FALSE, sizeof (ExifInfo));
+  watch.thumbs   = g_ptr_array_new ();
+  watch.decoded  = g_array_new (FALSE, FALSE, sizeof (ThumbTarget));
+  watch.plan     = NULL;
+  watch.pixbuf   = NULL;
+  watch.sheet    = NULL;
+  watch.known    = g_hash_table_new_full (g_str_hash, g_str_equal, g_free, NULL);
+  watch.layout   = layout;
+  watch.style    = style;
+  watch.text     = text;
+  watch.writer   = writer;
+  watch.manifest = manifest;
+  watch.metadata = metadata;
+  watch.write_id = 0;
+  watch.n_added  = 0;
+
+  for (i = 0; i < files->len; i++)
+  {
+    g_hash_table_add (watch.known, g_strdup (g_ptr_array_index (files, i)));
+  }
+
+  // The last sheet is already on disk, it is only written again once an image joins it
+  if (plan->n_sheets > 0)
+  {
+    first = plan->sheet_first[plan->n_sheets - 1];
+    sheet_number--;
+  }
+  for (i = first; i < files->len; i++)
+  {
+    watch_append (&watch, g_ptr_array_index (files, i));
+  }
+  if (watch.files->len > 0)
+  {
+    watch.plan = layout_plan_new (layout, (const ImageProbe *) watch.probes->data,
+                                  watch.files->len);
+    watch_draw (&watch, NULL);
+  }
+
+  folder = folder_watch_new (sheetvals.file_dir_tree, sheetvals.recursive, skip_prefix,
+                             watch_file_added, &watch);
+  g_printerr ("%s: watching %s for new images\n", PLUG_IN_BINARY, sheetvals.file_dir_tree);
+
+  if (interactive)
+  {
+    watch_dialog_run ();
+  }
+  else
+  {
+    GMainLoop *loop = g_main_loop_new (NULL, FALSE);
+#ifdef G_OS_UNIX
+    guint      sigint  = g_unix_signal_add (SIGINT, watch_stop, loop);
+    guint      sigterm = g_unix_signal_add (SIGTERM, watch_stop, loop);
+#endif
+
+    g_main_loop_run (loop);
+
+#ifdef G_OS_UNIX
+    g_source_remove (sigint);
+    g_source_remove (sigterm);
+#endif
+    g_main_loop_unref (loop);
+  }
+
+  folder_watch_free (folder);
+
+  // What came in since the last write goes out before the run finishes
+  if (watch.write_id != 0)
+  {
+    g_source_remove (watch.write_id);
+    watch_write (&watch);
+  }
+  if (watch.files->len > 0)
+  {
+    sheet_number++;
+  }
+
+  for (i = 0; i < watch.thumbs->len; i++)
+  {
+    if (g_ptr_array_index (watch.thumbs, i) != NULL)
+      g_object_unref (g_ptr_array_index (watch.thumbs, i));
+  }
+  g_clear_pointer (&watch.sheet, sheet_free);
+  g_clear_object (&watch.pixbuf);
+  g_clear_pointer (&watch.plan, layout_plan_free);
+  g_hash_table_destroy (watch.known);
+  g_array_free (watch.decoded, TRUE);
+  g_ptr_array_free (watch.thumbs, TRUE);
+  g_array_free (watch.exifs, TRUE);
+  g_array_free (watch.probes, TRUE);
+  g_ptr_array_free (watch.files, TRUE);
+
+  return watch.n_added;
+}
+
+/* Adds file to the end of the watched sheet with its header and caption
+ * values read, it is decoded once it has a cell */
+static void
+watch_append (SheetWatch  *watch,
+              const gchar *file)
+{
+  ImageProbe  probe = { 0, };
+  ExifInfo    exif = { 0, };
+  GdkPixbuf  *thumb = NULL;
+  ThumbTarget never = { -1, -1, -1, -1, -1, -1, -1, -1 };
+
+  image_probe (file, &probe);
+  if (watch->metadata != NULL)
+  {
+    metadata_index_get (watch->metadata, file, &exif);
+  }
+
+  g_ptr_array_add (watch->files, g_strdup (file));
+  g_array_append_val (watch->probes, probe);
+  g_array_append_val (watch->exifs, exif);
+  g_ptr_array_add (watch->thumbs, thumb);
+  g_array_append_val (watch->decoded, never);
+}
+
+/* Puts an image that has just been written into the folder on the sheet,
+ * starting the next sheet with it when the current one is full. Images
+ * already on a sheet are left where they are when written again. */
+static void
+watch_file_added (const gchar *file,
+                  gpointer     user_data)
+{
+  SheetWatch *watch = user_data;
+  LayoutPlan *old;
+  gint64      start = g_get_monotonic_time ();
+  gint64      span = TRACE_START ();
+  gchar      *output;
+  gchar      *basename;
+  guint       last;
+  guint       i;
+
+  if (g_hash_table_contains (watch->known, file))
+    return;
+  g_hash_table_add (watch->known, g_strdup (file));
+
+  watch_append (watch, file);
+  old = watch->plan;
+  watch->plan = layout_plan_new (watch->layout, (const ImageProbe *) watch->probes->data,
+                                 watch->files->len);
+
+  // Full, the sheet is written as it was and the image starts the next one
+  if (watch->plan->n_sheets > 1)
+  {
+    layout_plan_free (watch->plan);
+    if (watch->write_id != 0)
+    {
+      g_source_remove (watch->write_id);
+      watch_write (watch);
+    }
+
+    last = watch->files->len - 1;
+    for (i = 0; i < last; i++)
+    {
+      if (g_ptr_array_index (watch->thumbs, i) != NULL)
+        g_object_unref (g_ptr_array_index (watch->thumbs, i));
+    }
+    g_ptr_array_remove_range (watch->files, 0, last);
+    g_array_remove_range (watch->probes, 0, last);
+    g_array_remove_range (watch->exifs, 0, last);
+    g_ptr_array_remove_range (watch->thumbs, 0, last);
+    g_array_remove_range (watch->decoded, 0, last);
+    g_clear_pointer (&watch->sheet, sheet_free);
+    g_clear_object (&watch->pixbuf);
+    g_clear_pointer (&old, layout_plan_free);
+    sheet_number++;
+
+    watch->plan = layout_plan_new (watch->layout, (const ImageProbe *) watch->probes->data,
+                                   watch->files->len);
+  }
+
+  watch_draw (watch, old);
+  g_clear_pointer (&old, layout_plan_free);
+  watch->n_added++;
+
+  // A burst of frames is written out once
+  if (watch->write_id == 0)
+  {
+    watch->write_id = g_timeout_add (WATCH_WRITE_DELAY, watch_write, watch);
+  }
+
+  output   = sheet_output_path (sheet_number);
+  basename = g_path_get_basename (file);
+  g_printerr ("%s: %s added to %s in %.2f s\n", PLUG_IN_BINARY, basename, output,
+              (g_get_monotonic_time () - start) / (gdouble) G_USEC_PER_SEC);
+  TRACE_END ("main", "watch", span, file, trace_file_size (file), 0);
+  g_free (basename);
+  g_free (output);
+}
+
+/* Draws the watched sheet, decoding the images whose cell changed size.
+ * When the cells old had kept their place only the new ones are drawn,
+ * otherwise the sheet is cleared and drawn again. */
+static void
+watch_draw (SheetWatch       *watch,
+            const LayoutPlan *old)
+{
+  guint from = 0;
+  guint i;
+
+  if (watch->sheet != NULL && old != NULL)
+  {
+    from = old->n_cells;
+    for (i = 0; i < old->n_cells && from > 0; i++)
+    {
+      if (memcmp (&old->cells[i], &watch->plan->cells[i], sizeof (LayoutCell)) != 0)
+        from = 0;
+    }
+  }
+
+  if (from == 0)
+  {
+    g_clear_pointer (&watch->sheet, sheet_free);
+    if (watch->pixbuf == NULL)
+    {
+      watch->pixbuf = gdk_pixbuf_new (GDK_COLORSPACE_RGB, FALSE, 8,
+                                      (gint) watch->layout->width,
+                                      (gint) watch->layout->height);
+    }
+
+    // Starts from a clear background
+    watch->sheet = sheet_new_for_pixbuf (watch->pixbuf, watch->style, watch->text);
+  }
+
+  for (i = from; i < watch->plan->n_cells; i++)
+  {
+    const LayoutCell *cell    = &watch->plan->cells[i];
+    const gchar      *file    = g_ptr_array_index (watch->files, i);
+    ThumbTarget      *decoded = &g_array_index (watch->decoded, ThumbTarget, i);
+    GdkPixbuf        *thumb   = g_ptr_array_index (watch->thumbs, i);
+    gchar             caption[256];
+
+    // Unreadable images are only tried again for a different cell
+    if (memcmp (decoded, &cell->thumb, sizeof (ThumbTarget)) != 0)
+    {
+      g_clear_object (&thumb);
+      thumb = thumbnail_load (file, &cell->thumb, sheetvals.cache_thumbnails, sheetvals.resample);
+      if (thumb == NULL)
+      {
+        thumb = load_fallback (file, &cell->thumb);
+      }
+      g_ptr_array_index (watch->thumbs, i) = thumb;
+      *decoded = cell->thumb;
+    }
+
+    caption[0] = '\0';
+    if (watch->text != NULL)
+    {
+      gchar *basename = g_path_get_basename (file);
+
+      metadata_format_caption (&g_array_index (watch->exifs, ExifInfo, i), basename,
+                               caption_fields (), caption, sizeof (caption));
+      g_free (basename);
+    }
+
+    sheet_add_cell (watch->sheet, cell->x, cell->y, cell->width, cell->height,
+                    thumb, caption);
+  }
+}
+
+/* Hands a copy of the watched sheet to the writer, which replaces the
+ * files of the sheet once they are complete, and records it for the
+ * manifest saved at the end of the run */
+static gboolean
+watch_write (gpointer user_data)
+{
+  SheetWatch *watch = user_data;
+  gchar     **paths = sheet_output_paths (sheet_number);
+
+  watch->write_id = 0;
+
+  sheet_writer_push_tiers (watch->writer, gdk_pixbuf_copy (watch->pixbuf),
+                           (const gchar * const *) paths);
+  if (watch->manifest != NULL)
+  {
+    manifest_add_sheet (watch->manifest, sheet_number, (const gchar * const *) paths,
+                        watch->files, 0, watch->files->len);
+  }
+
+  g_strfreev (paths);
+  return G_SOURCE_REMOVE;
+}
+
+#ifdef G_OS_UNIX
+// Ends a watch run from the command line on Ctrl+C or kill
+static gboolean
+watch_stop (gpointer user_data)
+{
+  g_main_loop_quit (user_data);
+  return G_SOURCE_CONTINUE;
+}
+#endif
+
+// Shows the folder is being watched until the user stops it
+static void
+watch_dialog_run (void)
+{
+  GtkWidget *dlg;
+  GtkWidget *label;
+  gchar     *message;
+
+  gimp_ui_init (PLUG_IN_BINARY, FALSE);
+
+  dlg = gimp_dialog_new ("Contact Sheet", PLUG_IN_ROLE,
+                         NULL, 0,
+                         gimp_standard_help_func, PLUG_IN_PROC,
+                         "_Stop", GTK_RESPONSE_CLOSE,
+                         NULL);
+
+  message = g_strdup_printf ("Adding the images written to %s to the sheets",
+                             sheetvals.file_dir_tree);
+  label = gtk_label_new (message);
+  gtk_box_pack_start (GTK_BOX (gtk_dialog_get_content_area (GTK_DIALOG (dlg))),
+                      label, TRUE, TRUE, 12);
+  gtk_widget_show (label);
+
+  gimp_dialog_run (GIMP_DIALOG (dlg));
+
+  gtk_widget_destroy (dlg);
+  g_free (message);
+}
+
+/* Where sheet number goes on disk, file_prefix_number.ext, or
+ * file_prefix.pdf for all of them. Relative prefixes are taken from the
+ * image folder. */
+static gchar *
+sheet_output_path (guint number)
+{
+  gchar *name;
+  gchar *path;
+
+  if (sheetvals.output == SHEET_OUTPUT_PDF)
+    name = g_strdup_printf ("%s.pdf", sheetvals.file_prefix);
+  else
+    name = g_strdup_printf ("%s_%u.%s", sheetvals.file_prefix, number,
+                            sheet_writer_extension (sheetvals.output));
+
+  return output_path (name);
+}
+
+/* Every file sheet number is written to, sheet_output_path () and then
+ * file_prefix_RESdpi_number.ext for each tier, NULL-terminated. Only
+ * PNG, JPEG and TIFF sheets have tiers. */
+static gchar **
+sheet_output_paths (guint number)
+{
+  GPtrArray *paths = g_ptr_array_new ();
+  guint      i;
+
+  g_ptr_array_add (paths, sheet_output_path (number));
+
+  if (sheetvals.output != SHEET_OUTPUT_DISPLAY && sheetvals.output != SHEET_OUTPUT_PDF)
+  {
+    for (i = 0; i < sheet_tiers->len; i++)
+    {
+      gchar *name = g_strdup_printf ("%s_%ddpi_%u.%s", sheetvals.file_prefix,
+                                     g_array_index (sheet_tiers, gint, i), number,
+                                     sheet_writer_extension (sheetvals.output));
+
+      g_ptr_array_add (paths, output_path (name));
+    }
+  }
 
-static gint sheet_number = 0;
+  g_ptr_array_add (paths, NULL);
 
-MAIN()
+  return (gchar **) g_ptr_array_free (paths, FALSE);
+}
 
-static void
-query (void)
+/* Reads text, comma separated resolutions, as dpi. Returns NULL unless
+ * each is a whole number below sheet_res, the resolution tiers are
+ * shrunk from. */
+static GArray *
+parse_tiers (const gchar *text,
+             gint         sheet_res)
 {
-  static const GimpParamDef args[] =
-  {
- 
-    { GIMP_PDB_INT32,    "run-mode",     "The run mode { RUN-INTERACTIVE (0), RUN-NONINTERACTIVE (1) }" },
-    { GIMP_PDB_IMAGE,    "image",        "Input image (unused)" },
-    { GIMP_PDB_DRAWABLE, "drawable",     "Input drawable" },
-
-    { GIMP_PDB_FLOAT,    "sheet-res",     "Resolution of the sheet" },
-    { GIMP_PDB_FLOAT,    "sheet-width",   "Contact sheet Width" },
-    { GIMP_PDB_FLOAT,    "sheet-height",  "Contact sheet height" },
-    { GIMP_PDB_INT32,    "vg-hg-type",    "Data type for width and height, {PIXEL (0), INCH (1), MM (2), POINT (3)}" },
-    { GIMP_PDB_FLOAT,    "gap-vert",      "Vertical gaps between images" },
-    { GIMP_PDB_FLOAT,    "gap-horiz",     "Horizontal gaps between images" },
-    { GIMP_PDB_INT32,    "vg-hg-type",    "Data type for gaps, {PIXEL (0), INCH (1), MM (2), POINT (3)}" },
-    { GIMP_PDB_INT32,    "row",           "Number of rows" },
-    { GIMP_PDB_INT32,    "column",        "Number of columns" },
-    { GIMP_PDB_INT32,    "rotate-images", "Rotate to horizontal { FALSE (0), TRUE (1) }" },
-    { GIMP_PDB_INT32,    "flatten",       "Flatten to one layer { FALSE (0), TRUE (1) }" },
-    { GIMP_PDB_STRING,   "fontname",      "Font name for the whole sheet" },
-    { GIMP_PDB_FLOAT,    "caption-size",  "Size of the captions" },
-    { GIMP_PDB_INT32,    "cs-type",       "Data type for font, {PIXEL (0), INCH (1), MM (2), POINT (3)}" },
-
-    { GIMP_PDB_STRING,   "file-dir-tree", "File directory to the folder containing the files" },
-
-    { GIMP_PDB_INT32,    "file-name",     "Show file name { FALSE (0), TRUE (1) }" },
-    { GIMP_PDB_INT32,    "aperture",      "show aperture { FALSE (0), TRUE (1) }" },
-    { GIMP_PDB_INT32,    "focal-length",  "Show focal length { FALSE (0), TRUE (1) }" },
-    { GIMP_PDB_INT32,    "ISO",           "Show ISO speed { FALSE (0), TRUE (1) }" },
-    { GIMP_PDB_INT32,    "exposure",      "Show exposure time { FALSE (0), TRUE (1) }" },
-  };  
-  
-  static const GimpParamDef return_vals[] =
+  GArray  *tiers = g_array_new (FALSE, FALSE, sizeof (gint));
+  gchar  **parts = g_strsplit (text, ",", -1);
+  guint    i;
+
+  for (i = 0; parts[i] != NULL; i++)
   {
-    { GIMP_PDB_IMAGE, "new-image", "Output image" }
-  };
+    gchar  *part = g_strstrip (parts[i]);
+    gchar  *end;
+    gint64  res;
+    gint    dpi;
 
-  gimp_install_procedure (
-    PLUG_IN_PROC,
-    "Contact sheet creator",
-    "Creates a contact sheet from a folder of images."
-    "You set the colour of the text with the forground colour,"
-    "and the background with the background color."
-    "There are options to control size, gaps, etc.",
-    "Samuel Oldham",
-    "Samuel Oldham",
-    "2023",
-    "Contact sheet",
-    NULL,
-    GIMP_PLUGIN,
-    G_N_ELEMENTS (args),
-    G_N_ELEMENTS (return_vals),
-    args, return_vals);
+    if (*part == '\0')
+      continue;
 
-  gimp_plugin_menu_register (PLUG_IN_PROC,
-                             "<Image>/File/Create");
+    res = g_ascii_strtoll (part, &end, 10);
+    if (*end != '\0' || res <= 0 || res >= sheet_res)
+    {
+      g_array_free (tiers, TRUE);
+      tiers = NULL;
+      break;
+    }
+
+    dpi = res;
+    g_array_append_val (tiers, dpi);
+  }
+
+  g_strfreev (parts);
+
+  return tiers;
 }
 
-static void
-run (const gchar      *name,
-     gint              nparams,
-     const GimpParam  *param,
-     gint             *nreturn_vals,
-     GimpParam       **return_vals)
+// Resolves name, which it frees, against the image folder unless it is absolute
+static gchar *
+output_path (gchar *name)
 {
-  static GimpParam  values[2];
-  GimpPDBStatusType status = GIMP_PDB_SUCCESS;
-  gint32            image_ID;
-  gint              cell_width;
-  gint              cell_height;
-  gdouble           sheet_width;
-  gdouble           sheet_height;
-  gdouble           gap_vert;
-  gdouble           gap_horiz;
-  gint              tmp_row;
-  gint              tmp_col;
+  gchar *path;
 
-  gchar            *filed;
-  GFile            *file;
-  GDir             *files;
-  
-  GimpRunMode run_mode = param[0].data.d_int32;
+  if (g_path_is_absolute (name))
+    return name;
 
-  *nreturn_vals = 2;
-  *return_vals  = values;
+  path = g_build_filename (sheetvals.file_dir_tree, name, NULL);
+  g_free (name);
 
-  values[0].type          = GIMP_PDB_STATUS;
-  values[0].data.d_status = status;
-  values[1].type          = GIMP_PDB_IMAGE;
-  values[1].data.d_int32  = -1;
+  return path;
+}
 
-  switch (run_mode)
-  {
-    case GIMP_RUN_INTERACTIVE:
-      /* Try and get data*/
-      gimp_get_data (PLUG_IN_PROC, &sheetvals);
+/* Where the manifest of the whole folder, for a shard_index of -1, or of
+ * one shard of it goes */
+static gchar *
+manifest_path (gint shard_index)
+{
+  if (shard_index < 0)
+    return output_path (g_strdup_printf ("%s.manifest", sheetvals.file_prefix));
 
-      /*  First acquire information with a dialog  */
-      if (! contact_sheet_dialog (param[1].data.d_int32))
-      {
-        return;
-      }
-    break;
-    
-    case GIMP_RUN_NONINTERACTIVE:
-      status = GIMP_PDB_CALLING_ERROR;
-    break;
+  return output_path (g_strdup_printf ("%s.shard-%d-of-%d.manifest", sheetvals.file_prefix,
+                                       shard_index, sheetvals.shard_count));
+}
 
-    case GIMP_RUN_WITH_LAST_VALS:
-      gimp_get_data (PLUG_IN_PROC, &sheetvals);
-    break;
+/* Checks every shard of a split run made its sheets and records them in
+ * file_prefix.manifest as if one run had, so the next run, split or not,
+ * can reuse them */
+static GimpPDBStatusType
+merge_shards (const gchar *folder,
+              const gchar *prefix,
+              gint         shard_count,
+              gint        *n_sheets)
+{
+  GPtrArray *shard_paths = g_ptr_array_new_with_free_func (g_free);
+  gchar     *path;
+  gint       i;
 
-    default:
-      break;
-  }
-  
-  if (status == GIMP_PDB_SUCCESS && sheetvals.file_dir_tree[0] != 'N')
-    {
-      gint offset_x;
-      gint offset_y;
-      gint number_x;
-      gint number_y;
+  g_strlcpy (sheetvals.file_dir_tree, folder, NAME_LEN);
+  g_strlcpy (sheetvals.file_prefix, prefix, NAME_LEN);
+  sheetvals.shard_count = shard_count;
 
-      gint32          image_ID_dst;
-      gint32          layer_ID_src;
-      gint32          layer_ID_dst;
+  for (i = 0; i < shard_count; i++)
+  {
+    g_ptr_array_add (shard_paths, manifest_path (i));
+  }
+  g_ptr_array_add (shard_paths, NULL);
 
-      gimp_progress_init ("Composing images");
+  path      = manifest_path (-1);
+  *n_sheets = manifest_merge (path, (const gchar * const *) shard_paths->pdata);
 
-      sheet_width = gimp_units_to_pixels (sheetvals.sheet_width, sheetvals.w_h_type, sheetvals.sheet_res);
-      sheet_height = gimp_units_to_pixels (sheetvals.sheet_height, sheetvals.w_h_type, sheetvals.sheet_res);
-      
-      gap_vert = gimp_units_to_pixels (sheetvals.gap_vert, sheetvals.vg_hg_type, sheetvals.sheet_res);
-      gap_horiz = gimp_units_to_pixels (sheetvals.gap_horiz, sheetvals.vg_hg_type, sheetvals.sheet_res);
-      tmp_row = sheetvals.row;
-      tmp_col = sheetvals.column;
+  g_free (path);
+  g_ptr_array_free (shard_paths, TRUE);
 
-      cell_width = (sheet_width - (gap_vert * (tmp_col + 1))) / tmp_col;
-      cell_height = (sheet_height - (gap_horiz* (tmp_row + 1))) / tmp_row;
+  if (*n_sheets < 0)
+  {
+    *n_sheets = 0;
+    return GIMP_PDB_EXECUTION_ERROR;
+  }
 
-      // add to the background.
+  g_printerr ("%s: %d sheets from %d shards in %s\n", PLUG_IN_BINARY, *n_sheets, shard_count, folder);
 
-      image_ID_dst = create_new_image (sheet_number,
-                                   (guint) sheet_width, (guint) sheet_height,
-                                   &layer_ID_dst);
+  return GIMP_PDB_SUCCESS;
+}
 
-      // Itterate through directory
+/* Opens file_prefix.manifest, or the shard's own, keyed on everything
+ * that changes how a sheet looks. The thumbnail cache, the folder walk
+ * and the sharding do not. */
+static Manifest *
+open_manifest (const SheetStyle *style)
+{
+  Manifest *manifest;
+  gchar    *settings;
+  gchar    *digest;
+  gchar    *path;
+
+  settings = g_strdup_printf ("%d %g %g %d %g %g %d %d %d %d %d %s %g %d "
+                              "%d %d %d %d %d %d %d %d %d %02x%02x%02x",
+                              sheetvals.sheet_res,
+                              sheetvals.sheet_width, sheetvals.sheet_height, sheetvals.w_h_type,
+                              sheetvals.gap_vert, sheetvals.gap_horiz, sheetvals.vg_hg_type,
+                              sheetvals.row, sheetvals.column,
+                              sheetvals.rotate_images, sheetvals.flatten,
+                              sheetvals.fontname, sheetvals.caption_size, sheetvals.cs_type,
+                              sheetvals.file_name, sheetvals.aperture, sheetvals.focal_length,
+                              sheetvals.ISO, sheetvals.exposure,
+                              sheetvals.keep_layers, sheetvals.output, sheetvals.resample,
+                              sheetvals.layout,
+                              style->foreground[0], style->foreground[1], style->foreground[2]);
+  digest = g_compute_checksum_for_string (G_CHECKSUM_MD5, settings, -1);
+  path   = manifest_path (sheetvals.shard_count > 1 ? sheetvals.shard_index : -1);
+
+  manifest = manifest_open (path, sheetvals.file_dir_tree, digest);
+
+  g_free (path);
+  g_free (digest);
+  g_free (settings);
+
+  return manifest;
+}
 
-      files = g_dir_open (sheetvals.file_dir_tree, 0, NULL);
+/* Records every sheet of the plan in the manifest. Returns which of them
+ * can be kept from the last run and adds the files of the rest to todo,
+ * and what they are decoded to to targets. */
+static gboolean *
+plan_sheets (Manifest         *manifest,
+             GPtrArray        *files,
+             const LayoutPlan *plan,
+             GPtrArray        *todo,
+             GArray           *targets)
+{
+  gboolean *reuse = g_new0 (gboolean, MAX (plan->n_sheets, 1));
+  guint     number;
+  guint     i;
 
-      filename = g_dir_read_name (files);
+  for (number = 0; number < plan->n_sheets; number++)
+  {
+    guint   first   = plan->sheet_first[number];
+    guint   count   = plan->sheet_first[number + 1] - first;
+    gchar **outputs = sheet_output_paths (sheet_number + number);
+
+    reuse[number] = manifest_add_sheet (manifest, sheet_number + number,
+                                        (const gchar * const *) outputs,
+                                        files, first, count);
+    if (! reuse[number])
+    {
+      for (i = first; i < first + count; i++)
+      {
+        g_ptr_array_add (todo, g_ptr_array_index (files, i));
+        g_array_append_val (targets, plan->cells[i].thumb);
+      }
+    }
 
-      offset_x = gap_vert;
-      offset_y = gap_horiz;
+    g_strfreev (outputs);
+  }
 
-      number_x = 0;
-      number_y = 0;
+  return reuse;
+}
 
-      while (filename != NULL) 
-      {
-        filed = g_build_filename(sheetvals.file_dir_tree, filename, NULL);
-        file = g_file_new_for_path(filed);
+/* Opens the PDF the sheets are drawn into. Pages are in points, the
+ * drawing is in sheet pixels at the sheet resolution. */
+static cairo_t *
+begin_document (gdouble width,
+                gdouble height)
+{
+  cairo_surface_t *surface;
+  cairo_t         *document;
+  gchar           *path  = sheet_output_path (0);
+  gdouble          scale = 72.0 / sheetvals.sheet_res;
 
-        if (is_image_file(file)) 
-        {
-          gint32 added_caption;
-          gint32 added_image;
-          if (sheetvals.file_name || sheetvals.aperture || sheetvals.focal_length || sheetvals.ISO || sheetvals.exposure)
-          {
-            added_caption = add_caption (filed,
-                                         &image_ID_dst,
-                                         &layer_ID_dst,
-                                         cell_width);
-            
-            added_image = add_image (filed,
-                    &image_ID_dst,
-                    &layer_ID_dst,
-                    cell_width,
-                    cell_height - gimp_drawable_height(added_caption));
-
-            gimp_item_transform_translate (added_caption,
-                              offset_x, 
-                              offset_y + gimp_drawable_height(added_image));
-          }
-          else
-          {
-            added_image = add_image (filed,
-                      &image_ID_dst,
-                      &layer_ID_dst,
-                      cell_width,
-                      cell_height);
-          }
+  surface = cairo_pdf_surface_create (path, width * scale, height * scale);
+  cairo_pdf_surface_set_metadata (surface, CAIRO_PDF_METADATA_TITLE, sheetvals.file_prefix);
+  cairo_pdf_surface_set_metadata (surface, CAIRO_PDF_METADATA_CREATOR, "GIMP " PLUG_IN_BINARY);
 
-          gimp_item_transform_translate (added_image,
-                                         offset_x,
-                                         offset_y);
-          
-          number_x++;
-          offset_x += (cell_width + gap_vert);
-          if (number_x == sheetvals.column){
-            offset_x = gap_vert;
-            offset_y += (cell_height + gap_horiz);
-            number_x = 0;
-            number_y++;
-          }
-          if (number_y == sheetvals.row)
-          {
-            if (sheetvals.flatten)
-            {
-              gimp_image_flatten (image_ID_dst);
-            }
-            
-            gimp_image_undo_enable (image_ID_dst);
-            gimp_display_new (image_ID_dst);
-            sheet_number++;
-   
-            image_ID_dst = create_new_image (sheet_number,
-                                   (guint) sheet_width, (guint) sheet_height,
-                                   &layer_ID_dst);
-
-            offset_x = gap_vert;
-            offset_y = gap_horiz;
-            number_x = 0;
-            number_y = 0;
-          }
-        }
-        filename = g_dir_read_name (files);
-        filed = g_strdup(sheetvals.file_dir_tree);
-        g_object_unref(file);
-      }
-      if (sheetvals.flatten)
-      {
-        gimp_image_flatten (image_ID_dst);
-      }
-      gimp_image_undo_enable (image_ID_dst);
+  document = cairo_create (surface);
+  cairo_surface_destroy (surface);
+  cairo_scale (document, scale, scale);
 
-      if(number_x > 0){
-        gimp_display_new (image_ID_dst);
-      }
+  g_free (path);
 
-      if (run_mode == GIMP_RUN_INTERACTIVE){
-        gimp_set_data (PLUG_IN_PROC, &sheetvals, sizeof (SheetVals));
-      }
-    }
-    
-  values[0].data.d_status = status;
+  return document;
 }
 
+// Writes out the end of the PDF, FALSE if any of it could not be written
 static gboolean
-is_image_file(GFile *file)
+end_document (cairo_t *document)
 {
+  cairo_surface_t *surface = cairo_get_target (document);
+  cairo_status_t   status;
 
-  GFileInfo *file_info = g_file_query_info(file, G_FILE_ATTRIBUTE_STANDARD_CONTENT_TYPE, G_FILE_QUERY_INFO_NONE, NULL, NULL);
+  cairo_surface_finish (surface);
+  status = cairo_surface_status (surface);
 
-  if (file_info != NULL)
+  if (status != CAIRO_STATUS_SUCCESS)
   {
-      const gchar *content_type = g_file_info_get_content_type(file_info);
+    g_printerr ("%s: could not write the PDF: %s\n",
+                PLUG_IN_BINARY, cairo_status_to_string (status));
+  }
 
-      // Check if the content type is an image type
-      if (g_content_type_is_a(content_type, "image/*"))
-      {
-          // Process the image file
-          return TRUE;
-      }
+  cairo_destroy (document);
 
-      g_object_unref(file_info);
-  }
+  return status == CAIRO_STATUS_SUCCESS;
+}
 
-  return FALSE;
+// Reads a drawable back as an RGB pixbuf
+static GdkPixbuf *
+drawable_to_pixbuf (gint32 drawable_ID)
+{
+  GdkPixbuf  *pixbuf;
+  GeglBuffer *buffer;
+  gint        width  = TRACE_PDB (gimp_drawable_width (drawable_ID));
+  gint        height = TRACE_PDB (gimp_drawable_height (drawable_ID));
+
+  pixbuf = gdk_pixbuf_new (GDK_COLORSPACE_RGB, FALSE, 8, width, height);
+
+  buffer = TRACE_PDB (gimp_drawable_get_buffer (drawable_ID));
+  gegl_buffer_get (buffer, GEGL_RECTANGLE (0, 0, width, height), 1.0,
+                   babl_format ("R'G'B' u8"),
+                   gdk_pixbuf_get_pixels (pixbuf),
+                   gdk_pixbuf_get_rowstride (pixbuf),
+                   GEGL_ABYSS_NONE);
+  g_object_unref (buffer);
+
+  return pixbuf;
 }
 
-// Loads and adds an image as a layer, scaled proportionally to what is needed, it will also handle rotating the image and moving it so it can then be moved into the correct position later
-static gint32
-add_image (const gchar    *file,
-           guint32 *image_ID_dst,
-           guint32 *layer_ID,
-           gint     dst_width, 
-           gint     dst_height)
-{
-  gdouble aspect_ratio;
-  gboolean rotated = FALSE;
-  
-  *layer_ID = gimp_file_load_layer (GIMP_RUN_NONINTERACTIVE, *image_ID_dst, file);
-  gimp_image_insert_layer (*image_ID_dst,
-                          *layer_ID,
-                          0,
-                          -1);
-
-  if (sheetvals.rotate_images){
-    if (gimp_drawable_width (*layer_ID) < gimp_drawable_height (*layer_ID)){
-      gimp_item_transform_rotate (*layer_ID,
-                                  -1.5708,
-                                  FALSE,
-                                  0,
-                                  0);
-      rotated = TRUE;
-    }
+/* Shrinks a full size drawable into a width by height pixbuf with the
+ * plug-in's own resampler, instead of gimp_image_scale. Images deeper
+ * than 8 bits are filtered at 16 bits and only rounded at the end. The
+ * pixels are read in the image's own colour space, and only the shrunk
+ * result is converted to sRGB. */
+static GdkPixbuf *
+drawable_resample (gint32 image_ID,
+                   gint32 drawable_ID,
+                   gint   width,
+                   gint   height)
+{
+  GdkPixbuf     *pixbuf;
+  GeglBuffer    *buffer;
+  guchar        *pixels;
+  gint           src_width  = TRACE_PDB (gimp_drawable_width (drawable_ID));
+  gint           src_height = TRACE_PDB (gimp_drawable_height (drawable_ID));
+  GimpPrecision  precision  = TRACE_PDB (gimp_image_get_precision (image_ID));
+  const Babl    *space      = babl_format_get_space (TRACE_PDB (gimp_drawable_get_format (drawable_ID)));
+  ResampleDepth  depth;
+  gint           stride;
+
+  depth  = (precision == GIMP_PRECISION_U8_LINEAR ||
+            precision == GIMP_PRECISION_U8_GAMMA) ? RESAMPLE_U8 : RESAMPLE_U16;
+  stride = src_width * 3 * (depth == RESAMPLE_U16 ? 2 : 1);
+
+  pixels = g_try_malloc ((gsize) stride * src_height);
+  if (pixels == NULL)
+  {
+    return NULL;
   }
 
-  aspect_ratio = (gdouble)dst_width / gimp_drawable_width (*layer_ID);
+  buffer = TRACE_PDB (gimp_drawable_get_buffer (drawable_ID));
+  gegl_buffer_get (buffer, GEGL_RECTANGLE (0, 0, src_width, src_height), 1.0,
+                   babl_format_with_space (depth == RESAMPLE_U16 ? "R'G'B' u16" : "R'G'B' u8",
+                                           space),
+                   pixels, stride, GEGL_ABYSS_NONE);
+  g_object_unref (buffer);
 
-  if ((gimp_drawable_height (*layer_ID) * aspect_ratio) > dst_height){
-    aspect_ratio = (gdouble)dst_height / gimp_drawable_height (*layer_ID);
+  pixbuf = gdk_pixbuf_new (GDK_COLORSPACE_RGB, FALSE, 8, width, height);
 
-    gimp_layer_scale(*layer_ID,
-                gimp_drawable_width (*layer_ID) * aspect_ratio,
-                gimp_drawable_height (*layer_ID) * aspect_ratio,
-                FALSE);
+  if (space == babl_space ("sRGB"))
+  {
+    resample_pixels (pixels, depth, src_width, src_height, stride,
+                     gdk_pixbuf_get_pixels (pixbuf), RESAMPLE_U8,
+                     width, height, gdk_pixbuf_get_rowstride (pixbuf),
+                     3, sheetvals.resample);
   }
   else
   {
-
-    gimp_layer_scale(*layer_ID,
-                dst_width,
-                gimp_drawable_height (*layer_ID) * aspect_ratio,
-                FALSE);
-
+    // Shrunk at the depth it was read at, then converted
+    gint    thumb_stride = width * 3 * (depth == RESAMPLE_U16 ? 2 : 1);
+    guchar *thumb        = g_malloc ((gsize) thumb_stride * height);
+
+    resample_pixels (pixels, depth, src_width, src_height, stride,
+                     thumb, depth, width, height, thumb_stride,
+                     3, sheetvals.resample);
+    color_profile_convert (space, depth, FALSE, thumb, thumb_stride, pixbuf);
+    g_free (thumb);
   }
+  g_free (pixels);
 
-  if (rotated){
-      gimp_item_transform_translate (*layer_ID,
-                    0,
-                    gimp_drawable_height (*layer_ID));
-  }
-  gimp_item_transform_translate (*layer_ID,
-              (dst_width - gimp_drawable_width (*layer_ID)) / 2,
-              0);
-  return *layer_ID;
+  return pixbuf;
 }
 
-static gint32 // error in here, i think gexiv2 is missing 
-add_caption (const gchar    *file_dir,
-             guint32 *image_ID_dst,
-             guint32 *layer_ID,
-             gint     dst_width)
-{  
-GExiv2Metadata *metadata;
-  const gchar *caption = "";
-  gdouble caption_size;
-
-  gdouble f_number;
-  gdouble focal_length;
-  gint    iso_speed;
-  gint exposure_time_nom, exposure_time_dom;
+/* Prints how fast the run went, per core as well since that is what the
+ * batch machines are sized by */
+static void
+report_throughput (guint   n_images,
+                   guint   n_sheets,
+                   gdouble seconds)
+{
+  guint   n_cores = MAX (g_get_num_processors (), 1);
+  gdouble rate    = seconds > 0 ? n_images / seconds : 0;
 
-  size_t captionLength;
+  g_printerr ("%s: %u images on %u sheets in %.2f s, "
+              "%.1f images/s, %.1f images/s per core (%u cores)\n",
+              PLUG_IN_BINARY, n_images, n_sheets, seconds,
+              rate, rate / n_cores, n_cores);
+}
 
-  metadata = gexiv2_metadata_new();
-  
-  caption_size = gimp_units_to_pixels (sheetvals.caption_size, sheetvals.cs_type, sheetvals.sheet_res);
+/* Loads a file the workers could not decode through GIMP's own loaders,
+ * in a scratch image, and hands it back scaled like a worker thumbnail:
+ * to the size the layout gave it, or fitted into the box when its header
+ * could not be read either */
+static GdkPixbuf *
+load_fallback (const gchar       *file,
+               const ThumbTarget *target)
+{
+  GdkPixbuf  *pixbuf;
+  gint32      image_ID;
+  gint32      drawable_ID;
+  gint        width;
+  gint        height;
+  gint64      span = TRACE_START ();
+  guint       pdb_calls = TRACE_PDB_CALLS ();
+
+  image_ID = TRACE_PDB (gimp_file_load (GIMP_RUN_NONINTERACTIVE, file, file));
+  if (image_ID == -1)
+  {
+    TRACE_END ("pdb", "load_fallback", span, file, trace_file_size (file),
+               TRACE_PDB_CALLS () - pdb_calls);
+    return NULL;
+  }
 
-  gexiv2_metadata_open_path (metadata,
-                           file_dir,
-                           NULL);
-  
-  f_number = gexiv2_metadata_try_get_fnumber (metadata, NULL);
-  focal_length = gexiv2_metadata_try_get_focal_length (metadata, NULL);
-  iso_speed = gexiv2_metadata_try_get_iso_speed (metadata, NULL);
-  
-  gexiv2_metadata_try_get_exposure_time (metadata,
-                                       &exposure_time_nom,
-                                       &exposure_time_dom,
-                                       NULL);
+  TRACE_PDB (gimp_image_undo_disable (image_ID));
 
-  gchar captionBuffer[256];  // Adjust the buffer size as needed
-  if (sheetvals.file_name) {
-    snprintf(captionBuffer, sizeof(captionBuffer), "%s - ", filename);
-  }
-  if (f_number >= 0 && sheetvals.aperture) {
-      snprintf(captionBuffer + strlen(captionBuffer), sizeof(captionBuffer) - strlen(captionBuffer),
-                "f/%.2g, ", f_number);
-  }
-  if (focal_length > 1 && sheetvals.focal_length) {
-      snprintf(captionBuffer + strlen(captionBuffer), sizeof(captionBuffer) - strlen(captionBuffer),
-                "%.2gmm, ", focal_length);
+  if (sheetvals.rotate_images)
+  {
+    width  = TRACE_PDB (gimp_image_width (image_ID));
+    height = TRACE_PDB (gimp_image_height (image_ID));
+    if (width < height)
+    {
+      TRACE_PDB (gimp_image_rotate (image_ID, GIMP_ROTATE_270));
+    }
   }
-  if (iso_speed > 1 && sheetvals.ISO) {
-      snprintf(captionBuffer + strlen(captionBuffer), sizeof(captionBuffer) - strlen(captionBuffer),
-                "%d, ", iso_speed);
+
+  drawable_ID = TRACE_PDB (gimp_image_flatten (image_ID));
+
+  if (target->width > 0 && target->height > 0)
+  {
+    width  = target->width;
+    height = target->height;
   }
-  if (exposure_time_nom > 0 && exposure_time_dom > 0 && sheetvals.exposure) {
-      snprintf(captionBuffer + strlen(captionBuffer), sizeof(captionBuffer) - strlen(captionBuffer),
-                "%d/%ds, ", exposure_time_nom, exposure_time_dom);
+  else
+  {
+    gint src_width  = TRACE_PDB (gimp_drawable_width (drawable_ID));
+    gint src_height = TRACE_PDB (gimp_drawable_height (drawable_ID));
+
+    thumbnail_fit (src_width,
+                   src_height,
+                   target->box_width,
+                   target->box_height,
+                   &width,
+                   &height);
   }
 
-  // Remove the trailing comma and space
-  captionLength = strlen(captionBuffer);
-  if (captionLength >= 2) {
-      captionBuffer[captionLength - 2] = '\0';
-  }
+  pixbuf = drawable_resample (image_ID, drawable_ID, width, height);
+
+  TRACE_PDB (gimp_image_delete (image_ID));
+
+  TRACE_END ("pdb", "load_fallback", span, file, trace_file_size (file),
+             TRACE_PDB_CALLS () - pdb_calls);
+  return pixbuf;
+}
+
+// Starts composing straight into the background layer of a new sheet
+static Sheet *
+begin_direct_sheet (gint32            layer_ID,
+                    const SheetStyle *style,
+                    SheetText        *text)
+{
+  GeglBuffer *buffer;
+  Sheet      *sheet;
+
+  buffer = gimp_drawable_get_buffer (layer_ID);
+  sheet = sheet_new (buffer, style, text);
+  g_object_unref (buffer);
+
+  return sheet;
+}
+
+/* Adds caption as a text layer on top, as wide as the cell and centred
+ * in it, for sheets whose layers are kept to be edited */
+static gint32
+add_caption (const gchar      *caption,
+             const SheetStyle *style,
+             gint32            image_ID_dst,
+             gint              dst_width)
+{
+  gint32 layer_ID;
+  gint64 span      = TRACE_START ();
+  guint  pdb_calls = TRACE_PDB_CALLS ();
+  gint   height;
+
+  layer_ID = TRACE_PDB (gimp_text_layer_new (image_ID_dst,
+                                             caption,
+                                             style->fontname,
+                                             style->caption_size,
+                                             GIMP_UNIT_PIXEL));
 
-  // Set the caption
-  caption = g_strdup(captionBuffer);
+  TRACE_PDB (gimp_image_insert_layer (image_ID_dst, layer_ID, 0, -1));
 
+  height = TRACE_PDB (gimp_drawable_height (layer_ID));
+  TRACE_PDB (gimp_text_layer_resize (layer_ID, dst_width, height));
+  TRACE_PDB (gimp_text_layer_set_justification (layer_ID, GIMP_TEXT_JUSTIFY_CENTER));
 
-  *layer_ID = gimp_text_layer_new (*image_ID_dst,
-                     caption,
-                     sheetvals.fontname,
-                     caption_size,
-                     GIMP_UNIT_PIXEL);
+  TRACE_END ("pdb", "add_caption", span, NULL, 0, TRACE_PDB_CALLS () - pdb_calls);
+  return layer_ID;
+}
 
-  gimp_image_insert_layer (*image_ID_dst,
-                          *layer_ID,
-                          0,
-                          -1);
+// Adds a thumbnail as a layer, centred horizontally in the cell
+static gint32
+add_thumbnail (GdkPixbuf   *pixbuf,
+               const gchar *name,
+               gint32       image_ID_dst,
+               gint         dst_width)
+{
+  GeglBuffer *buffer;
+  gint32      layer_ID;
+  gint        width     = gdk_pixbuf_get_width (pixbuf);
+  gint        height    = gdk_pixbuf_get_height (pixbuf);
+  gboolean    has_alpha = gdk_pixbuf_get_has_alpha (pixbuf);
+  gint64      span      = TRACE_START ();
+  guint       pdb_calls = TRACE_PDB_CALLS ();
+  gint        mode;
+
+  mode = TRACE_PDB (gimp_image_get_default_new_layer_mode (image_ID_dst));
+  layer_ID = TRACE_PDB (gimp_layer_new (image_ID_dst, name, width, height,
+                                        has_alpha ? GIMP_RGBA_IMAGE : GIMP_RGB_IMAGE,
+                                        100,
+                                        mode));
+
+  TRACE_PDB (gimp_image_insert_layer (image_ID_dst,
+                                      layer_ID,
+                                      0,
+                                      -1));
+
+  buffer = TRACE_PDB (gimp_drawable_get_buffer (layer_ID));
+  gegl_buffer_set (buffer, GEGL_RECTANGLE (0, 0, width, height), 0,
+                   babl_format (has_alpha ? "R'G'B'A u8" : "R'G'B' u8"),
+                   gdk_pixbuf_get_pixels (pixbuf),
+                   gdk_pixbuf_get_rowstride (pixbuf));
+  g_object_unref (buffer);
+
+  TRACE_PDB (gimp_item_transform_translate (layer_ID,
+                                            (dst_width - width) / 2,
+                                            0));
+
+  TRACE_END ("pdb", "add_thumbnail", span, name, 0, TRACE_PDB_CALLS () - pdb_calls);
+  return layer_ID;
+}
 
-  gimp_text_layer_resize (*layer_ID,
-                          dst_width,
-                          gimp_drawable_height(*layer_ID)
-                         );
+// The caption values the user picked
+static CaptionFields
+caption_fields (void)
+{
+  return (sheetvals.file_name    ? CAPTION_FILE_NAME    : 0) |
+         (sheetvals.aperture     ? CAPTION_APERTURE     : 0) |
+         (sheetvals.focal_length ? CAPTION_FOCAL_LENGTH : 0) |
+         (sheetvals.ISO          ? CAPTION_ISO          : 0) |
+         (sheetvals.exposure     ? CAPTION_EXPOSURE     : 0);
+}
 
-  gimp_text_layer_set_justification (*layer_ID,
-                                   GIMP_TEXT_JUSTIFY_CENTER);
-  g_free (caption);
-  g_object_unref (metadata);
-  return *layer_ID;
+// Builds the caption text out of the file name and the EXIF values the user picked
+static void
+format_caption (const ExifInfo *exif,
+                gchar          *captionBuffer,
+                gsize           size)
+{
+  metadata_format_caption (exif, filename, caption_fields (), captionBuffer, size);
 }
 
-// Create an image, set layer_ID, drawable and rgn, returns the image_ID REWRTIE!!
+// Creates a white sheet image, sets layer_ID to its background layer and returns the image_ID
 
 static gint32
 create_new_image (guint           file_num,
@@ -562,27 +2151,92 @@ create_new_image (guint           file_num,
 {
 
   gint32            image_ID;
-  gimp_context_push ();
-  gimp_context_set_background (&(GimpRGB){1.0, 1.0, 1.0, 1.0});
-  image_ID = gimp_image_new (width, height, GIMP_RGB);
+  gchar            *name;
+  gint64            span = TRACE_START ();
+  guint             pdb_calls = TRACE_PDB_CALLS ();
+  gint              mode;
+  TRACE_PDB (gimp_context_push ());
+  TRACE_PDB (gimp_context_set_background (&(GimpRGB){1.0, 1.0, 1.0, 1.0}));
+  image_ID = TRACE_PDB (gimp_image_new (width, height, GIMP_RGB));
 
+  // Named like the file it would be exported to
+  name = g_strdup_printf ("%s_%u", sheetvals.file_prefix, file_num);
+  TRACE_PDB (gimp_image_set_filename (image_ID, name));
+  g_free (name);
 
-  gimp_image_set_filename (image_ID, g_strdup_printf("%s_%d", sheetvals.file_prefix, (gchar)file_num));
+  TRACE_PDB (gimp_image_undo_disable (image_ID));
 
-  gimp_image_undo_disable (image_ID);
+  mode = TRACE_PDB (gimp_image_get_default_new_layer_mode (image_ID));
+  *layer_ID = TRACE_PDB (gimp_layer_new(image_ID, "Background", width, height,
+                                        GIMP_RGB,
+                                        100,
+                                        mode));
 
-  *layer_ID = gimp_layer_new(image_ID, "Background", width, height,
-                             GIMP_RGB,
-                             100,
-                             gimp_image_get_default_new_layer_mode (image_ID));
+  TRACE_PDB (gimp_drawable_fill(*layer_ID, GIMP_FILL_BACKGROUND));
+  TRACE_PDB (gimp_context_pop ());
 
-  gimp_drawable_fill(*layer_ID, GIMP_FILL_BACKGROUND);
+  TRACE_PDB (gimp_image_insert_layer (image_ID, *layer_ID, -1, 0));
 
-  gimp_image_insert_layer (image_ID, *layer_ID, -1, 0);
-  
+  TRACE_END ("pdb", "create_new_image", span, NULL, 0, TRACE_PDB_CALLS () - pdb_calls);
   return image_ID;
 }
 
+/* Sends what the entries hold now to the preview, which draws it on its
+ * own thread. Connected to every entry and toggle the first sheet depends on. */
+static void
+update_preview (GtkWidget   *widget,
+                SheetDialog *dialog)
+{
+  SheetPreviewSettings settings;
+  gdouble              res;
+  gchar               *folder;
+
+  folder = gtk_file_chooser_get_current_folder (GTK_FILE_CHOOSER (dialog->file_entry));
+  if (folder == NULL)
+    return;
+
+  res = gimp_size_entry_get_refval (GIMP_SIZE_ENTRY (dialog->sheet_res), 0);
+
+  settings.folder       = folder;
+  settings.recursive    = sheetvals.recursive;
+  settings.use_cache    = sheetvals.cache_thumbnails;
+  settings.sheet_width  = gimp_units_to_pixels (gimp_size_entry_get_value (GIMP_SIZE_ENTRY (dialog->width), 0),
+                                                gimp_size_entry_get_unit (GIMP_SIZE_ENTRY (dialog->width)), res);
+  settings.sheet_height = gimp_units_to_pixels (gimp_size_entry_get_value (GIMP_SIZE_ENTRY (dialog->width), 1),
+                                                gimp_size_entry_get_unit (GIMP_SIZE_ENTRY (dialog->width)), res);
+  settings.gap_vert     = gimp_units_to_pixels (gimp_size_entry_get_value (GIMP_SIZE_ENTRY (dialog->gap), 0),
+                                                gimp_size_entry_get_unit (GIMP_SIZE_ENTRY (dialog->gap)), res);
+  settings.gap_horiz    = gimp_units_to_pixels (gimp_size_entry_get_value (GIMP_SIZE_ENTRY (dialog->gap), 1),
+                                                gimp_size_entry_get_unit (GIMP_SIZE_ENTRY (dialog->gap)), res);
+  settings.column       = gimp_size_entry_get_refval (GIMP_SIZE_ENTRY (dialog->row_column), 0);
+  settings.row          = gimp_size_entry_get_refval (GIMP_SIZE_ENTRY (dialog->row_column), 1);
+  settings.rotate       = sheetvals.rotate_images;
+  settings.layout       = sheetvals.layout;
+  settings.captions     = caption_fields ();
+
+  settings.style.fontname     = sheetvals.fontname;
+  settings.style.caption_size = gimp_units_to_pixels (gimp_size_entry_get_value (GIMP_SIZE_ENTRY (dialog->caption_text_size), 0),
+                                                      gimp_size_entry_get_unit (GIMP_SIZE_ENTRY (dialog->caption_text_size)), res);
+  memcpy (settings.style.foreground, dialog->foreground, 3);
+  settings.style.background[0] = settings.style.background[1] = settings.style.background[2] = 255;
+
+  sheet_preview_update (dialog->preview, &settings);
+
+  g_free (folder);
+}
+
+/* Keeps the picked font for the run and redraws the preview with it */
+static void
+caption_font_set (GimpFontSelectButton *button,
+                  const gchar          *font_name,
+                  gboolean              dialog_closing,
+                  SheetDialog          *dialog)
+{
+  g_strlcpy (sheetvals.fontname, font_name, NAME_LEN);
+
+  update_preview (NULL, dialog);
+}
+
 //GUI, cahnge the way this is done in order to have it do it in real time, so then you can reuse the widghets, also make it so it isd in multiple functions
 
 static gboolean
@@ -594,15 +2248,24 @@ contact_sheet_dialog (gint32 image_ID)
   GtkWidget       *hbox;
   GtkWidget       *label;
   GtkWidget       *caption_text_size;
+  GtkWidget       *caption_font;
   GtkWidget       *sheet_res;
   GtkWidget       *file_entry;
   GtkWidget       *prefix;
   GtkWidget       *check_box;
+  GtkWidget       *output;
+  GtkWidget       *memory_limit;
+  GtkWidget       *resample;
+  GtkWidget       *layout;
+  GtkWidget       *tiers;
   gboolean         run;
   GimpUnit         unit;
   GtkWidget       *width;
   GtkWidget       *gap;
   GtkWidget       *row_column;
+  GtkWidget       *frame;
+  SheetDialog      dialog;
+  GimpRGB          foreground;
   gimp_ui_init (PLUG_IN_BINARY, TRUE);
 
   dlg = gimp_dialog_new ("Contact Sheet", PLUG_IN_ROLE,
@@ -631,15 +2294,28 @@ contact_sheet_dialog (gint32 image_ID)
   gtk_box_pack_start (GTK_BOX (main_vbox), vbox, FALSE, FALSE, 0);
   gtk_widget_show (vbox);
 
+  hbox = gtk_box_new(GTK_ORIENTATION_HORIZONTAL, 12);
+  gtk_box_pack_start(GTK_BOX(vbox), hbox, FALSE, FALSE, 0);
+  gtk_widget_show(hbox);
+
   // File entry change to dir entry
   file_entry = gtk_file_chooser_widget_new(GTK_FILE_CHOOSER_ACTION_SELECT_FOLDER);
-  gtk_widget_set_size_request(file_entry, 600, 200);
+  gtk_widget_set_size_request(file_entry, 600, PREVIEW_HEIGHT);
   if(sheetvals.file_dir_tree[0] != '~'){
     gtk_file_chooser_set_current_folder(GTK_FILE_CHOOSER (file_entry), sheetvals.file_dir_tree);
   }
-  gtk_box_pack_start (GTK_BOX (vbox), file_entry, FALSE, FALSE, 0);
+  gtk_box_pack_start (GTK_BOX (hbox), file_entry, TRUE, TRUE, 0);
   gtk_widget_show (file_entry);
 
+  // The first sheet as the settings stand, redrawn as they change
+  dialog.preview = sheet_preview_new (PREVIEW_WIDTH, PREVIEW_HEIGHT);
+
+  frame = gtk_frame_new (NULL);
+  gtk_container_add (GTK_CONTAINER (frame), sheet_preview_get_widget (dialog.preview));
+  gtk_box_pack_start (GTK_BOX (hbox), frame, FALSE, FALSE, 0);
+  gtk_widget_show (sheet_preview_get_widget (dialog.preview));
+  gtk_widget_show (frame);
+
   /*  The sheet size entries  */
   hbox = gtk_box_new(GTK_ORIENTATION_HORIZONTAL, 5);
   gtk_box_pack_start(GTK_BOX(vbox), hbox, FALSE, FALSE, 0);
@@ -738,6 +2414,25 @@ contact_sheet_dialog (gint32 image_ID)
   g_signal_connect (check_box, "toggled",
                     G_CALLBACK (gimp_toggle_button_update),
                     &sheetvals.rotate_images);
+  g_signal_connect (check_box, "toggled",
+                    G_CALLBACK (update_preview), &dialog);
+
+  // Rows and columns set the cell, the other layouts take its height or width from it
+  label = gtk_label_new("Layout: ");
+  layout = gimp_int_combo_box_new ("Grid",      LAYOUT_GRID,
+                                   "Justified", LAYOUT_JUSTIFIED,
+                                   "Masonry",   LAYOUT_MASONRY,
+                                   NULL);
+  gimp_int_combo_box_connect (GIMP_INT_COMBO_BOX (layout), sheetvals.layout,
+                              G_CALLBACK (gimp_int_combo_box_get_active),
+                              &sheetvals.layout);
+  g_signal_connect (layout, "changed",
+                    G_CALLBACK (update_preview), &dialog);
+
+  gtk_box_pack_start (GTK_BOX (hbox), label, FALSE, FALSE, 0);
+  gtk_box_pack_start (GTK_BOX (hbox), layout, FALSE, FALSE, 0);
+  gtk_widget_show (label);
+  gtk_widget_show (layout);
 
   hbox = gtk_box_new(GTK_ORIENTATION_HORIZONTAL, 5);
   gtk_box_pack_start(GTK_BOX(vbox), hbox, FALSE, FALSE, 0);
@@ -750,6 +2445,8 @@ contact_sheet_dialog (gint32 image_ID)
   g_signal_connect (check_box, "toggled",
                     G_CALLBACK (gimp_toggle_button_update),
                     &sheetvals.file_name);
+  g_signal_connect (check_box, "toggled",
+                    G_CALLBACK (update_preview), &dialog);
 
   check_box = gtk_check_button_new_with_mnemonic("aperture");
   gtk_widget_show(check_box);
@@ -758,6 +2455,8 @@ contact_sheet_dialog (gint32 image_ID)
   g_signal_connect (check_box, "toggled",
                     G_CALLBACK (gimp_toggle_button_update),
                     &sheetvals.aperture);
+  g_signal_connect (check_box, "toggled",
+                    G_CALLBACK (update_preview), &dialog);
 
   check_box = gtk_check_button_new_with_mnemonic("Focal Length");
   gtk_widget_show(check_box);
@@ -766,6 +2465,8 @@ contact_sheet_dialog (gint32 image_ID)
   g_signal_connect (check_box, "toggled",
                     G_CALLBACK (gimp_toggle_button_update),
                     &sheetvals.focal_length);
+  g_signal_connect (check_box, "toggled",
+                    G_CALLBACK (update_preview), &dialog);
 
   check_box = gtk_check_button_new_with_mnemonic("ISO");
   gtk_widget_show(check_box);
@@ -774,6 +2475,8 @@ contact_sheet_dialog (gint32 image_ID)
   g_signal_connect (check_box, "toggled",
                     G_CALLBACK (gimp_toggle_button_update),
                     &sheetvals.ISO);
+  g_signal_connect (check_box, "toggled",
+                    G_CALLBACK (update_preview), &dialog);
 
   check_box = gtk_check_button_new_with_mnemonic("Exposure");
   gtk_widget_show(check_box);
@@ -782,6 +2485,8 @@ contact_sheet_dialog (gint32 image_ID)
   g_signal_connect (check_box, "toggled",
                     G_CALLBACK (gimp_toggle_button_update),
                     &sheetvals.exposure);
+  g_signal_connect (check_box, "toggled",
+                    G_CALLBACK (update_preview), &dialog);
 
   hbox = gtk_box_new(GTK_ORIENTATION_HORIZONTAL, 5);
   gtk_box_pack_start(GTK_BOX(vbox), hbox, FALSE, FALSE, 0);
@@ -809,6 +2514,11 @@ contact_sheet_dialog (gint32 image_ID)
   label = gimp_size_entry_attach_label (GIMP_SIZE_ENTRY (caption_text_size), "Text size :",
         1, 0, 0.0);
 
+  // Caption font, the preview is redrawn with it once it is picked
+  caption_font = gimp_font_select_button_new ("Caption Font", sheetvals.fontname);
+  gtk_box_pack_start (GTK_BOX (hbox), caption_font, FALSE, FALSE, 0);
+  gtk_widget_show (caption_font);
+
   /*  Caption text size entry  */
   sheet_res = gimp_size_entry_new (1,                            /*  number_of_fields  */
                                unit,                         /*  unit              */
@@ -845,6 +2555,45 @@ contact_sheet_dialog (gint32 image_ID)
                     G_CALLBACK (gimp_toggle_button_update),
                     &sheetvals.flatten);
 
+  check_box = gtk_check_button_new_with_mnemonic("Cache thumbnails");
+  gtk_widget_show(check_box);
+
+  gtk_box_pack_start (GTK_BOX (hbox), check_box, FALSE, FALSE, 0);
+  gtk_toggle_button_set_active(GTK_CHECK_BUTTON (check_box), sheetvals.cache_thumbnails);
+  g_signal_connect (check_box, "toggled",
+                    G_CALLBACK (gimp_toggle_button_update),
+                    &sheetvals.cache_thumbnails);
+
+  check_box = gtk_check_button_new_with_mnemonic("Keep layers");
+  gtk_widget_show(check_box);
+
+  gtk_box_pack_start (GTK_BOX (hbox), check_box, FALSE, FALSE, 0);
+  gtk_toggle_button_set_active(GTK_CHECK_BUTTON (check_box), sheetvals.keep_layers);
+  g_signal_connect (check_box, "toggled",
+                    G_CALLBACK (gimp_toggle_button_update),
+                    &sheetvals.keep_layers);
+
+  check_box = gtk_check_button_new_with_mnemonic("Include subfolders");
+  gtk_widget_show(check_box);
+
+  gtk_box_pack_start (GTK_BOX (hbox), check_box, FALSE, FALSE, 0);
+  gtk_toggle_button_set_active(GTK_CHECK_BUTTON (check_box), sheetvals.recursive);
+  g_signal_connect (check_box, "toggled",
+                    G_CALLBACK (gimp_toggle_button_update),
+                    &sheetvals.recursive);
+  g_signal_connect (check_box, "toggled",
+                    G_CALLBACK (update_preview), &dialog);
+
+  // For tethered shooting, the sheets grow as frames come in
+  check_box = gtk_check_button_new_with_mnemonic("Keep watching the folder");
+  gtk_widget_show(check_box);
+
+  gtk_box_pack_start (GTK_BOX (hbox), check_box, FALSE, FALSE, 0);
+  gtk_toggle_button_set_active(GTK_CHECK_BUTTON (check_box), sheetvals.watch);
+  g_signal_connect (check_box, "toggled",
+                    G_CALLBACK (gimp_toggle_button_update),
+                    &sheetvals.watch);
+
   //File name prefix entry option
   hbox = gtk_box_new(GTK_ORIENTATION_HORIZONTAL, 5);
   gtk_box_pack_start(GTK_BOX(vbox), hbox, FALSE, FALSE, 0);
@@ -859,6 +2608,91 @@ contact_sheet_dialog (gint32 image_ID)
   gtk_widget_show (label);
   gtk_widget_show (prefix);
 
+  // Open the sheets, or write them out as file prefix_N and close them
+  label = gtk_label_new("Output: ");
+  output = gimp_int_combo_box_new ("Open in GIMP", SHEET_OUTPUT_DISPLAY,
+                                   "PNG",          SHEET_OUTPUT_PNG,
+                                   "JPEG",         SHEET_OUTPUT_JPEG,
+                                   "TIFF",         SHEET_OUTPUT_TIFF,
+                                   "PDF",          SHEET_OUTPUT_PDF,
+                                   NULL);
+  gimp_int_combo_box_set_active (GIMP_INT_COMBO_BOX (output), sheetvals.output);
+
+  gtk_box_pack_start (GTK_BOX (hbox), label, FALSE, FALSE, 0);
+  gtk_box_pack_start (GTK_BOX (hbox), output, FALSE, FALSE, 0);
+  gtk_widget_show (label);
+  gtk_widget_show (output);
+
+  // Memory ceiling for the run, decoding and writing slow down to stay under it
+  label = gtk_label_new("Memory limit (MB): ");
+  memory_limit = gtk_spin_button_new_with_range (0, 1 << 20, 256);
+  gtk_spin_button_set_value (GTK_SPIN_BUTTON (memory_limit), sheetvals.memory_limit);
+  gtk_widget_set_tooltip_text (memory_limit, "0 for no limit");
+
+  gtk_box_pack_start (GTK_BOX (hbox), label, FALSE, FALSE, 0);
+  gtk_box_pack_start (GTK_BOX (hbox), memory_limit, FALSE, FALSE, 0);
+  gtk_widget_show (label);
+  gtk_widget_show (memory_limit);
+
+  // Drafts can shrink faster, sheets for print get the sharper filter
+  label = gtk_label_new("Scaling: ");
+  resample = gimp_int_combo_box_new ("Fast (box)",        RESAMPLE_BOX,
+                                     "Print (Lanczos-3)", RESAMPLE_LANCZOS3,
+                                     NULL);
+  gimp_int_combo_box_set_active (GIMP_INT_COMBO_BOX (resample), sheetvals.resample);
+
+  gtk_box_pack_start (GTK_BOX (hbox), label, FALSE, FALSE, 0);
+  gtk_box_pack_start (GTK_BOX (hbox), resample, FALSE, FALSE, 0);
+  gtk_widget_show (label);
+  gtk_widget_show (resample);
+
+  // Smaller copies of every exported sheet, for the web, shrunk from it as it is written
+  label = gtk_label_new("Also at (dpi): ");
+  tiers = gtk_entry_new();
+  gtk_entry_set_text(GTK_ENTRY (tiers), sheetvals.tiers);
+  gtk_entry_set_width_chars (GTK_ENTRY (tiers), 8);
+  gtk_widget_set_tooltip_text (tiers, "Comma separated, e.g. 72,150; PNG, JPEG and TIFF only");
+
+  gtk_box_pack_start (GTK_BOX (hbox), label, FALSE, FALSE, 0);
+  gtk_box_pack_start (GTK_BOX (hbox), tiers, FALSE, FALSE, 0);
+  gtk_widget_show (label);
+  gtk_widget_show (tiers);
+
+  // Redraw the preview whenever something it shows changes
+  dialog.file_entry        = file_entry;
+  dialog.width             = width;
+  dialog.gap               = gap;
+  dialog.row_column        = row_column;
+  dialog.caption_text_size = caption_text_size;
+  dialog.sheet_res         = sheet_res;
+
+  gimp_context_get_foreground (&foreground);
+  gimp_rgb_get_uchar (&foreground,
+                      &dialog.foreground[0], &dialog.foreground[1], &dialog.foreground[2]);
+
+  g_signal_connect (file_entry, "current-folder-changed",
+                    G_CALLBACK (update_preview), &dialog);
+  g_signal_connect (width, "value-changed",
+                    G_CALLBACK (update_preview), &dialog);
+  g_signal_connect (width, "unit-changed",
+                    G_CALLBACK (update_preview), &dialog);
+  g_signal_connect (gap, "value-changed",
+                    G_CALLBACK (update_preview), &dialog);
+  g_signal_connect (gap, "unit-changed",
+                    G_CALLBACK (update_preview), &dialog);
+  g_signal_connect (row_column, "value-changed",
+                    G_CALLBACK (update_preview), &dialog);
+  g_signal_connect (caption_text_size, "value-changed",
+                    G_CALLBACK (update_preview), &dialog);
+  g_signal_connect (caption_text_size, "unit-changed",
+                    G_CALLBACK (update_preview), &dialog);
+  g_signal_connect (sheet_res, "value-changed",
+                    G_CALLBACK (update_preview), &dialog);
+  g_signal_connect (caption_font, "font-set",
+                    G_CALLBACK (caption_font_set), &dialog);
+
+  update_preview (NULL, &dialog);
+
   // run
   run = (gimp_dialog_run (GIMP_DIALOG (dlg)) == GTK_RESPONSE_OK);
   if (run)
@@ -901,8 +2735,18 @@ contact_sheet_dialog (gint32 image_ID)
         gimp_size_entry_get_value (GIMP_SIZE_ENTRY (caption_text_size), 0);
 
       strcpy(sheetvals.file_prefix, gtk_entry_get_text(prefix));
+
+      gimp_int_combo_box_get_active (GIMP_INT_COMBO_BOX (output), &sheetvals.output);
+
+      sheetvals.memory_limit =
+        gtk_spin_button_get_value_as_int (GTK_SPIN_BUTTON (memory_limit));
+
+      gimp_int_combo_box_get_active (GIMP_INT_COMBO_BOX (resample), &sheetvals.resample);
+
+      g_strlcpy (sheetvals.tiers, gtk_entry_get_text (GTK_ENTRY (tiers)), NAME_LEN);
     }
 
+  sheet_preview_free (dialog.preview);
   gtk_widget_destroy (dlg);
  return run;
 }
\ No newline at end of file
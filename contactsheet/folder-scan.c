@@ -0,0 +1,230 @@
+/* GIMP - The GNU Image Manipulation Program
+ * Copyright (C) 2023 Samuel Oldham
+ * Contact sheet plug-in (C) 2023 Samuel Oldham
+ * e-mail: so9010sami@gmail.com
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Folder enumeration.
+ */
+
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+#include <gio/gio.h>
+#include <glib/gstdio.h>
+
+#include "folder-scan.h"
+
+/* Only name and type are asked for, which most file systems answer from
+ * the directory entries themselves without a stat () per file */
+#define FOLDER_SCAN_ATTRIBUTES  G_FILE_ATTRIBUTE_STANDARD_NAME "," \
+                                G_FILE_ATTRIBUTE_STANDARD_TYPE
+
+typedef enum
+{
+  SCAN_IMAGE,
+  SCAN_OTHER,
+  SCAN_UNKNOWN                    /* Has to be opened to tell */
+} ScanKind;
+
+/* Lower case and sorted, they are searched with bsearch () */
+static const gchar *const image_extensions[] =
+{
+  "arw", "avif", "bmp", "cr2", "cr3", "dng", "exr", "gif", "hdr", "heic",
+  "heif", "ico", "j2k", "jp2", "jpe", "jpeg", "jpg", "jxl", "nef", "nrw",
+  "orf", "pbm", "pef", "pgm", "png", "pnm", "ppm", "psd", "raf", "rw2",
+  "sr2", "srw", "tga", "tif", "tiff", "webp", "x3f", "xcf"
+};
+
+/* Sidecars and the other things cameras leave next to the images */
+static const gchar *const other_extensions[] =
+{
+  "aae", "avi", "bak", "csv", "db", "dop", "html", "ini", "json", "log",
+  "lrv", "m4a", "m4v", "md", "mkv", "mov", "mp3", "mp4", "mts", "on1",
+  "pdf", "pp3", "thm", "tmp", "txt", "wav", "xml", "xmp", "zip"
+};
+
+static gint
+folder_scan_compare_extension (gconstpointer key,
+                               gconstpointer element)
+{
+  return strcmp (key, *(const gchar *const *) element);
+}
+
+static ScanKind
+folder_scan_classify (const gchar *name)
+{
+  const gchar *dot = strrchr (name, '.');
+  gchar        extension[8];
+  gsize        length;
+  gsize        i;
+
+  if (dot == NULL || dot == name)
+    return SCAN_UNKNOWN;
+
+  length = strlen (dot + 1);
+  if (length == 0 || length >= sizeof (extension))
+    return SCAN_UNKNOWN;
+
+  for (i = 0; i <= length; i++)
+    extension[i] = g_ascii_tolower (dot[1 + i]);
+
+  if (bsearch (extension, image_extensions, G_N_ELEMENTS (image_extensions),
+               sizeof (image_extensions[0]), folder_scan_compare_extension))
+    return SCAN_IMAGE;
+
+  if (bsearch (extension, other_extensions, G_N_ELEMENTS (other_extensions),
+               sizeof (other_extensions[0]), folder_scan_compare_extension))
+    return SCAN_OTHER;
+
+  return SCAN_UNKNOWN;
+}
+
+/* Looks for the signature of a format GIMP or gdk-pixbuf can load in the
+ * first bytes of path */
+static gboolean
+folder_scan_sniff (const gchar *path)
+{
+  guchar  head[16];
+  gssize  n;
+  gint    fd;
+
+  fd = g_open (path, O_RDONLY, 0);
+  if (fd < 0)
+    return FALSE;
+
+  n = read (fd, head, sizeof (head));
+  close (fd);
+
+  if (n < 4)
+    return FALSE;
+
+  return (head[0] == 0xff && head[1] == 0xd8 && head[2] == 0xff) ||  /* JPEG */
+         memcmp (head, "\x89PNG", 4) == 0                        ||
+         memcmp (head, "GIF8", 4) == 0                            ||
+         memcmp (head, "II*\0", 4) == 0                           ||  /* TIFF and most RAW */
+         memcmp (head, "MM\0*", 4) == 0                           ||
+         memcmp (head, "8BPS", 4) == 0                            ||  /* PSD */
+         (head[0] == 'B' && head[1] == 'M')                       ||
+         (head[0] == 0xff && head[1] == 0x0a)                     ||  /* JPEG XL */
+         (n >= 12 && memcmp (head, "RIFF", 4) == 0 &&
+                     memcmp (head + 8, "WEBP", 4) == 0)           ||
+         (n >= 12 && memcmp (head + 4, "ftyp", 4) == 0 &&
+                     (memcmp (head + 8, "hei", 3) == 0 ||
+                      memcmp (head + 8, "mif1", 4) == 0 ||
+                      memcmp (head + 8, "avif", 4) == 0 ||
+                      memcmp (head + 8, "crx ", 4) == 0))         ||
+         (n >= 8 && memcmp (head, "gimp xcf", 8) == 0);
+}
+
+/* Whether folder_scan () would list path, for files that turn up later */
+gboolean
+folder_scan_is_image (const gchar *path)
+{
+  gchar    *name = g_path_get_basename (path);
+  ScanKind  kind = folder_scan_classify (name);
+
+  g_free (name);
+
+  return kind == SCAN_IMAGE || (kind == SCAN_UNKNOWN && folder_scan_sniff (path));
+}
+
+static gint
+folder_scan_compare_path (gconstpointer a,
+                          gconstpointer b)
+{
+  return strcmp (*(const gchar *const *) a, *(const gchar *const *) b);
+}
+
+GPtrArray *
+folder_scan (const gchar *folder,
+             gboolean     recursive,
+             const gchar *skip_prefix)
+{
+  GPtrArray *files = g_ptr_array_new_with_free_func (g_free);
+  GQueue     pending = G_QUEUE_INIT;
+  GFile     *top;
+  GFile     *dir;
+
+  top = g_file_new_for_path (folder);
+  g_queue_push_tail (&pending, g_object_ref (top));
+
+  while ((dir = g_queue_pop_head (&pending)) != NULL)
+    {
+      GFileEnumerator *enumerator;
+      GFileInfo       *info;
+      gboolean         at_top = g_file_equal (dir, top);
+
+      /* Symbolic links are not followed, so a link back up the tree
+       * cannot make the walk go round forever */
+      enumerator = g_file_enumerate_children (dir, FOLDER_SCAN_ATTRIBUTES,
+                                              G_FILE_QUERY_INFO_NOFOLLOW_SYMLINKS,
+                                              NULL, NULL);
+
+      while (enumerator != NULL &&
+             (info = g_file_enumerator_next_file (enumerator, NULL, NULL)) != NULL)
+        {
+          const gchar *name = g_file_info_get_name (info);
+          GFileType    type = g_file_info_get_file_type (info);
+          gchar       *path;
+          ScanKind     kind;
+
+          if (name[0] == '.' ||
+              (at_top && skip_prefix != NULL && g_str_has_prefix (name, skip_prefix)))
+            {
+              g_object_unref (info);
+              continue;
+            }
+
+          if (type == G_FILE_TYPE_DIRECTORY)
+            {
+              if (recursive)
+                g_queue_push_tail (&pending, g_file_get_child (dir, name));
+
+              g_object_unref (info);
+              continue;
+            }
+
+          if (type != G_FILE_TYPE_REGULAR && type != G_FILE_TYPE_SYMBOLIC_LINK)
+            {
+              g_object_unref (info);
+              continue;
+            }
+
+          kind = folder_scan_classify (name);
+          path = kind == SCAN_OTHER ? NULL : g_build_filename (g_file_peek_path (dir), name, NULL);
+
+          if (kind == SCAN_IMAGE ||
+              (kind == SCAN_UNKNOWN && folder_scan_sniff (path)))
+            g_ptr_array_add (files, path);
+          else
+            g_free (path);
+
+          g_object_unref (info);
+        }
+
+      g_clear_object (&enumerator);
+      g_object_unref (dir);
+    }
+
+  g_object_unref (top);
+
+  g_ptr_array_sort (files, folder_scan_compare_path);
+
+  return files;
+}
@@ -0,0 +1,37 @@
+/* GIMP - The GNU Image Manipulation Program
+ * Copyright (C) 2023 Samuel Oldham
+ * Contact sheet plug-in (C) 2023 Samuel Oldham
+ * e-mail: so9010sami@gmail.com
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#ifndef __CONTACTSHEET_FOLDER_SCAN_H__
+#define __CONTACTSHEET_FOLDER_SCAN_H__
+
+#include <glib.h>
+
+/* Lists the image files in folder, and in its subfolders when recursive,
+ * as full paths sorted by name. Names starting with skip_prefix at the top
+ * level are left out. Files are told apart by extension, and only those
+ * with an extension it does not know are opened to look at their first
+ * bytes, so no content type sniffing is done. */
+GPtrArray *folder_scan (const gchar *folder,
+                        gboolean     recursive,
+                        const gchar *skip_prefix);
+
+gboolean   folder_scan_is_image
+                       (const gchar *path);
+
+#endif /* __CONTACTSHEET_FOLDER_SCAN_H__ */
@@ -0,0 +1,232 @@
+/* GIMP - The GNU Image Manipulation Program
+ * Copyright (C) 2023 Samuel Oldham
+ * Contact sheet plug-in (C) 2023 Samuel Oldham
+ * e-mail: so9010sami@gmail.com
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Watching a folder for new images.
+ */
+
+#include <gio/gio.h>
+
+#include "folder-scan.h"
+#include "folder-watch.h"
+
+struct _FolderWatch
+{
+  GFile           *top;
+  gboolean         recursive;
+  gchar           *skip_prefix;
+  GHashTable      *monitors;      /* Folder path to its GFileMonitor */
+  FolderWatchFunc  func;
+  gpointer         user_data;
+};
+
+static void folder_watch_add (FolderWatch *watch,
+                              GFile       *dir);
+
+/* Reports file unless folder_scan () would have left it out */
+static void
+folder_watch_report (FolderWatch *watch,
+                     GFile       *file)
+{
+  GFile    *parent = g_file_get_parent (file);
+  gchar    *name   = g_file_get_basename (file);
+  gchar    *path   = g_file_get_path (file);
+  gboolean  skip;
+
+  skip = (name[0] == '.' ||
+          (watch->skip_prefix != NULL && parent != NULL && g_file_equal (parent, watch->top) &&
+           g_str_has_prefix (name, watch->skip_prefix)));
+
+  if (! skip && path != NULL &&
+      g_file_test (path, G_FILE_TEST_IS_REGULAR) && folder_scan_is_image (path))
+    watch->func (path, watch->user_data);
+
+  g_free (path);
+  g_free (name);
+  g_clear_object (&parent);
+}
+
+/* A folder that appeared under a recursive watch is watched too, and
+ * whatever was put in it before the monitor started is reported */
+static void
+folder_watch_add_tree (FolderWatch *watch,
+                       GFile       *dir)
+{
+  GPtrArray *files;
+  guint      i;
+
+  folder_watch_add (watch, dir);
+
+  files = folder_scan (g_file_peek_path (dir), TRUE, NULL);
+  for (i = 0; i < files->len; i++)
+    watch->func (g_ptr_array_index (files, i), watch->user_data);
+  g_ptr_array_free (files, TRUE);
+}
+
+static void
+folder_watch_changed (GFileMonitor      *monitor,
+                      GFile             *file,
+                      GFile             *other_file,
+                      GFileMonitorEvent  event,
+                      gpointer           user_data)
+{
+  FolderWatch *watch = user_data;
+  GFile       *arrived;
+
+  switch (event)
+    {
+    case G_FILE_MONITOR_EVENT_CHANGES_DONE_HINT:
+    case G_FILE_MONITOR_EVENT_MOVED_IN:
+    case G_FILE_MONITOR_EVENT_CREATED:
+      arrived = file;
+      break;
+
+    // Renamed within the folder, as cameras' tether software does once a frame is written
+    case G_FILE_MONITOR_EVENT_RENAMED:
+      arrived = other_file;
+      break;
+
+    default:
+      return;
+    }
+
+  if (arrived == NULL)
+    return;
+
+  if (g_file_query_file_type (arrived, G_FILE_QUERY_INFO_NOFOLLOW_SYMLINKS, NULL) ==
+      G_FILE_TYPE_DIRECTORY)
+    {
+      if (watch->recursive && event != G_FILE_MONITOR_EVENT_CHANGES_DONE_HINT)
+        folder_watch_add_tree (watch, arrived);
+      return;
+    }
+
+  // A file being written is only complete once it is closed
+  if (event != G_FILE_MONITOR_EVENT_CREATED)
+    folder_watch_report (watch, arrived);
+}
+
+static void
+folder_watch_add (FolderWatch *watch,
+                  GFile       *dir)
+{
+  GFileMonitor *monitor;
+  gchar        *path = g_file_get_path (dir);
+
+  if (path == NULL || g_hash_table_contains (watch->monitors, path))
+    {
+      g_free (path);
+      return;
+    }
+
+  monitor = g_file_monitor_directory (dir, G_FILE_MONITOR_WATCH_MOVES, NULL, NULL);
+  if (monitor == NULL)
+    {
+      g_printerr ("contactsheet: can not watch %s\n", path);
+      g_free (path);
+      return;
+    }
+
+  g_signal_connect (monitor, "changed",
+                    G_CALLBACK (folder_watch_changed), watch);
+  g_hash_table_insert (watch->monitors, path, monitor);
+}
+
+/* Watches folder, and when recursive every folder under it, including
+ * those made later. Names starting with skip_prefix at the top level are
+ * left out, like folder_scan () does. func gets the full path of each
+ * image, possibly more than once when it is written again. */
+FolderWatch *
+folder_watch_new (const gchar     *folder,
+                  gboolean         recursive,
+                  const gchar     *skip_prefix,
+                  FolderWatchFunc  func,
+                  gpointer         user_data)
+{
+  FolderWatch *watch = g_new0 (FolderWatch, 1);
+
+  watch->top         = g_file_new_for_path (folder);
+  watch->recursive   = recursive;
+  watch->skip_prefix = g_strdup (skip_prefix);
+  watch->monitors    = g_hash_table_new_full (g_str_hash, g_str_equal,
+                                              g_free, g_object_unref);
+  watch->func        = func;
+  watch->user_data   = user_data;
+
+  folder_watch_add (watch, watch->top);
+
+  if (recursive)
+    {
+      GQueue  pending = G_QUEUE_INIT;
+      GFile  *dir;
+
+      g_queue_push_tail (&pending, g_object_ref (watch->top));
+
+      while ((dir = g_queue_pop_head (&pending)) != NULL)
+        {
+          GFileEnumerator *enumerator;
+          GFileInfo       *info;
+
+          enumerator = g_file_enumerate_children (dir, G_FILE_ATTRIBUTE_STANDARD_NAME ","
+                                                       G_FILE_ATTRIBUTE_STANDARD_TYPE,
+                                                  G_FILE_QUERY_INFO_NOFOLLOW_SYMLINKS,
+                                                  NULL, NULL);
+
+          while (enumerator != NULL &&
+                 (info = g_file_enumerator_next_file (enumerator, NULL, NULL)) != NULL)
+            {
+              const gchar *name = g_file_info_get_name (info);
+
+              if (name[0] != '.' && g_file_info_get_file_type (info) == G_FILE_TYPE_DIRECTORY)
+                {
+                  GFile *child = g_file_get_child (dir, name);
+
+                  folder_watch_add (watch, child);
+                  g_queue_push_tail (&pending, child);
+                }
+
+              g_object_unref (info);
+            }
+
+          g_clear_object (&enumerator);
+          g_object_unref (dir);
+        }
+    }
+
+  return watch;
+}
+
+void
+folder_watch_free (FolderWatch *watch)
+{
+  GHashTableIter  iter;
+  gpointer        monitor;
+
+  g_hash_table_iter_init (&iter, watch->monitors);
+  while (g_hash_table_iter_next (&iter, NULL, &monitor))
+    {
+      g_signal_handlers_disconnect_by_data (monitor, watch);
+      g_file_monitor_cancel (monitor);
+    }
+
+  g_hash_table_unref (watch->monitors);
+  g_object_unref (watch->top);
+  g_free (watch->skip_prefix);
+  g_free (watch);
+}
@@ -0,0 +1,42 @@
+/* GIMP - The GNU Image Manipulation Program
+ * Copyright (C) 2023 Samuel Oldham
+ * Contact sheet plug-in (C) 2023 Samuel Oldham
+ * e-mail: so9010sami@gmail.com
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#ifndef __CONTACTSHEET_FOLDER_WATCH_H__
+#define __CONTACTSHEET_FOLDER_WATCH_H__
+
+#include <glib.h>
+
+/* Reports the images that turn up in a folder once they are complete,
+ * through GIO's file monitors (inotify on Linux). Images written in place
+ * are reported when the writer closes them, images moved in straight
+ * away. Runs on the main context of the thread that made it. */
+typedef struct _FolderWatch FolderWatch;
+
+typedef void (* FolderWatchFunc) (const gchar *file,
+                                  gpointer     user_data);
+
+FolderWatch *folder_watch_new  (const gchar     *folder,
+                                gboolean         recursive,
+                                const gchar     *skip_prefix,
+                                FolderWatchFunc  func,
+                                gpointer         user_data);
+
+void         folder_watch_free (FolderWatch     *watch);
+
+#endif /* __CONTACTSHEET_FOLDER_WATCH_H__ */
@@ -0,0 +1,118 @@
+/* GIMP - The GNU Image Manipulation Program
+ * Copyright (C) 2023 Samuel Oldham
+ * Contact sheet plug-in (C) 2023 Samuel Oldham
+ * e-mail: so9010sami@gmail.com
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Header-only image sizes for the layout pass.
+ */
+
+#include <gdk-pixbuf/gdk-pixbuf.h>
+
+#include "image-probe.h"
+#include "jpeg-load.h"
+#include "raw-preview.h"
+#include "trace.h"
+
+typedef struct
+{
+  GPtrArray  *files;
+  ImageProbe *probes;
+} ImageProbeJob;
+
+/* Reads the size and orientation of file without decoding it. JPEGs and
+ * RAW files have their EXIF orientation read, other formats are taken to
+ * be stored upright. Needs gexiv2_initialize () for RAW files. Safe on
+ * any thread. */
+gboolean
+image_probe (const gchar *file,
+             ImageProbe  *probe)
+{
+  gint     width  = 0;
+  gint     height = 0;
+  gboolean read;
+
+  probe->orientation = 1;
+
+  if (raw_preview_is_raw (file))
+    read = raw_preview_probe (file, &width, &height, &probe->orientation);
+  else if (jpeg_is_jpeg (file))
+    read = jpeg_probe (file, &width, &height, &probe->orientation);
+  else
+    read = gdk_pixbuf_get_file_info (file, &width, &height) != NULL;
+
+  if (! read || width <= 0 || height <= 0)
+    {
+      probe->width       = 0;
+      probe->height      = 0;
+      probe->orientation = 1;
+      return FALSE;
+    }
+
+  /* 5 to 8 are stored a quarter turn from upright */
+  if (probe->orientation >= 5)
+    {
+      probe->width  = height;
+      probe->height = width;
+    }
+  else
+    {
+      probe->width  = width;
+      probe->height = height;
+    }
+
+  return TRUE;
+}
+
+static void
+image_probe_worker (gpointer data,
+                    gpointer user_data)
+{
+  ImageProbeJob *job   = user_data;
+  guint          index = GPOINTER_TO_UINT (data) - 1;
+  const gchar   *file  = g_ptr_array_index (job->files, index);
+  gint64         start = TRACE_START ();
+
+  image_probe (file, &job->probes[index]);
+
+  TRACE_END ("worker", "probe", start, file, 0, 0);
+}
+
+/* Probes every file on a pool of threads, returning one ImageProbe per
+ * file in the same order. Files whose header can not be read get a size
+ * of 0, GIMP may still be able to load them. */
+ImageProbe *
+image_probe_files (GPtrArray *files)
+{
+  ImageProbeJob  job;
+  GThreadPool   *pool;
+  guint          i;
+
+  job.files  = files;
+  job.probes = g_new0 (ImageProbe, MAX (files->len, 1));
+
+  pool = g_thread_pool_new (image_probe_worker, &job,
+                            MAX (g_get_num_processors (), 1), TRUE, NULL);
+
+  /* Offset by one so the first file is not pushed as NULL */
+  for (i = 0; i < files->len; i++)
+    g_thread_pool_push (pool, GUINT_TO_POINTER (i + 1), NULL);
+
+  g_thread_pool_free (pool, FALSE, TRUE);
+
+  return job.probes;
+}
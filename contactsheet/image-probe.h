@@ -0,0 +1,39 @@
+/* GIMP - The GNU Image Manipulation Program
+ * Copyright (C) 2023 Samuel Oldham
+ * Contact sheet plug-in (C) 2023 Samuel Oldham
+ * e-mail: so9010sami@gmail.com
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#ifndef __CONTACTSHEET_IMAGE_PROBE_H__
+#define __CONTACTSHEET_IMAGE_PROBE_H__
+
+#include <glib.h>
+
+/* What is known of an image from its header alone, enough to lay a
+ * sheet out before any of it is decoded */
+typedef struct
+{
+  gint width;                     /* Upright, 0 when the header could not be read */
+  gint height;
+  gint orientation;               /* EXIF orientation the pixels are stored in, 1 when upright */
+} ImageProbe;
+
+gboolean    image_probe       (const gchar *file,
+                               ImageProbe  *probe);
+
+ImageProbe *image_probe_files (GPtrArray   *files);
+
+#endif /* __CONTACTSHEET_IMAGE_PROBE_H__ */
@@ -0,0 +1,326 @@
+/* GIMP - The GNU Image Manipulation Program
+ * Copyright (C) 2023 Samuel Oldham
+ * Contact sheet plug-in (C) 2023 Samuel Oldham
+ * e-mail: so9010sami@gmail.com
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Reduced size JPEG loader. libjpeg can hand out the image at 1/2, 1/4 or
+ * 1/8 of its size while only doing a fraction of the IDCT work, which for a
+ * camera JPEG going into a small cell is most of the cost of loading it.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <setjmp.h>
+
+#include <jpeglib.h>
+
+#include "jpeg-load.h"
+
+typedef struct
+{
+  struct jpeg_error_mgr pub;
+  jmp_buf               setjmp_buffer;
+} JpegErrorMgr;
+
+static void
+jpeg_load_error_exit (j_common_ptr cinfo)
+{
+  JpegErrorMgr *err = (JpegErrorMgr *) cinfo->err;
+
+  longjmp (err->setjmp_buffer, 1);
+}
+
+static void
+jpeg_load_output_message (j_common_ptr cinfo)
+{
+  /* Warnings about corrupt data are not worth a message per thumbnail */
+}
+
+// Checks the SOI marker, so other formats never reach libjpeg
+gboolean
+jpeg_is_jpeg (const gchar *filename)
+{
+  FILE   *fp;
+  guchar  magic[3];
+  gsize   n_read;
+
+  fp = fopen (filename, "rb");
+  if (fp == NULL)
+    return FALSE;
+
+  n_read = fread (magic, 1, sizeof (magic), fp);
+  fclose (fp);
+
+  return (n_read == sizeof (magic) &&
+          magic[0] == 0xff && magic[1] == 0xd8 && magic[2] == 0xff);
+}
+
+/* Reads a 16 or 32 bit value of a TIFF structure in either byte order */
+static guint
+jpeg_exif_get (const JOCTET *p,
+               gsize         n_bytes,
+               gboolean      big_endian)
+{
+  guint value = 0;
+  gsize i;
+
+  for (i = 0; i < n_bytes; i++)
+    value |= (guint) p[big_endian ? i : n_bytes - 1 - i] << (8 * (n_bytes - 1 - i));
+
+  return value;
+}
+
+/* The Orientation tag of the first IFD of an APP1 Exif marker, 1 when it
+ * is not there or can not be read */
+static gint
+jpeg_exif_orientation (const JOCTET *data,
+                       guint         length)
+{
+  const JOCTET *tiff = data + 6;
+  gsize         size = length - 6;
+  gboolean      big_endian;
+  guint         ifd;
+  guint         n_entries;
+  guint         i;
+
+  if (length < 6 + 8 || memcmp (data, "Exif\0\0", 6) != 0)
+    return 1;
+
+  if (tiff[0] == 'M' && tiff[1] == 'M')
+    big_endian = TRUE;
+  else if (tiff[0] == 'I' && tiff[1] == 'I')
+    big_endian = FALSE;
+  else
+    return 1;
+
+  ifd = jpeg_exif_get (tiff + 4, 4, big_endian);
+  if (ifd > size - 2)
+    return 1;
+
+  n_entries = jpeg_exif_get (tiff + ifd, 2, big_endian);
+
+  for (i = 0; i < n_entries && ifd + 2 + (i + 1) * 12 <= size; i++)
+    {
+      const JOCTET *entry = tiff + ifd + 2 + i * 12;
+
+      if (jpeg_exif_get (entry, 2, big_endian) == 0x0112)
+        {
+          guint orientation = jpeg_exif_get (entry + 8, 2, big_endian);
+
+          return orientation >= 1 && orientation <= 8 ? orientation : 1;
+        }
+    }
+
+  return 1;
+}
+
+/* Reads the size and EXIF orientation of filename from its header,
+ * without decoding any of the image */
+gboolean
+jpeg_probe (const gchar *filename,
+            gint        *width,
+            gint        *height,
+            gint        *orientation)
+{
+  struct jpeg_decompress_struct  cinfo;
+  JpegErrorMgr                   jerr;
+  jpeg_saved_marker_ptr          marker;
+  FILE                          *fp;
+
+  fp = fopen (filename, "rb");
+  if (fp == NULL)
+    return FALSE;
+
+  cinfo.err = jpeg_std_error (&jerr.pub);
+  jerr.pub.error_exit     = jpeg_load_error_exit;
+  jerr.pub.output_message = jpeg_load_output_message;
+
+  if (setjmp (jerr.setjmp_buffer))
+    {
+      jpeg_destroy_decompress (&cinfo);
+      fclose (fp);
+      return FALSE;
+    }
+
+  jpeg_create_decompress (&cinfo);
+  jpeg_stdio_src (&cinfo, fp);
+  jpeg_save_markers (&cinfo, JPEG_APP0 + 1, 0xffff);
+  jpeg_read_header (&cinfo, TRUE);
+
+  *width       = cinfo.image_width;
+  *height      = cinfo.image_height;
+  *orientation = 1;
+
+  for (marker = cinfo.marker_list; marker != NULL; marker = marker->next)
+    {
+      if (marker->marker == JPEG_APP0 + 1)
+        {
+          *orientation = jpeg_exif_orientation (marker->data, marker->data_length);
+          break;
+        }
+    }
+
+  jpeg_destroy_decompress (&cinfo);
+  fclose (fp);
+
+  return TRUE;
+}
+
+/* Decodes from fp, or from the size bytes at data when fp is NULL */
+static GdkPixbuf *
+jpeg_load_decode (FILE          *fp,
+                  const guchar  *data,
+                  gsize          size,
+                  JpegSizeFunc   size_func,
+                  gpointer       user_data)
+{
+  struct jpeg_decompress_struct  cinfo;
+  JpegErrorMgr                   jerr;
+  GdkPixbuf *volatile            pixbuf = NULL;
+  guchar                        *pixels;
+  JOCTET                        *icc;
+  guint                          icc_length;
+  gint                           rowstride;
+  gint                           width;
+  gint                           height;
+  guint                          denom;
+
+  cinfo.err = jpeg_std_error (&jerr.pub);
+  jerr.pub.error_exit     = jpeg_load_error_exit;
+  jerr.pub.output_message = jpeg_load_output_message;
+
+  if (setjmp (jerr.setjmp_buffer))
+    {
+      jpeg_destroy_decompress (&cinfo);
+
+      if (pixbuf != NULL)
+        g_object_unref (pixbuf);
+
+      return NULL;
+    }
+
+  jpeg_create_decompress (&cinfo);
+  if (fp != NULL)
+    jpeg_stdio_src (&cinfo, fp);
+  else
+    jpeg_mem_src (&cinfo, (guchar *) data, size);
+  jpeg_save_markers (&cinfo, JPEG_APP0 + 2, 0xffff);
+  jpeg_read_header (&cinfo, TRUE);
+
+  if (cinfo.jpeg_color_space == JCS_CMYK ||
+      cinfo.jpeg_color_space == JCS_YCCK)
+    {
+      jpeg_destroy_decompress (&cinfo);
+      return NULL;
+    }
+
+  width  = cinfo.image_width;
+  height = cinfo.image_height;
+  size_func (cinfo.image_width, cinfo.image_height, &width, &height, user_data);
+
+  cinfo.out_color_space = JCS_RGB;
+  cinfo.dct_method      = JDCT_ISLOW;
+  cinfo.scale_num       = 1;
+
+  /* Largest reduction that does not drop below the size we need */
+  for (denom = 8; denom > 1; denom /= 2)
+    {
+      cinfo.scale_denom = denom;
+      jpeg_calc_output_dimensions (&cinfo);
+
+      if (cinfo.output_width >= width && cinfo.output_height >= height)
+        break;
+    }
+  cinfo.scale_denom = denom;
+
+  /* Smooth chroma upsampling is lost in the final resample anyway */
+  if (denom > 1)
+    cinfo.do_fancy_upsampling = FALSE;
+
+  jpeg_start_decompress (&cinfo);
+
+  pixbuf = gdk_pixbuf_new (GDK_COLORSPACE_RGB, FALSE, 8,
+                           cinfo.output_width, cinfo.output_height);
+  if (pixbuf == NULL)
+    {
+      jpeg_destroy_decompress (&cinfo);
+      return NULL;
+    }
+
+  /* Left on the pixbuf the way gdk-pixbuf's loaders leave it */
+  if (jpeg_read_icc_profile (&cinfo, &icc, &icc_length))
+    {
+      gchar *text = g_base64_encode (icc, icc_length);
+
+      gdk_pixbuf_set_option (pixbuf, "icc-profile", text);
+      g_free (text);
+      free (icc);
+    }
+
+  pixels    = gdk_pixbuf_get_pixels (pixbuf);
+  rowstride = gdk_pixbuf_get_rowstride (pixbuf);
+
+  while (cinfo.output_scanline < cinfo.output_height)
+    {
+      JSAMPROW row = pixels + (gsize) cinfo.output_scanline * rowstride;
+
+      jpeg_read_scanlines (&cinfo, &row, 1);
+    }
+
+  jpeg_finish_decompress (&cinfo);
+  jpeg_destroy_decompress (&cinfo);
+
+  return pixbuf;
+}
+
+/* Decodes filename at the smallest DCT scale that still covers the size
+ * asked for by size_func, so the result only needs a small final resample.
+ * Returns NULL for anything libjpeg can not turn into RGB (CMYK, broken
+ * files), the caller falls back to the slower loaders for those. */
+GdkPixbuf *
+jpeg_load_scaled (const gchar  *filename,
+                  JpegSizeFunc  size_func,
+                  gpointer      user_data)
+{
+  GdkPixbuf *pixbuf;
+  FILE      *fp;
+
+  fp = fopen (filename, "rb");
+  if (fp == NULL)
+    return NULL;
+
+  pixbuf = jpeg_load_decode (fp, NULL, 0, size_func, user_data);
+  fclose (fp);
+
+  return pixbuf;
+}
+
+/* Like jpeg_load_scaled (), for a JPEG already in memory, such as the
+ * preview embedded in a RAW file */
+GdkPixbuf *
+jpeg_load_scaled_from_data (const guchar *data,
+                            gsize         size,
+                            JpegSizeFunc  size_func,
+                            gpointer      user_data)
+{
+  if (size < 3 || data[0] != 0xff || data[1] != 0xd8 || data[2] != 0xff)
+    return NULL;
+
+  return jpeg_load_decode (NULL, data, size, size_func, user_data);
+}
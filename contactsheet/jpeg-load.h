@@ -0,0 +1,50 @@
+/* GIMP - The GNU Image Manipulation Program
+ * Copyright (C) 2023 Samuel Oldham
+ * Contact sheet plug-in (C) 2023 Samuel Oldham
+ * e-mail: so9010sami@gmail.com
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#ifndef __CONTACTSHEET_JPEG_LOAD_H__
+#define __CONTACTSHEET_JPEG_LOAD_H__
+
+#include <glib.h>
+#include <gdk-pixbuf/gdk-pixbuf.h>
+
+/* Called once the JPEG header is read, with the full size of the image.
+ * Sets the smallest size the caller still needs out of the decoder. */
+typedef void (* JpegSizeFunc) (gint      src_width,
+                               gint      src_height,
+                               gint     *width,
+                               gint     *height,
+                               gpointer  user_data);
+
+gboolean   jpeg_is_jpeg     (const gchar  *filename);
+
+gboolean   jpeg_probe       (const gchar  *filename,
+                             gint         *width,
+                             gint         *height,
+                             gint         *orientation);
+
+GdkPixbuf *jpeg_load_scaled (const gchar  *filename,
+                             JpegSizeFunc  size_func,
+                             gpointer      user_data);
+
+GdkPixbuf *jpeg_load_scaled_from_data (const guchar *data,
+                                       gsize         size,
+                                       JpegSizeFunc  size_func,
+                                       gpointer      user_data);
+
+#endif /* __CONTACTSHEET_JPEG_LOAD_H__ */
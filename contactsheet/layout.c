@@ -0,0 +1,383 @@
+/* GIMP - The GNU Image Manipulation Program
+ * Copyright (C) 2023 Samuel Oldham
+ * Contact sheet plug-in (C) 2023 Samuel Oldham
+ * e-mail: so9010sami@gmail.com
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Working out where every image of a run goes, from the sizes in the
+ * image headers, before any of them is decoded.
+ */
+
+#include <string.h>
+
+#include "layout.h"
+
+typedef struct
+{
+  const LayoutSettings *settings;
+  GArray               *cells;
+  GArray               *sheet_first;
+  gint                  cell_width;     /* The grid's cell */
+  gint                  cell_height;
+  gint                  image_height;   /* cell_height less the caption */
+  gint                  left;           /* Inside the gaps round the sheet */
+  gint                  right;
+  gint                  top;
+  gint                  bottom;
+} LayoutBuilder;
+
+/* Size of the image on the sheet, turned when rotate turns it. FALSE when
+ * its header could not be read. */
+static gboolean
+layout_turned_size (const LayoutSettings *settings,
+                    const ImageProbe     *probe,
+                    gint                 *width,
+                    gint                 *height)
+{
+  gboolean turn = (settings->rotate && probe->width < probe->height);
+
+  if (probe->width <= 0 || probe->height <= 0)
+    return FALSE;
+
+  *width  = turn ? probe->height : probe->width;
+  *height = turn ? probe->width  : probe->height;
+
+  return TRUE;
+}
+
+/* Width over height on the sheet, that of the grid's cell when the image
+ * could not be probed */
+static gdouble
+layout_aspect (LayoutBuilder    *builder,
+               const ImageProbe *probe)
+{
+  gint width;
+  gint height;
+
+  if (! layout_turned_size (builder->settings, probe, &width, &height))
+    return (gdouble) builder->cell_width / builder->image_height;
+
+  return (gdouble) width / height;
+}
+
+static void
+layout_begin_sheet (LayoutBuilder *builder)
+{
+  guint first = builder->cells->len;
+
+  g_array_append_val (builder->sheet_first, first);
+}
+
+/* Adds a cell whose thumbnail is thumb_width by thumb_height, or fitted
+ * into the part of the cell above the caption when the image could not
+ * be probed */
+static void
+layout_add_cell (LayoutBuilder    *builder,
+                 const ImageProbe *probe,
+                 gint              x,
+                 gint              y,
+                 gint              cell_width,
+                 gint              cell_height,
+                 gint              thumb_width,
+                 gint              thumb_height)
+{
+  LayoutCell cell;
+  gboolean   known = (probe->width > 0 && probe->height > 0);
+
+  cell.x      = x;
+  cell.y      = y;
+  cell.width  = cell_width;
+  cell.height = cell_height;
+
+  cell.thumb.box_width   = cell_width;
+  cell.thumb.box_height  = MAX (cell_height - builder->settings->caption_height, 1);
+  cell.thumb.width       = known ? thumb_width  : 0;
+  cell.thumb.height      = known ? thumb_height : 0;
+  cell.thumb.orientation = known ? probe->orientation : 1;
+  cell.thumb.rotate      = builder->settings->rotate;
+  cell.thumb.src_width   = known ? probe->width  : 0;
+  cell.thumb.src_height  = known ? probe->height : 0;
+
+  g_array_append_val (builder->cells, cell);
+}
+
+/* Left edges of the grid's columns, or tops of its rows, stepped the way the sheets always
+ * were, in whole pixels after each gap */
+static gint *
+layout_steps (gdouble gap,
+              gint    cell,
+              gint    count)
+{
+  gint *steps = g_new (gint, MAX (count, 1));
+  gint  i;
+
+  steps[0] = gap;
+  for (i = 1; i < count; i++)
+    steps[i] = steps[i - 1] + cell + gap;
+
+  return steps;
+}
+
+/* rows by columns of cell_width by cell_height, every image fitted into
+ * the part above its caption */
+static void
+layout_grid (LayoutBuilder    *builder,
+             const ImageProbe *probes,
+             guint             n_probes)
+{
+  const LayoutSettings *settings = builder->settings;
+  guint                 per_sheet = settings->rows * settings->columns;
+  gint                 *column_x;
+  gint                 *row_y;
+  guint                 i;
+
+  column_x = layout_steps (settings->gap_x, builder->cell_width, settings->columns);
+  row_y    = layout_steps (settings->gap_y, builder->cell_height, settings->rows);
+
+  for (i = 0; i < n_probes; i++)
+    {
+      guint k = i % per_sheet;
+      gint  width;
+      gint  height;
+      gint  thumb_width  = 0;
+      gint  thumb_height = builder->image_height;
+
+      if (k == 0)
+        layout_begin_sheet (builder);
+
+      if (layout_turned_size (settings, &probes[i], &width, &height))
+        thumbnail_fit (width, height, builder->cell_width, builder->image_height,
+                       &thumb_width, &thumb_height);
+
+      layout_add_cell (builder, &probes[i],
+                       column_x[k % settings->columns], row_y[k / settings->columns],
+                       builder->cell_width, builder->cell_height,
+                       thumb_width, thumb_height);
+    }
+
+  g_free (row_y);
+  g_free (column_x);
+}
+
+/* Rows as tall as the grid's images, give or take: images are added to a
+ * row until it would be wider than the sheet, then the row is scaled
+ * down to fill it exactly. The last row keeps the height and is left
+ * short. */
+static void
+layout_justified (LayoutBuilder    *builder,
+                  const ImageProbe *probes,
+                  guint             n_probes)
+{
+  const LayoutSettings *settings  = builder->settings;
+  gint                  avail     = builder->right - builder->left;
+  gint                  max_image = MAX (builder->bottom - builder->top - settings->caption_height, 1);
+  gdouble              *aspects   = g_new (gdouble, MAX (n_probes, 1));
+  gboolean              open      = FALSE;
+  gint                  y         = builder->top;
+  guint                 start;
+  guint                 i;
+
+  for (i = 0; i < n_probes; i++)
+    aspects[i] = layout_aspect (builder, &probes[i]);
+
+  start = 0;
+  while (start < n_probes)
+    {
+      gdouble  sum  = 0.0;
+      gdouble  gaps = 0.0;
+      gboolean full = FALSE;
+      gdouble  height;
+      gint     row_height;
+      gint     x;
+      guint    end = start;
+
+      while (end < n_probes && ! full)
+        {
+          sum += aspects[end++];
+          gaps = settings->gap_x * (end - start - 1);
+          full = (builder->image_height * sum + gaps >= avail);
+        }
+
+      height = full ? (avail - gaps) / sum : builder->image_height;
+      height = CLAMP (height, 1.0, max_image);
+      row_height = MAX ((gint) (height + 0.5), 1);
+
+      if (! open || y + row_height + settings->caption_height > builder->bottom)
+        {
+          layout_begin_sheet (builder);
+          y = builder->top;
+          open = TRUE;
+        }
+
+      x = builder->left;
+      for (i = start; i < end; i++)
+        {
+          gint width = MAX ((gint) (height * aspects[i] + 0.5), 1);
+
+          // Rounding is made up on the last image, so full rows end flush
+          if (full && i == end - 1 && height < max_image)
+            width = MAX (builder->right - x, 1);
+
+          layout_add_cell (builder, &probes[i], x, y,
+                           width, row_height + settings->caption_height,
+                           width, row_height);
+          x = x + width + settings->gap_x;
+        }
+
+      y = y + row_height + settings->caption_height + settings->gap_y;
+      start = end;
+    }
+
+  g_free (aspects);
+}
+
+/* columns as wide as the grid's, every image its full width and as tall
+ * as its aspect makes it, each going under the shortest column */
+static void
+layout_masonry (LayoutBuilder    *builder,
+                const ImageProbe *probes,
+                guint             n_probes)
+{
+  const LayoutSettings *settings  = builder->settings;
+  gint                  max_image = MAX (builder->bottom - builder->top - settings->caption_height, 1);
+  gint                 *column_x;
+  gint                 *column_y;
+  gboolean              open = FALSE;
+  guint                 i;
+  gint                  c;
+
+  column_x = layout_steps (settings->gap_x, builder->cell_width, settings->columns);
+  column_y = g_new0 (gint, settings->columns);
+
+  for (i = 0; i < n_probes; i++)
+    {
+      gdouble aspect = layout_aspect (builder, &probes[i]);
+      gint    width  = builder->cell_width;
+      gint    height = MAX ((gint) (width / aspect + 0.5), 1);
+      gint    shortest = 0;
+
+      if (height > max_image)
+        {
+          height = max_image;
+          width  = MAX ((gint) (height * aspect + 0.5), 1);
+        }
+
+      for (c = 1; c < settings->columns; c++)
+        if (column_y[c] < column_y[shortest])
+          shortest = c;
+
+      if (! open || column_y[shortest] + height + settings->caption_height > builder->bottom)
+        {
+          layout_begin_sheet (builder);
+          for (c = 0; c < settings->columns; c++)
+            column_y[c] = builder->top;
+          shortest = 0;
+          open = TRUE;
+        }
+
+      layout_add_cell (builder, &probes[i],
+                       column_x[shortest], column_y[shortest],
+                       builder->cell_width, height + settings->caption_height,
+                       width, height);
+
+      column_y[shortest] = column_y[shortest] + height + settings->caption_height +
+                           settings->gap_y;
+    }
+
+  g_free (column_y);
+  g_free (column_x);
+}
+
+/* Lays out one cell per probe, in order, over as many sheets as they
+ * need */
+LayoutPlan *
+layout_plan_new (const LayoutSettings *settings,
+                 const ImageProbe     *probes,
+                 guint                 n_probes)
+{
+  LayoutBuilder builder;
+  LayoutPlan   *plan = g_new0 (LayoutPlan, 1);
+  guint         i;
+
+  builder.settings     = settings;
+  builder.cells        = g_array_sized_new (FALSE, FALSE, sizeof (LayoutCell), n_probes);
+  builder.sheet_first  = g_array_new (FALSE, FALSE, sizeof (guint));
+  builder.cell_width   = (settings->width  - (settings->gap_x * (settings->columns + 1))) / settings->columns;
+  builder.cell_height  = (settings->height - (settings->gap_y * (settings->rows + 1))) / settings->rows;
+  builder.image_height = MAX (builder.cell_height - settings->caption_height, 1);
+  builder.left         = settings->gap_x;
+  builder.right        = settings->width - settings->gap_x;
+  builder.top          = settings->gap_y;
+  builder.bottom       = settings->height - settings->gap_y;
+
+  switch (settings->kind)
+    {
+    case LAYOUT_JUSTIFIED:
+      layout_justified (&builder, probes, n_probes);
+      break;
+
+    case LAYOUT_MASONRY:
+      layout_masonry (&builder, probes, n_probes);
+      break;
+
+    default:
+      layout_grid (&builder, probes, n_probes);
+      break;
+    }
+
+  plan->n_sheets = builder.sheet_first->len;
+  g_array_append_val (builder.sheet_first, builder.cells->len);
+
+  plan->n_cells     = builder.cells->len;
+  plan->cells       = (LayoutCell *) g_array_free (builder.cells, FALSE);
+  plan->sheet_first = (guint *) g_array_free (builder.sheet_first, FALSE);
+
+  for (i = 0; i < plan->n_cells; i++)
+    plan->max_cell_height = MAX (plan->max_cell_height, plan->cells[i].height);
+
+  return plan;
+}
+
+/* Keeps only sheets first_sheet up to last_sheet, for a shard */
+void
+layout_plan_crop (LayoutPlan *plan,
+                  guint       first_sheet,
+                  guint       last_sheet)
+{
+  guint first;
+  guint i;
+
+  last_sheet  = MIN (last_sheet, plan->n_sheets);
+  first_sheet = MIN (first_sheet, last_sheet);
+  first       = plan->sheet_first[first_sheet];
+
+  plan->n_cells  = plan->sheet_first[last_sheet] - first;
+  plan->n_sheets = last_sheet - first_sheet;
+
+  memmove (plan->cells, plan->cells + first, plan->n_cells * sizeof (LayoutCell));
+
+  for (i = 0; i <= plan->n_sheets; i++)
+    plan->sheet_first[i] = plan->sheet_first[first_sheet + i] - first;
+}
+
+void
+layout_plan_free (LayoutPlan *plan)
+{
+  g_free (plan->sheet_first);
+  g_free (plan->cells);
+  g_free (plan);
+}
@@ -0,0 +1,85 @@
+/* GIMP - The GNU Image Manipulation Program
+ * Copyright (C) 2023 Samuel Oldham
+ * Contact sheet plug-in (C) 2023 Samuel Oldham
+ * e-mail: so9010sami@gmail.com
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#ifndef __CONTACTSHEET_LAYOUT_H__
+#define __CONTACTSHEET_LAYOUT_H__
+
+#include <glib.h>
+
+#include "image-probe.h"
+#include "thumbnail.h"
+
+/* How cells are placed on the sheets */
+typedef enum
+{
+  LAYOUT_GRID,                    /* rows by columns of equal cells */
+  LAYOUT_JUSTIFIED,               /* rows of equal height filling the sheet's width */
+  LAYOUT_MASONRY                  /* columns of equal width, each image as tall as its aspect */
+} LayoutKind;
+
+/* The sheet, in pixels, and what the dialog asked for. rows and columns
+ * give the grid's cell, which the other layouts take as their row height
+ * and column width. */
+typedef struct
+{
+  LayoutKind kind;
+  gdouble    width;
+  gdouble    height;
+  gdouble    gap_x;               /* Between columns and at the sides */
+  gdouble    gap_y;               /* Between rows and at the top and bottom */
+  gint       rows;
+  gint       columns;
+  gint       caption_height;      /* Under every image, 0 without captions */
+  gboolean   rotate;              /* Portrait images are turned to landscape */
+} LayoutSettings;
+
+/* One image's place on its sheet: the thumbnail is centred along the top
+ * of x, y, width, height and the caption goes under it */
+typedef struct
+{
+  gint        x;
+  gint        y;
+  gint        width;
+  gint        height;
+  ThumbTarget thumb;
+} LayoutCell;
+
+/* Every cell of a run, worked out before anything is decoded. The cells
+ * of sheet s are sheet_first[s] up to sheet_first[s + 1], in the order
+ * they are composed, which never goes up the sheet. */
+typedef struct
+{
+  LayoutCell *cells;
+  guint       n_cells;
+  guint      *sheet_first;
+  guint       n_sheets;
+  gint        max_cell_height;
+} LayoutPlan;
+
+LayoutPlan *layout_plan_new  (const LayoutSettings *settings,
+                              const ImageProbe     *probes,
+                              guint                 n_probes);
+
+void        layout_plan_crop (LayoutPlan           *plan,
+                              guint                 first_sheet,
+                              guint                 last_sheet);
+
+void        layout_plan_free (LayoutPlan           *plan);
+
+#endif /* __CONTACTSHEET_LAYOUT_H__ */
@@ -0,0 +1,394 @@
+/* GIMP - The GNU Image Manipulation Program
+ * Copyright (C) 2023 Samuel Oldham
+ * Contact sheet plug-in (C) 2023 Samuel Oldham
+ * e-mail: so9010sami@gmail.com
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Per-run manifest, for rebuilding only the sheets that changed.
+ */
+
+#include <stdio.h>
+#include <string.h>
+
+#include <glib/gstdio.h>
+
+#include "manifest.h"
+
+#define MANIFEST_GROUP    "Manifest"
+/* Raised whenever the same settings start giving different sheets, so
+ * sheets from older runs are composed again. 2: colour managed. */
+#define MANIFEST_VERSION  2
+
+struct _Manifest
+{
+  gchar    *path;
+  gchar    *root;                 /* Image folder, ending in a separator */
+  gchar    *settings;             /* Digest of everything that changes the look */
+  GKeyFile *previous;             /* What the last run wrote, NULL if nothing */
+  GKeyFile *current;
+};
+
+/* Opens the manifest at path, reading the one the last run left when it
+ * was made with the same settings. root is the image folder, file names
+ * are recorded relative to it. */
+Manifest *
+manifest_open (const gchar *path,
+               const gchar *root,
+               const gchar *settings)
+{
+  Manifest *manifest = g_new0 (Manifest, 1);
+  gchar    *absolute;
+  gchar    *previous_settings;
+
+  absolute = g_canonicalize_filename (root, NULL);
+
+  manifest->path     = g_strdup (path);
+  manifest->root     = g_strconcat (absolute, G_DIR_SEPARATOR_S, NULL);
+  manifest->settings = g_strdup (settings);
+  manifest->previous = g_key_file_new ();
+  manifest->current  = g_key_file_new ();
+
+  g_free (absolute);
+
+  if (! g_key_file_load_from_file (manifest->previous, path, G_KEY_FILE_NONE, NULL) ||
+      g_key_file_get_integer (manifest->previous, MANIFEST_GROUP, "Version", NULL) != MANIFEST_VERSION)
+    {
+      g_clear_pointer (&manifest->previous, g_key_file_free);
+    }
+
+  g_key_file_set_integer (manifest->current, MANIFEST_GROUP, "Version", MANIFEST_VERSION);
+  g_key_file_set_string (manifest->current, MANIFEST_GROUP, "Settings", settings);
+
+  /* Sheets laid out differently cannot be reused, but their files are
+   * still known so the ones past the new end can be removed */
+  if (manifest->previous != NULL)
+    {
+      previous_settings = g_key_file_get_string (manifest->previous, MANIFEST_GROUP,
+                                                 "Settings", NULL);
+      if (g_strcmp0 (previous_settings, settings) != 0)
+        g_key_file_remove_group (manifest->previous, MANIFEST_GROUP, NULL);
+      g_free (previous_settings);
+    }
+
+  return manifest;
+}
+
+static gchar *
+manifest_group (guint number)
+{
+  return g_strdup_printf ("Sheet %u", number);
+}
+
+/* Records sheet number as made of count files from first, written to
+ * each of the NULL-terminated outputs. Returns TRUE when the last run
+ * wrote the very same sheet to all of them and they are still on disk,
+ * so it does not need composing again. */
+gboolean
+manifest_add_sheet (Manifest            *manifest,
+                    guint                number,
+                    const gchar * const *outputs,
+                    GPtrArray           *files,
+                    guint                first,
+                    guint                count)
+{
+  GChecksum *checksum;
+  gchar    **names  = g_new0 (gchar *, count + 1);
+  gchar    **mtimes = g_new0 (gchar *, count + 1);
+  gchar    **sizes  = g_new0 (gchar *, count + 1);
+  gchar     *group;
+  gchar     *digest;
+  gchar     *previous = NULL;
+  gboolean   unchanged;
+  guint      i;
+
+  checksum = g_checksum_new (G_CHECKSUM_MD5);
+  g_checksum_update (checksum, (const guchar *) manifest->settings, -1);
+  for (i = 0; outputs[i] != NULL; i++)
+    g_checksum_update (checksum, (const guchar *) outputs[i], strlen (outputs[i]) + 1);
+
+  for (i = 0; i < count; i++)
+    {
+      gchar    *file = g_canonicalize_filename (g_ptr_array_index (files, first + i), NULL);
+      GStatBuf  st;
+      gint64    mtime = -1;
+      gint64    size  = -1;
+
+      if (g_stat (file, &st) == 0)
+        {
+          mtime = st.st_mtime;
+          size  = st.st_size;
+        }
+
+      names[i]  = g_strdup (g_str_has_prefix (file, manifest->root) ?
+                            file + strlen (manifest->root) : file);
+      mtimes[i] = g_strdup_printf ("%" G_GINT64_FORMAT, mtime);
+      sizes[i]  = g_strdup_printf ("%" G_GINT64_FORMAT, size);
+
+      g_checksum_update (checksum, (const guchar *) names[i], strlen (names[i]) + 1);
+      g_checksum_update (checksum, (const guchar *) &mtime, sizeof (mtime));
+      g_checksum_update (checksum, (const guchar *) &size, sizeof (size));
+
+      g_free (file);
+    }
+
+  digest = g_strdup (g_checksum_get_string (checksum));
+  g_checksum_free (checksum);
+
+  group = manifest_group (number);
+
+  g_key_file_set_string_list (manifest->current, group, "Output",
+                              outputs, g_strv_length ((gchar **) outputs));
+  g_key_file_set_string (manifest->current, group, "Digest", digest);
+  g_key_file_set_string_list (manifest->current, group, "Files",
+                              (const gchar * const *) names, count);
+  g_key_file_set_string_list (manifest->current, group, "MTimes",
+                              (const gchar * const *) mtimes, count);
+  g_key_file_set_string_list (manifest->current, group, "Sizes",
+                              (const gchar * const *) sizes, count);
+
+  if (manifest->previous != NULL &&
+      g_key_file_has_group (manifest->previous, MANIFEST_GROUP))
+    previous = g_key_file_get_string (manifest->previous, group, "Digest", NULL);
+
+  unchanged = g_strcmp0 (previous, digest) == 0;
+  for (i = 0; unchanged && outputs[i] != NULL; i++)
+    unchanged = g_file_test (outputs[i], G_FILE_TEST_IS_REGULAR);
+
+  g_free (previous);
+  g_free (group);
+  g_free (digest);
+  g_strfreev (sizes);
+  g_strfreev (mtimes);
+  g_strfreev (names);
+
+  return unchanged;
+}
+
+/* Records that the whole job makes n_sheets, for a run that only makes
+ * some of them, so manifest_merge () can tell when every one is there */
+void
+manifest_set_total (Manifest *manifest,
+                    guint     n_sheets)
+{
+  g_key_file_set_integer (manifest->current, MANIFEST_GROUP, "Total", n_sheets);
+}
+
+/* Deletes the sheets the last run wrote past the n_sheets this one made */
+void
+manifest_remove_stale (Manifest *manifest,
+                       guint     n_sheets)
+{
+  guint number;
+
+  if (manifest->previous == NULL)
+    return;
+
+  for (number = n_sheets; ; number++)
+    {
+      gchar  *group = manifest_group (number);
+      gchar **outputs;
+      guint   i;
+
+      outputs = g_key_file_get_string_list (manifest->previous, group, "Output", NULL, NULL);
+      g_free (group);
+
+      if (outputs == NULL)
+        break;
+
+      for (i = 0; outputs[i] != NULL; i++)
+        g_unlink (outputs[i]);
+      g_strfreev (outputs);
+    }
+}
+
+gboolean
+manifest_save (Manifest *manifest)
+{
+  GError   *error = NULL;
+  gboolean  saved;
+
+  saved = g_key_file_save_to_file (manifest->current, manifest->path, &error);
+  if (! saved)
+    {
+      g_printerr ("contactsheet: could not write %s: %s\n",
+                  manifest->path, error->message);
+      g_clear_error (&error);
+    }
+
+  return saved;
+}
+
+void
+manifest_free (Manifest *manifest)
+{
+  g_clear_pointer (&manifest->previous, g_key_file_free);
+  g_key_file_free (manifest->current);
+  g_free (manifest->settings);
+  g_free (manifest->root);
+  g_free (manifest->path);
+  g_free (manifest);
+}
+
+/* Copies the sheets recorded in the manifest at shard_path into merged,
+ * marking each in seen. Returns the job's total, or -1 when the shard is
+ * missing, made with other settings or of another job than the others,
+ * or records a sheet twice. */
+static gint
+manifest_merge_shard (Manifest    *merged,
+                      const gchar *shard_path,
+                      gboolean   **seen,
+                      gint         total)
+{
+  GKeyFile  *shard = g_key_file_new ();
+  gchar     *settings;
+  gchar    **groups;
+  gint       shard_total;
+  guint      number;
+  guint      i;
+  guint      j;
+
+  if (! g_key_file_load_from_file (shard, shard_path, G_KEY_FILE_NONE, NULL) ||
+      g_key_file_get_integer (shard, MANIFEST_GROUP, "Version", NULL) != MANIFEST_VERSION)
+    {
+      g_printerr ("contactsheet: %s is missing, its shard has not finished\n", shard_path);
+      g_key_file_free (shard);
+      return -1;
+    }
+
+  settings    = g_key_file_get_string (shard, MANIFEST_GROUP, "Settings", NULL);
+  shard_total = g_key_file_get_integer (shard, MANIFEST_GROUP, "Total", NULL);
+
+  /* The first shard sets what the others have to agree with */
+  if (merged->settings == NULL)
+    {
+      merged->settings = g_strdup (settings);
+      g_key_file_set_string (merged->current, MANIFEST_GROUP, "Settings", settings);
+      *seen = g_new0 (gboolean, MAX (shard_total, 1));
+      total = shard_total;
+    }
+
+  if (g_strcmp0 (settings, merged->settings) != 0 || shard_total != total)
+    {
+      g_printerr ("contactsheet: %s is from a run with other settings or files\n", shard_path);
+      total = -1;
+    }
+  g_free (settings);
+
+  groups = g_key_file_get_groups (shard, NULL);
+  for (i = 0; total >= 0 && groups[i] != NULL; i++)
+    {
+      gchar **keys;
+
+      if (sscanf (groups[i], "Sheet %u", &number) != 1)
+        continue;
+
+      if (number >= (guint) total || (*seen)[number])
+        {
+          g_printerr ("contactsheet: %s records sheet %u, which is not its to make\n",
+                      shard_path, number);
+          total = -1;
+          break;
+        }
+      (*seen)[number] = TRUE;
+
+      keys = g_key_file_get_keys (shard, groups[i], NULL, NULL);
+      for (j = 0; keys[j] != NULL; j++)
+        {
+          gchar *value = g_key_file_get_value (shard, groups[i], keys[j], NULL);
+
+          g_key_file_set_value (merged->current, groups[i], keys[j], value);
+          g_free (value);
+        }
+      g_strfreev (keys);
+    }
+
+  g_strfreev (groups);
+  g_key_file_free (shard);
+
+  return total;
+}
+
+/* Combines the manifests left by the shards of one job, in
+ * shard_paths, into a single one at path as if one run had made every
+ * sheet, and deletes sheets an earlier, longer run left past the end.
+ * Returns the number of sheets, or -1 when a shard is missing, they
+ * disagree, or a sheet is not recorded or not on disk. */
+gint
+manifest_merge (const gchar         *path,
+                const gchar * const *shard_paths)
+{
+  Manifest  merged = { 0, };
+  gboolean *seen = NULL;
+  gint      total = 0;
+  guint     number;
+  guint     i;
+
+  merged.path     = g_strdup (path);
+  merged.previous = g_key_file_new ();
+  merged.current  = g_key_file_new ();
+
+  if (! g_key_file_load_from_file (merged.previous, path, G_KEY_FILE_NONE, NULL))
+    g_clear_pointer (&merged.previous, g_key_file_free);
+
+  g_key_file_set_integer (merged.current, MANIFEST_GROUP, "Version", MANIFEST_VERSION);
+
+  for (i = 0; shard_paths[i] != NULL && total >= 0; i++)
+    total = manifest_merge_shard (&merged, shard_paths[i], &seen, total);
+
+  for (number = 0; total > 0 && number < (guint) total; number++)
+    {
+      gchar  *group = manifest_group (number);
+      gchar **outputs;
+      guint   j;
+
+      outputs = g_key_file_get_string_list (merged.current, group, "Output", NULL, NULL);
+      g_free (group);
+
+      if (! seen[number] || outputs == NULL)
+        {
+          g_printerr ("contactsheet: no shard made sheet %u\n", number);
+          total = -1;
+        }
+
+      for (j = 0; total >= 0 && outputs[j] != NULL; j++)
+        {
+          if (! g_file_test (outputs[j], G_FILE_TEST_IS_REGULAR))
+            {
+              g_printerr ("contactsheet: sheet %u was not written to %s\n",
+                          number, outputs[j]);
+              total = -1;
+            }
+        }
+
+      g_strfreev (outputs);
+    }
+
+  if (total >= 0)
+    {
+      manifest_remove_stale (&merged, total);
+      if (! manifest_save (&merged))
+        total = -1;
+    }
+
+  g_clear_pointer (&merged.previous, g_key_file_free);
+  g_key_file_free (merged.current);
+  g_free (merged.settings);
+  g_free (merged.path);
+  g_free (seen);
+
+  return total;
+}
@@ -0,0 +1,55 @@
+/* GIMP - The GNU Image Manipulation Program
+ * Copyright (C) 2023 Samuel Oldham
+ * Contact sheet plug-in (C) 2023 Samuel Oldham
+ * e-mail: so9010sami@gmail.com
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#ifndef __CONTACTSHEET_MANIFEST_H__
+#define __CONTACTSHEET_MANIFEST_H__
+
+#include <glib.h>
+
+/* Records what went into each numbered sheet of a run, the files with
+ * their modification times and sizes, and a digest of the settings, so a
+ * rerun can tell which sheets written last time are still right. It is a
+ * key file kept next to the sheets. */
+typedef struct _Manifest Manifest;
+
+Manifest *manifest_open         (const gchar *path,
+                                 const gchar *root,
+                                 const gchar *settings);
+
+gboolean  manifest_add_sheet    (Manifest            *manifest,
+                                 guint                number,
+                                 const gchar * const *outputs,
+                                 GPtrArray           *files,
+                                 guint                first,
+                                 guint                count);
+
+void      manifest_set_total    (Manifest    *manifest,
+                                 guint        n_sheets);
+
+void      manifest_remove_stale (Manifest    *manifest,
+                                 guint        n_sheets);
+
+gboolean  manifest_save         (Manifest    *manifest);
+
+void      manifest_free         (Manifest    *manifest);
+
+gint      manifest_merge        (const gchar         *path,
+                                 const gchar * const *shard_paths);
+
+#endif /* __CONTACTSHEET_MANIFEST_H__ */
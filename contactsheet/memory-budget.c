@@ -0,0 +1,75 @@
+/* GIMP - The GNU Image Manipulation Program
+ * Copyright (C) 2023 Samuel Oldham
+ * Contact sheet plug-in (C) 2023 Samuel Oldham
+ * e-mail: so9010sami@gmail.com
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Sharing a memory ceiling out between the stages of a run.
+ */
+
+#include "memory-budget.h"
+#include "sheet-writer.h"
+
+/* Left for everything the budget does not steer: code, fonts, gexiv2 and
+ * the tiles of whatever GIMP hands over */
+#define MEMORY_BUDGET_BASE  (64 << 20)
+
+/* Splits limit bytes, 0 for no limit. Sheets are sheet_bytes each, one
+ * being composed plus those the writer holds, and the writer also holds
+ * one lower-resolution copy of up to tier_bytes while it saves a sheet.
+ * The writer gets as deep as it can while the decode queue keeps at
+ * least a quarter. Returns FALSE
+ * when even a single sheet does not fit, the run then goes ahead with
+ * the smallest settings and may go over. */
+gboolean
+memory_budget_split (gsize         limit,
+                     gsize         sheet_bytes,
+                     gsize         tier_bytes,
+                     MemoryBudget *budget)
+{
+  gsize avail;
+  gint  depth;
+
+  budget->writer_depth = SHEET_WRITER_DEPTH;
+  budget->queue_budget = 0;
+  budget->tile_cache   = 0;
+
+  if (limit == 0)
+    return TRUE;
+
+  avail = limit > MEMORY_BUDGET_BASE ? limit - MEMORY_BUDGET_BASE : 0;
+
+  budget->tile_cache = avail / 8;
+  avail -= budget->tile_cache;
+
+  for (depth = SHEET_WRITER_DEPTH; depth >= 0; depth--)
+    {
+      gsize sheets = (depth + 1) * sheet_bytes + tier_bytes;
+
+      if (sheets <= avail / 4 * 3)
+        {
+          budget->writer_depth = depth;
+          budget->queue_budget = MAX (avail - sheets, 1);
+          return TRUE;
+        }
+    }
+
+  budget->writer_depth = 0;
+  budget->queue_budget = MAX (avail / 4, 1);
+
+  return FALSE;
+}
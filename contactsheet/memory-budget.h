@@ -0,0 +1,39 @@
+/* GIMP - The GNU Image Manipulation Program
+ * Copyright (C) 2023 Samuel Oldham
+ * Contact sheet plug-in (C) 2023 Samuel Oldham
+ * e-mail: so9010sami@gmail.com
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#ifndef __CONTACTSHEET_MEMORY_BUDGET_H__
+#define __CONTACTSHEET_MEMORY_BUDGET_H__
+
+#include <glib.h>
+
+/* How a run's memory ceiling is shared out between the sheets in flight,
+ * the decode queue and GEGL's tile cache */
+typedef struct
+{
+  guint    writer_depth;          /* Finished sheets the writer may hold */
+  gsize    queue_budget;          /* For thumb_queue_new (), 0 for no limit */
+  gsize    tile_cache;            /* GEGL tile cache size, 0 to leave it be */
+} MemoryBudget;
+
+gboolean memory_budget_split (gsize         limit,
+                              gsize         sheet_bytes,
+                              gsize         tier_bytes,
+                              MemoryBudget *budget);
+
+#endif /* __CONTACTSHEET_MEMORY_BUDGET_H__ */
@@ -0,0 +1,365 @@
+/* GIMP - The GNU Image Manipulation Program
+ * Copyright (C) 2023 Samuel Oldham
+ * Contact sheet plug-in (C) 2023 Samuel Oldham
+ * e-mail: so9010sami@gmail.com
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+/*
+ * EXIF reading for the captions, plus a small per-directory index kept in
+ * the user cache so later runs over an unchanged folder do not have to
+ * open and parse every file again.
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+
+#include <glib/gstdio.h>
+#include <gexiv2/gexiv2.h>
+
+#include "metadata.h"
+
+#define METADATA_INDEX_MAGIC    "CSEXIF01"
+
+typedef struct
+{
+  gint64   mtime;
+  gint64   size;
+  ExifInfo info;
+  gboolean seen;                  /* Asked for during this run */
+} MetadataEntry;
+
+struct _MetadataIndex
+{
+  GMutex      mutex;
+  gchar      *path;               /* Index file in the cache */
+  gchar      *root;               /* The directory, ending in a separator */
+  GHashTable *entries;            /* Path relative to root -> MetadataEntry */
+  gboolean    dirty;
+};
+
+/* Reads the caption values of file. Anything missing comes back the way
+ * gexiv2 reports it (-1 or 0), which metadata_format_caption treats as
+ * not there.
+ * Safe to call from any thread once gexiv2_initialize has run. */
+void
+metadata_read (const gchar *file,
+               ExifInfo    *info)
+{
+  GExiv2Metadata *metadata;
+
+  memset (info, 0, sizeof (ExifInfo));
+  info->f_number     = -1.0;
+  info->focal_length = -1.0;
+
+  metadata = gexiv2_metadata_new ();
+
+  if (gexiv2_metadata_open_path (metadata, file, NULL))
+    {
+      info->f_number     = gexiv2_metadata_try_get_fnumber (metadata, NULL);
+      info->focal_length = gexiv2_metadata_try_get_focal_length (metadata, NULL);
+      info->iso_speed    = gexiv2_metadata_try_get_iso_speed (metadata, NULL);
+
+      gexiv2_metadata_try_get_exposure_time (metadata,
+                                             &info->exposure_nom,
+                                             &info->exposure_den,
+                                             NULL);
+    }
+
+  g_object_unref (metadata);
+}
+
+/* Builds the caption text out of the file name and the EXIF values in
+ * fields, leaving out any the file does not have */
+void
+metadata_format_caption (const ExifInfo *exif,
+                         const gchar    *name,
+                         CaptionFields   fields,
+                         gchar          *captionBuffer,
+                         gsize           size)
+{
+  size_t captionLength;
+
+  captionBuffer[0] = '\0';
+  if (fields & CAPTION_FILE_NAME) {
+    snprintf(captionBuffer, size, "%s - ", name);
+  }
+  if (exif->f_number >= 0 && (fields & CAPTION_APERTURE)) {
+      snprintf(captionBuffer + strlen(captionBuffer), size - strlen(captionBuffer),
+                "f/%.2g, ", exif->f_number);
+  }
+  if (exif->focal_length > 1 && (fields & CAPTION_FOCAL_LENGTH)) {
+      snprintf(captionBuffer + strlen(captionBuffer), size - strlen(captionBuffer),
+                "%.2gmm, ", exif->focal_length);
+  }
+  if (exif->iso_speed > 1 && (fields & CAPTION_ISO)) {
+      snprintf(captionBuffer + strlen(captionBuffer), size - strlen(captionBuffer),
+                "%d, ", exif->iso_speed);
+  }
+  if (exif->exposure_nom > 0 && exif->exposure_den > 0 && (fields & CAPTION_EXPOSURE)) {
+      snprintf(captionBuffer + strlen(captionBuffer), size - strlen(captionBuffer),
+                "%d/%ds, ", exif->exposure_nom, exif->exposure_den);
+  }
+
+  // Remove the trailing comma and space
+  captionLength = strlen(captionBuffer);
+  if (captionLength >= 2) {
+      captionBuffer[captionLength - 2] = '\0';
+  }
+}
+
+// Pulls size bytes off the front of the index data, FALSE when it runs out
+static gboolean
+metadata_index_take (const gchar **data,
+                     const gchar  *end,
+                     gpointer      dest,
+                     gsize         size)
+{
+  if ((gsize) (end - *data) < size)
+    return FALSE;
+
+  memcpy (dest, *data, size);
+  *data += size;
+
+  return TRUE;
+}
+
+static void
+metadata_index_load (MetadataIndex *index)
+{
+  gchar       *contents;
+  gsize        length;
+  const gchar *data;
+  const gchar *end;
+
+  if (! g_file_get_contents (index->path, &contents, &length, NULL))
+    return;
+
+  data = contents;
+  end  = contents + length;
+
+  if (length >= strlen (METADATA_INDEX_MAGIC) &&
+      memcmp (data, METADATA_INDEX_MAGIC, strlen (METADATA_INDEX_MAGIC)) == 0)
+    {
+      data += strlen (METADATA_INDEX_MAGIC);
+
+      while (data < end)
+        {
+          MetadataEntry *entry;
+          guint16        name_length;
+          gchar         *name;
+          gint32         values[3];
+
+          if (! metadata_index_take (&data, end, &name_length, sizeof (name_length)) ||
+              (gsize) (end - data) < name_length)
+            break;
+
+          name = g_strndup (data, name_length);
+          data += name_length;
+
+          entry = g_new0 (MetadataEntry, 1);
+
+          if (! metadata_index_take (&data, end, &entry->mtime, sizeof (entry->mtime)) ||
+              ! metadata_index_take (&data, end, &entry->size, sizeof (entry->size)) ||
+              ! metadata_index_take (&data, end, &entry->info.f_number, sizeof (gdouble)) ||
+              ! metadata_index_take (&data, end, &entry->info.focal_length, sizeof (gdouble)) ||
+              ! metadata_index_take (&data, end, values, sizeof (values)))
+            {
+              g_free (entry);
+              g_free (name);
+              break;
+            }
+
+          entry->info.iso_speed    = values[0];
+          entry->info.exposure_nom = values[1];
+          entry->info.exposure_den = values[2];
+
+          g_hash_table_replace (index->entries, name, entry);
+        }
+    }
+
+  g_free (contents);
+}
+
+/* Opens the index of dir, it lives under ~/.cache/contactsheet so nothing
+ * is written next to the images */
+MetadataIndex *
+metadata_index_open (const gchar *dir)
+{
+  MetadataIndex *index;
+  gchar         *absolute;
+  gchar         *md5;
+  gchar         *name;
+
+  index = g_new0 (MetadataIndex, 1);
+  g_mutex_init (&index->mutex);
+
+  absolute = g_canonicalize_filename (dir, NULL);
+  md5  = g_compute_checksum_for_string (G_CHECKSUM_MD5, absolute, -1);
+  name = g_strconcat (md5, ".exif", NULL);
+
+  index->path    = g_build_filename (g_get_user_cache_dir (), "contactsheet",
+                                     "metadata", name, NULL);
+  index->root    = g_strconcat (absolute, G_DIR_SEPARATOR_S, NULL);
+  index->entries = g_hash_table_new_full (g_str_hash, g_str_equal,
+                                          g_free, g_free);
+
+  g_free (name);
+  g_free (md5);
+  g_free (absolute);
+
+  metadata_index_load (index);
+
+  return index;
+}
+
+/* Fills info for file, from the index when the file has not changed since
+ * it was read, otherwise by reading it. Safe to call from the workers. */
+void
+metadata_index_get (MetadataIndex *index,
+                    const gchar   *file,
+                    ExifInfo      *info)
+{
+  MetadataEntry *entry;
+  GStatBuf       st;
+  gchar         *absolute;
+  gchar         *name;
+
+  if (g_stat (file, &st) != 0)
+    {
+      metadata_read (file, info);
+      return;
+    }
+
+  /* Files in subfolders are kept under their relative path, which for the
+   * directory's own files is the base name older indexes used */
+  absolute = g_canonicalize_filename (file, NULL);
+  if (g_str_has_prefix (absolute, index->root))
+    name = g_strdup (absolute + strlen (index->root));
+  else
+    name = g_path_get_basename (absolute);
+  g_free (absolute);
+
+  g_mutex_lock (&index->mutex);
+  entry = g_hash_table_lookup (index->entries, name);
+
+  if (entry != NULL &&
+      entry->mtime == (gint64) st.st_mtime &&
+      entry->size == (gint64) st.st_size)
+    {
+      *info = entry->info;
+      entry->seen = TRUE;
+
+      g_mutex_unlock (&index->mutex);
+      g_free (name);
+      return;
+    }
+  g_mutex_unlock (&index->mutex);
+
+  /* Parse outside the lock so the other workers are not held up */
+  metadata_read (file, info);
+
+  entry = g_new0 (MetadataEntry, 1);
+  entry->mtime = st.st_mtime;
+  entry->size  = st.st_size;
+  entry->info  = *info;
+  entry->seen  = TRUE;
+
+  g_mutex_lock (&index->mutex);
+  g_hash_table_replace (index->entries, name, entry);
+  index->dirty = TRUE;
+  g_mutex_unlock (&index->mutex);
+}
+
+/* Writes the index back if anything changed. With prune only files asked
+ * for during this run are kept, so deleted files drop out; a run that
+ * only covers part of the folder keeps the others. */
+void
+metadata_index_save (MetadataIndex *index,
+                     gboolean       prune)
+{
+  GHashTableIter  iter;
+  gpointer        key;
+  gpointer        value;
+  GString        *data;
+  gchar          *dir;
+
+  g_mutex_lock (&index->mutex);
+
+  g_hash_table_iter_init (&iter, index->entries);
+  while (g_hash_table_iter_next (&iter, &key, &value))
+    {
+      if (prune && ! ((MetadataEntry *) value)->seen)
+        {
+          g_hash_table_iter_remove (&iter);
+          index->dirty = TRUE;
+        }
+    }
+
+  if (! index->dirty)
+    {
+      g_mutex_unlock (&index->mutex);
+      return;
+    }
+
+  data = g_string_new (METADATA_INDEX_MAGIC);
+
+  g_hash_table_iter_init (&iter, index->entries);
+  while (g_hash_table_iter_next (&iter, &key, &value))
+    {
+      MetadataEntry *entry       = value;
+      gsize          name_length = strlen (key);
+      guint16        length;
+      gint32         values[3];
+
+      if (name_length > G_MAXUINT16)
+        continue;
+
+      length    = name_length;
+      values[0] = entry->info.iso_speed;
+      values[1] = entry->info.exposure_nom;
+      values[2] = entry->info.exposure_den;
+
+      g_string_append_len (data, (const gchar *) &length, sizeof (length));
+      g_string_append_len (data, key, length);
+      g_string_append_len (data, (const gchar *) &entry->mtime, sizeof (entry->mtime));
+      g_string_append_len (data, (const gchar *) &entry->size, sizeof (entry->size));
+      g_string_append_len (data, (const gchar *) &entry->info.f_number, sizeof (gdouble));
+      g_string_append_len (data, (const gchar *) &entry->info.focal_length, sizeof (gdouble));
+      g_string_append_len (data, (const gchar *) values, sizeof (values));
+    }
+
+  index->dirty = FALSE;
+  g_mutex_unlock (&index->mutex);
+
+  dir = g_path_get_dirname (index->path);
+  g_mkdir_with_parents (dir, 0700);
+  g_file_set_contents (index->path, data->str, data->len, NULL);
+
+  g_free (dir);
+  g_string_free (data, TRUE);
+}
+
+void
+metadata_index_free (MetadataIndex *index)
+{
+  g_hash_table_destroy (index->entries);
+  g_free (index->path);
+  g_free (index->root);
+  g_mutex_clear (&index->mutex);
+  g_free (index);
+}
@@ -0,0 +1,69 @@
+/* GIMP - The GNU Image Manipulation Program
+ * Copyright (C) 2023 Samuel Oldham
+ * Contact sheet plug-in (C) 2023 Samuel Oldham
+ * e-mail: so9010sami@gmail.com
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#ifndef __CONTACTSHEET_METADATA_H__
+#define __CONTACTSHEET_METADATA_H__
+
+#include <glib.h>
+
+/* The EXIF values a caption can show */
+typedef struct
+{
+  gdouble f_number;
+  gdouble focal_length;
+  gint    iso_speed;
+  gint    exposure_nom;
+  gint    exposure_den;
+} ExifInfo;
+
+/* What a caption shows */
+typedef enum
+{
+  CAPTION_FILE_NAME    = 1 << 0,
+  CAPTION_APERTURE     = 1 << 1,
+  CAPTION_FOCAL_LENGTH = 1 << 2,
+  CAPTION_ISO          = 1 << 3,
+  CAPTION_EXPOSURE     = 1 << 4
+} CaptionFields;
+
+/* Remembers the ExifInfo of every file of one directory between runs */
+typedef struct _MetadataIndex MetadataIndex;
+
+void           metadata_read         (const gchar   *file,
+                                      ExifInfo      *info);
+
+void           metadata_format_caption
+                                     (const ExifInfo *exif,
+                                      const gchar   *name,
+                                      CaptionFields  fields,
+                                      gchar         *captionBuffer,
+                                      gsize          size);
+
+MetadataIndex *metadata_index_open   (const gchar   *dir);
+
+void           metadata_index_get    (MetadataIndex *index,
+                                      const gchar   *file,
+                                      ExifInfo      *info);
+
+void           metadata_index_save   (MetadataIndex *index,
+                                      gboolean       prune);
+
+void           metadata_index_free   (MetadataIndex *index);
+
+#endif /* __CONTACTSHEET_METADATA_H__ */
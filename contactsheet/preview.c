@@ -0,0 +1,474 @@
+/* GIMP - The GNU Image Manipulation Program
+ * Copyright (C) 2023 Samuel Oldham
+ * Contact sheet plug-in (C) 2023 Samuel Oldham
+ * e-mail: so9010sami@gmail.com
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Live preview of the first sheet for the dialog.
+ */
+
+#include <gexiv2/gexiv2.h>
+
+#include "folder-scan.h"
+#include "image-probe.h"
+#include "layout.h"
+#include "preview.h"
+#include "thumbnail.h"
+
+/* Box the preview thumbnails are decoded into, a cell is rarely larger */
+#define PREVIEW_THUMB_SIZE  192
+
+/* Most cells drawn, past this they are smaller than a few pixels anyway */
+#define PREVIEW_MAX_CELLS   400
+
+/* Thumbnails decoded between redraws while a folder is first read */
+#define PREVIEW_BATCH       8
+
+typedef struct
+{
+  gchar     *name;
+  GdkPixbuf *pixbuf;              /* NULL when only GIMP can read the file */
+  ExifInfo   exif;
+} PreviewSource;
+
+typedef struct
+{
+  SheetPreview *preview;
+  GdkPixbuf    *pixbuf;
+  guint         generation;
+} PreviewResult;
+
+struct _SheetPreview
+{
+  GThread              *thread;
+  GMutex                mutex;
+  GCond                 cond;
+  SheetPreviewSettings *pending;  /* Newest settings not yet picked up */
+  guint                 generation;
+  gboolean              closing;
+  gint                  ref_count; /* The dialog's, the thread's and one per result in flight */
+
+  GtkWidget            *image;    /* NULL once the dialog is done with it */
+  gint                  width;
+  gint                  height;
+
+  /* Only touched by the thread */
+  gchar                *folder;
+  gboolean              recursive;
+  GPtrArray            *files;
+  GPtrArray            *sources;
+};
+
+static SheetPreviewSettings *
+preview_settings_copy (const SheetPreviewSettings *settings)
+{
+  SheetPreviewSettings *copy = g_new (SheetPreviewSettings, 1);
+
+  *copy = *settings;
+  copy->folder         = g_strdup (settings->folder);
+  copy->style.fontname = g_strdup (settings->style.fontname);
+
+  return copy;
+}
+
+static void
+preview_settings_free (SheetPreviewSettings *settings)
+{
+  g_free ((gchar *) settings->folder);
+  g_free ((gchar *) settings->style.fontname);
+  g_free (settings);
+}
+
+static void
+preview_source_free (PreviewSource *source)
+{
+  g_clear_object (&source->pixbuf);
+  g_free (source->name);
+  g_free (source);
+}
+
+static void
+preview_unref (SheetPreview *preview)
+{
+  if (! g_atomic_int_dec_and_test (&preview->ref_count))
+    return;
+
+  g_clear_pointer (&preview->files, g_ptr_array_unref);
+  g_clear_pointer (&preview->sources, g_ptr_array_unref);
+  g_free (preview->folder);
+
+  g_cond_clear (&preview->cond);
+  g_mutex_clear (&preview->mutex);
+  g_free (preview);
+}
+
+/* Newer settings came in, or the dialog closed, since generation was taken */
+static gboolean
+preview_is_stale (SheetPreview *preview,
+                  guint         generation)
+{
+  gboolean stale;
+
+  g_mutex_lock (&preview->mutex);
+  stale = preview->closing || preview->generation != generation;
+  g_mutex_unlock (&preview->mutex);
+
+  return stale;
+}
+
+/* Runs on the main loop, a result for settings since replaced is dropped */
+static gboolean
+preview_show (gpointer data)
+{
+  PreviewResult *result  = data;
+  SheetPreview  *preview = result->preview;
+
+  if (preview->image != NULL &&
+      ! preview_is_stale (preview, result->generation))
+    gtk_image_set_from_pixbuf (GTK_IMAGE (preview->image), result->pixbuf);
+
+  g_object_unref (result->pixbuf);
+  g_free (result);
+  preview_unref (preview);
+
+  return G_SOURCE_REMOVE;
+}
+
+/* Reads the folder again when the settings point somewhere else */
+static void
+preview_set_folder (SheetPreview               *preview,
+                    const SheetPreviewSettings *settings)
+{
+  if (preview->files != NULL &&
+      preview->recursive == settings->recursive &&
+      g_strcmp0 (preview->folder, settings->folder) == 0)
+    return;
+
+  g_clear_pointer (&preview->files, g_ptr_array_unref);
+  g_ptr_array_set_size (preview->sources, 0);
+
+  g_free (preview->folder);
+  preview->folder    = g_strdup (settings->folder);
+  preview->recursive = settings->recursive;
+
+  if (g_file_test (settings->folder, G_FILE_TEST_IS_DIR))
+    preview->files = folder_scan (settings->folder, settings->recursive, NULL);
+  else
+    preview->files = g_ptr_array_new_with_free_func (g_free);
+}
+
+static void
+preview_load_source (SheetPreview               *preview,
+                     const SheetPreviewSettings *settings)
+{
+  const gchar   *file   = g_ptr_array_index (preview->files, preview->sources->len);
+  PreviewSource *source = g_new0 (PreviewSource, 1);
+  ImageProbe     probe;
+  ThumbTarget    target = { PREVIEW_THUMB_SIZE, PREVIEW_THUMB_SIZE, 0, 0, 1, FALSE, 0, 0 };
+
+  // Decoded upright, preview_fit turns it for rotate
+  if (image_probe (file, &probe))
+    target.orientation = probe.orientation;
+
+  source->name   = g_path_get_basename (file);
+  source->pixbuf = thumbnail_load (file, &target, settings->use_cache, RESAMPLE_BOX);
+  metadata_read (file, &source->exif);
+
+  g_ptr_array_add (preview->sources, source);
+}
+
+/* The thumbnail of source as it would sit in a box_width by box_height
+ * cell, or a grey box while it is still being decoded */
+static GdkPixbuf *
+preview_fit (PreviewSource *source,
+             gboolean       rotate,
+             gint           box_width,
+             gint           box_height)
+{
+  GdkPixbuf *pixbuf;
+  GdkPixbuf *thumb;
+  gint       width;
+  gint       height;
+
+  if (box_width < 1 || box_height < 1)
+    return NULL;
+
+  if (source == NULL || source->pixbuf == NULL)
+    {
+      thumb = gdk_pixbuf_new (GDK_COLORSPACE_RGB, FALSE, 8, box_width, box_height);
+      gdk_pixbuf_fill (thumb, 0xd8d8d8ff);
+      return thumb;
+    }
+
+  width  = gdk_pixbuf_get_width (source->pixbuf);
+  height = gdk_pixbuf_get_height (source->pixbuf);
+
+  if (rotate && width < height)
+    pixbuf = gdk_pixbuf_rotate_simple (source->pixbuf, GDK_PIXBUF_ROTATE_COUNTERCLOCKWISE);
+  else
+    pixbuf = g_object_ref (source->pixbuf);
+
+  thumbnail_fit (gdk_pixbuf_get_width (pixbuf), gdk_pixbuf_get_height (pixbuf),
+                 box_width, box_height, &width, &height);
+
+  thumb = resample_pixbuf (pixbuf, MAX (width, 1), MAX (height, 1), RESAMPLE_BOX);
+  g_object_unref (pixbuf);
+
+  return thumb;
+}
+
+/* Lays the first sheet out the way run() does, in sheet pixels, from the
+ * thumbnails decoded so far, and draws it scaled down to fit the preview.
+ * n_cells is set to how many images the first sheet takes. */
+static GdkPixbuf *
+preview_render (SheetPreview               *preview,
+                const SheetPreviewSettings *settings,
+                guint                      *n_cells)
+{
+  GdkPixbuf      *pixbuf;
+  Sheet          *sheet;
+  SheetText      *text = NULL;
+  SheetStyle      style = settings->style;
+  LayoutSettings  layout;
+  LayoutPlan     *plan;
+  ImageProbe     *probes;
+  gdouble         scale;
+  gint            caption_height = 0;
+  guint           n_files;
+  guint           i;
+
+  scale = MIN (preview->width / settings->sheet_width,
+               preview->height / settings->sheet_height);
+
+  pixbuf = gdk_pixbuf_new (GDK_COLORSPACE_RGB, FALSE, 8,
+                           MAX ((gint) (settings->sheet_width * scale), 1),
+                           MAX ((gint) (settings->sheet_height * scale), 1));
+
+  style.caption_size *= scale;
+  if (settings->captions != 0)
+    {
+      text = sheet_text_new (&style);
+      caption_height = sheet_text_get_height (text);
+    }
+
+  sheet = sheet_new_for_pixbuf (pixbuf, &style, text);
+
+  /* Images not decoded yet are laid out as the grid's cell, they take
+   * their place once they are */
+  n_files = MIN (preview->files->len, PREVIEW_MAX_CELLS);
+  probes  = g_new0 (ImageProbe, MAX (n_files, 1));
+
+  for (i = 0; i < n_files && i < preview->sources->len; i++)
+    {
+      PreviewSource *source = g_ptr_array_index (preview->sources, i);
+
+      if (source->pixbuf != NULL)
+        {
+          probes[i].width       = gdk_pixbuf_get_width (source->pixbuf);
+          probes[i].height      = gdk_pixbuf_get_height (source->pixbuf);
+          probes[i].orientation = 1;
+        }
+    }
+
+  layout.kind           = settings->layout;
+  layout.width          = settings->sheet_width;
+  layout.height         = settings->sheet_height;
+  layout.gap_x          = settings->gap_vert;
+  layout.gap_y          = settings->gap_horiz;
+  layout.rows           = settings->row;
+  layout.columns        = settings->column;
+  layout.caption_height = caption_height / scale;
+  layout.rotate         = settings->rotate;
+
+  plan = layout_plan_new (&layout, probes, n_files);
+  g_free (probes);
+
+  *n_cells = plan->n_sheets > 0 ? plan->sheet_first[1] : 0;
+
+  for (i = 0; i < *n_cells; i++)
+    {
+      const LayoutCell *cell   = &plan->cells[i];
+      PreviewSource    *source = NULL;
+      GdkPixbuf        *thumb;
+      gchar             caption[256];
+      gint              width  = cell->width * scale;
+      gint              height = cell->height * scale;
+
+      if (width < 1 || height < 1)
+        continue;
+
+      if (i < preview->sources->len)
+        source = g_ptr_array_index (preview->sources, i);
+
+      caption[0] = '\0';
+      if (text != NULL && source != NULL)
+        metadata_format_caption (&source->exif, source->name, settings->captions,
+                                 caption, sizeof (caption));
+
+      thumb = preview_fit (source, settings->rotate,
+                           (gint) (cell->thumb.box_width * scale), height - caption_height);
+      sheet_add_cell (sheet, cell->x * scale, cell->y * scale, width, height, thumb, caption);
+      g_clear_object (&thumb);
+    }
+
+  layout_plan_free (plan);
+  sheet_free (sheet);
+  g_clear_pointer (&text, sheet_text_free);
+
+  return pixbuf;
+}
+
+/* Draws straight away with what is decoded so far, then keeps decoding
+ * and redrawing until the sheet is complete or the settings change */
+static void
+preview_draw (SheetPreview               *preview,
+              const SheetPreviewSettings *settings,
+              guint                       generation)
+{
+  guint n_needed;
+
+  preview_set_folder (preview, settings);
+
+  while (! preview_is_stale (preview, generation))
+    {
+      PreviewResult *result = g_new0 (PreviewResult, 1);
+      guint          batch;
+
+      result->preview    = preview;
+      result->pixbuf     = preview_render (preview, settings, &n_needed);
+      result->generation = generation;
+
+      g_atomic_int_inc (&preview->ref_count);
+      g_idle_add (preview_show, result);
+
+      for (batch = 0;
+           batch < PREVIEW_BATCH && preview->sources->len < n_needed &&
+           ! preview_is_stale (preview, generation);
+           batch++)
+        preview_load_source (preview, settings);
+
+      if (batch == 0)
+        break;
+    }
+}
+
+static gpointer
+preview_thread (gpointer data)
+{
+  SheetPreview         *preview = data;
+  SheetPreviewSettings *settings;
+  guint                 generation;
+
+  g_mutex_lock (&preview->mutex);
+
+  while (TRUE)
+    {
+      while (preview->pending == NULL && ! preview->closing)
+        g_cond_wait (&preview->cond, &preview->mutex);
+
+      if (preview->closing)
+        break;
+
+      settings   = preview->pending;
+      generation = preview->generation;
+      preview->pending = NULL;
+
+      g_mutex_unlock (&preview->mutex);
+
+      preview_draw (preview, settings, generation);
+      preview_settings_free (settings);
+
+      g_mutex_lock (&preview->mutex);
+    }
+
+  g_mutex_unlock (&preview->mutex);
+
+  preview_unref (preview);
+
+  return NULL;
+}
+
+/* A preview drawn into a width by height area */
+SheetPreview *
+sheet_preview_new (gint width,
+                   gint height)
+{
+  SheetPreview *preview = g_new0 (SheetPreview, 1);
+
+  g_mutex_init (&preview->mutex);
+  g_cond_init (&preview->cond);
+
+  preview->ref_count = 2;
+  preview->width     = width;
+  preview->height    = height;
+  preview->sources   = g_ptr_array_new_with_free_func ((GDestroyNotify) preview_source_free);
+
+  preview->image = g_object_ref_sink (gtk_image_new ());
+  gtk_widget_set_size_request (preview->image, width, height);
+
+  // Captions are read on the thread
+  gexiv2_initialize ();
+
+  preview->thread = g_thread_new ("contactsheet-preview", preview_thread, preview);
+
+  return preview;
+}
+
+GtkWidget *
+sheet_preview_get_widget (SheetPreview *preview)
+{
+  return preview->image;
+}
+
+/* Asks for the sheet to be drawn with settings, which are copied. Returns
+ * at once, the drawing shows up when it is done. */
+void
+sheet_preview_update (SheetPreview               *preview,
+                      const SheetPreviewSettings *settings)
+{
+  if (settings->row <= 0 || settings->column <= 0 ||
+      settings->sheet_width < 1 || settings->sheet_height < 1 ||
+      settings->folder == NULL)
+    return;
+
+  g_mutex_lock (&preview->mutex);
+
+  g_clear_pointer (&preview->pending, preview_settings_free);
+  preview->pending = preview_settings_copy (settings);
+  preview->generation++;
+  g_cond_broadcast (&preview->cond);
+
+  g_mutex_unlock (&preview->mutex);
+}
+
+/* Tells the thread to stop and returns without waiting for it, it may be
+ * deep in a folder scan or a large decode. It drops whatever it was doing
+ * at its next check and frees the preview with its own reference. */
+void
+sheet_preview_free (SheetPreview *preview)
+{
+  g_mutex_lock (&preview->mutex);
+  preview->closing = TRUE;
+  g_clear_pointer (&preview->pending, preview_settings_free);
+  g_cond_broadcast (&preview->cond);
+  g_mutex_unlock (&preview->mutex);
+
+  g_thread_unref (preview->thread);
+
+  g_clear_object (&preview->image);
+  preview_unref (preview);
+}
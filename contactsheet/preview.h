@@ -0,0 +1,61 @@
+/* GIMP - The GNU Image Manipulation Program
+ * Copyright (C) 2023 Samuel Oldham
+ * Contact sheet plug-in (C) 2023 Samuel Oldham
+ * e-mail: so9010sami@gmail.com
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#ifndef __CONTACTSHEET_PREVIEW_H__
+#define __CONTACTSHEET_PREVIEW_H__
+
+#include <gtk/gtk.h>
+
+#include "metadata.h"
+#include "sheet.h"
+
+/* What the first sheet would be made from, in sheet pixels */
+typedef struct
+{
+  const gchar   *folder;
+  gboolean       recursive;
+  gboolean       use_cache;
+  gdouble        sheet_width;
+  gdouble        sheet_height;
+  gdouble        gap_vert;
+  gdouble        gap_horiz;
+  gint           row;
+  gint           column;
+  gboolean       rotate;
+  gint           layout;          /* LayoutKind */
+  CaptionFields  captions;
+  SheetStyle     style;
+} SheetPreviewSettings;
+
+/* A scaled down first sheet for the dialog, drawn on a thread of its own
+ * from small thumbnails so the dialog never waits for it. Only the newest
+ * settings are drawn, anything asked for in between is dropped. */
+typedef struct _SheetPreview SheetPreview;
+
+SheetPreview *sheet_preview_new        (gint                        width,
+                                        gint                        height);
+
+GtkWidget    *sheet_preview_get_widget (SheetPreview               *preview);
+
+void          sheet_preview_update     (SheetPreview               *preview,
+                                        const SheetPreviewSettings *settings);
+
+void          sheet_preview_free       (SheetPreview               *preview);
+
+#endif /* __CONTACTSHEET_PREVIEW_H__ */
@@ -0,0 +1,218 @@
+/* GIMP - The GNU Image Manipulation Program
+ * Copyright (C) 2023 Samuel Oldham
+ * Contact sheet plug-in (C) 2023 Samuel Oldham
+ * e-mail: so9010sami@gmail.com
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+/*
+ * Thumbnails of RAW files from their embedded previews.
+ */
+
+#include <string.h>
+#include <stdlib.h>
+
+#include <gexiv2/gexiv2.h>
+
+#include "raw-preview.h"
+
+/* How far short of the size asked for a preview may fall and still be
+ * used, scaled up the rest of the way, rather than developing the file */
+#define RAW_PREVIEW_MIN_COVER  0.75
+
+/* Lower case and sorted, they are searched with bsearch () */
+static const gchar *const raw_extensions[] =
+{
+  "3fr", "arw", "cr2", "cr3", "crw", "dcr", "dng", "erf", "iiq", "k25",
+  "kdc", "mef", "mos", "mrw", "nef", "nrw", "orf", "pef", "raf", "raw",
+  "rw2", "rwl", "sr2", "srf", "srw", "x3f"
+};
+
+static gint
+raw_preview_compare_extension (gconstpointer key,
+                               gconstpointer element)
+{
+  return strcmp (key, *(const gchar *const *) element);
+}
+
+/* Tells RAW files by their extension, their headers are mostly TIFF or
+ * ISO media and say little on their own */
+gboolean
+raw_preview_is_raw (const gchar *filename)
+{
+  const gchar *dot = strrchr (filename, '.');
+  gchar        extension[8];
+  gsize        length;
+  gsize        i;
+
+  if (dot == NULL)
+    return FALSE;
+
+  length = strlen (dot + 1);
+  if (length == 0 || length >= sizeof (extension))
+    return FALSE;
+
+  for (i = 0; i <= length; i++)
+    extension[i] = g_ascii_tolower (dot[1 + i]);
+
+  return bsearch (extension, raw_extensions, G_N_ELEMENTS (raw_extensions),
+                  sizeof (raw_extensions[0]), raw_preview_compare_extension) != NULL;
+}
+
+static gboolean
+raw_preview_is_jpeg (GExiv2PreviewProperties *props)
+{
+  return g_strcmp0 (gexiv2_preview_properties_get_mime_type (props), "image/jpeg") == 0;
+}
+
+static guint64
+raw_preview_area (GExiv2PreviewProperties *props)
+{
+  return (guint64) gexiv2_preview_properties_get_width (props) *
+                   gexiv2_preview_properties_get_height (props);
+}
+
+/* Reads the size of the largest JPEG preview in filename, which is what
+ * its thumbnail will be made from, and the EXIF orientation the previews
+ * share. Without a preview the size of the RAW itself is given. */
+gboolean
+raw_preview_probe (const gchar *filename,
+                   gint        *width,
+                   gint        *height,
+                   gint        *orientation)
+{
+  GExiv2Metadata           *metadata;
+  GExiv2PreviewProperties **props;
+  GExiv2PreviewProperties  *largest = NULL;
+  gint                      i;
+
+  metadata = gexiv2_metadata_new ();
+
+  if (! gexiv2_metadata_open_path (metadata, filename, NULL))
+    {
+      g_object_unref (metadata);
+      return FALSE;
+    }
+
+  props = gexiv2_metadata_get_preview_properties (metadata);
+
+  for (i = 0; props != NULL && props[i] != NULL; i++)
+    {
+      if (raw_preview_is_jpeg (props[i]) &&
+          (largest == NULL || raw_preview_area (props[i]) > raw_preview_area (largest)))
+        largest = props[i];
+    }
+
+  if (largest != NULL)
+    {
+      *width  = gexiv2_preview_properties_get_width (largest);
+      *height = gexiv2_preview_properties_get_height (largest);
+    }
+  else
+    {
+      *width  = gexiv2_metadata_get_pixel_width (metadata);
+      *height = gexiv2_metadata_get_pixel_height (metadata);
+    }
+
+  *orientation = gexiv2_metadata_try_get_orientation (metadata, NULL);
+  if (*orientation < 1 || *orientation > 8)
+    *orientation = 1;
+
+  g_object_unref (metadata);
+
+  return *width > 0 && *height > 0;
+}
+
+/* Decodes the smallest JPEG preview in filename that covers the size
+ * size_func asks for, the way jpeg_load_scaled () would. size_func sees
+ * the preview's size as the image's. Returns NULL when the file has no
+ * JPEG preview close enough to that size; the caller should develop the
+ * RAW itself then. */
+GdkPixbuf *
+raw_preview_load (const gchar  *filename,
+                  JpegSizeFunc  size_func,
+                  gpointer      user_data)
+{
+  GExiv2Metadata           *metadata;
+  GExiv2PreviewProperties **props;
+  GExiv2PreviewProperties  *largest = NULL;
+  GExiv2PreviewProperties  *best;
+  GExiv2PreviewImage       *image;
+  GdkPixbuf                *pixbuf = NULL;
+  const guint8             *data;
+  guint32                   size;
+  gint                      width;
+  gint                      height;
+  gint                      i;
+
+  metadata = gexiv2_metadata_new ();
+
+  if (! gexiv2_metadata_open_path (metadata, filename, NULL))
+    {
+      g_object_unref (metadata);
+      return NULL;
+    }
+
+  props = gexiv2_metadata_get_preview_properties (metadata);
+
+  for (i = 0; props != NULL && props[i] != NULL; i++)
+    {
+      if (raw_preview_is_jpeg (props[i]) &&
+          (largest == NULL || raw_preview_area (props[i]) > raw_preview_area (largest)))
+        largest = props[i];
+    }
+
+  if (largest == NULL)
+    {
+      g_object_unref (metadata);
+      return NULL;
+    }
+
+  /* The previews share the image's shape, so the largest tells the size
+   * needed out of any of them */
+  size_func (gexiv2_preview_properties_get_width (largest),
+             gexiv2_preview_properties_get_height (largest),
+             &width, &height, user_data);
+
+  best = largest;
+  for (i = 0; props[i] != NULL; i++)
+    {
+      if (raw_preview_is_jpeg (props[i]) &&
+          gexiv2_preview_properties_get_width (props[i]) >= width &&
+          gexiv2_preview_properties_get_height (props[i]) >= height &&
+          raw_preview_area (props[i]) < raw_preview_area (best))
+        best = props[i];
+    }
+
+  if (gexiv2_preview_properties_get_width (best) < width * RAW_PREVIEW_MIN_COVER ||
+      gexiv2_preview_properties_get_height (best) < height * RAW_PREVIEW_MIN_COVER)
+    {
+      g_object_unref (metadata);
+      return NULL;
+    }
+
+  image = gexiv2_metadata_try_get_preview_image (metadata, best, NULL);
+  if (image != NULL)
+    {
+      data = gexiv2_preview_image_get_data (image, &size);
+      if (data != NULL)
+        pixbuf = jpeg_load_scaled_from_data (data, size, size_func, user_data);
+
+      gexiv2_preview_image_free (image);
+    }
+
+  g_object_unref (metadata);
+
+  return pixbuf;
+}
@@ -0,0 +1,44 @@
+/* GIMP - The GNU Image Manipulation Program
+ * Copyright (C) 2023 Samuel Oldham
+ * Contact sheet plug-in (C) 2023 Samuel Oldham
+ * e-mail: so9010sami@gmail.com
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+#ifndef __CONTACTSHEET_RAW_PREVIEW_H__
+#define __CONTACTSHEET_RAW_PREVIEW_H__
+
+#include <glib.h>
+#include <gdk-pixbuf/gdk-pixbuf.h>
+
+#include "jpeg-load.h"
+
+/* Camera RAW files carry JPEG previews, often one at full size, that the
+ * camera rendered when the shot was taken. Decoding one of those is as
+ * quick as decoding a JPEG, where developing the RAW itself takes
+ * seconds. Needs gexiv2_initialize () to have run, then is safe on any
+ * thread. */
+
+gboolean   raw_preview_is_raw (const gchar  *filename);
+
+gboolean   raw_preview_probe  (const gchar  *filename,
+                               gint         *width,
+                               gint         *height,
+                               gint         *orientation);
+
+GdkPixbuf *raw_preview_load   (const gchar  *filename,
+                               JpegSizeFunc  size_func,
+                               gpointer      user_data);
+
+#endif /* __CONTACTSHEET_RAW_PREVIEW_H__ */
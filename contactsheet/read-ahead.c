@@ -0,0 +1,277 @@
+/* GIMP - The GNU Image Manipulation Program
+ * Copyright (C) 2023 Samuel Oldham
+ * Contact sheet plug-in (C) 2023 Samuel Oldham
+ * e-mail: so9010sami@gmail.com
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Telling the kernel which files the decoders will want next.
+ */
+
+#include <fcntl.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+
+#ifdef __linux__
+#include <sys/ioctl.h>
+#include <linux/fs.h>
+#include <linux/fiemap.h>
+#endif
+
+#include <glib/gstdio.h>
+
+#ifndef G_OS_WIN32
+#include <unistd.h>
+#endif
+
+#include "read-ahead.h"
+#include "trace.h"
+
+typedef struct
+{
+  gint     fd;
+  goffset  length;
+  guint64  device;
+  guint64  position;              /* First block on the disk, or the inode */
+} ReadAheadFile;
+
+struct _ReadAhead
+{
+  GThread      *thread;
+  GMutex        mutex;
+  GCond         cond;
+
+  guint         n_files;
+  guint         batch;            /* Files hinted at once, half the window */
+  guint         window;
+  guint         issued;           /* Files hinted so far */
+  guint         wanted;           /* Files that should have been by now */
+  gboolean      stop;
+
+  ReadAheadFunc func;
+  gpointer      user_data;
+};
+
+#ifdef POSIX_FADV_WILLNEED
+
+/* Where fd starts on the disk. Filesystems that cannot say, NFS among
+ * them, are ordered by inode, which most allocate near their data. */
+static guint64
+read_ahead_position (gint               fd,
+                     const struct stat *st)
+{
+#ifdef FS_IOC_FIEMAP
+  union
+  {
+    struct fiemap map;
+    guchar        space[sizeof (struct fiemap) + sizeof (struct fiemap_extent)];
+  } extents;
+
+  memset (&extents, 0, sizeof (extents));
+  extents.map.fm_length       = FIEMAP_MAX_OFFSET;
+  extents.map.fm_extent_count = 1;
+
+  if (ioctl (fd, FS_IOC_FIEMAP, &extents.map) == 0 &&
+      extents.map.fm_mapped_extents > 0 &&
+      extents.map.fm_extents[0].fe_physical > 0)
+    return extents.map.fm_extents[0].fe_physical;
+#endif
+
+  return st->st_ino;
+}
+
+static gint
+read_ahead_compare (gconstpointer a,
+                    gconstpointer b)
+{
+  const ReadAheadFile *file_a = a;
+  const ReadAheadFile *file_b = b;
+
+  if (file_a->device != file_b->device)
+    return file_a->device < file_b->device ? -1 : 1;
+  if (file_a->position != file_b->position)
+    return file_a->position < file_b->position ? -1 : 1;
+
+  return 0;
+}
+
+/* Hints files first to last, in the order they lie on the disk */
+static void
+read_ahead_batch (ReadAhead *ahead,
+                  guint      first,
+                  guint      last)
+{
+  GArray *batch = g_array_sized_new (FALSE, FALSE, sizeof (ReadAheadFile), last - first);
+  gint64  span  = TRACE_START ();
+  gint64  bytes = 0;
+  guint   i;
+
+  for (i = first; i < last; i++)
+    {
+      ReadAheadFile file;
+      struct stat   st;
+      gchar        *path = ahead->func (i, &file.length, ahead->user_data);
+
+      if (path == NULL)
+        continue;
+
+      file.fd = g_open (path, O_RDONLY, 0);
+      g_free (path);
+
+      if (file.fd < 0)
+        continue;
+
+      if (fstat (file.fd, &st) != 0)
+        {
+          close (file.fd);
+          continue;
+        }
+
+      if (file.length == 0 || file.length > st.st_size)
+        file.length = st.st_size;
+      file.device   = st.st_dev;
+      file.position = read_ahead_position (file.fd, &st);
+
+      g_array_append_val (batch, file);
+    }
+
+  g_array_sort (batch, read_ahead_compare);
+
+  // The kernel reads asynchronously, the pages stay cached once the files are closed
+  for (i = 0; i < batch->len; i++)
+    {
+      ReadAheadFile *file = &g_array_index (batch, ReadAheadFile, i);
+
+      posix_fadvise (file->fd, 0, file->length, POSIX_FADV_WILLNEED);
+      close (file->fd);
+      bytes += file->length;
+    }
+
+  TRACE_END ("readahead", "hint", span, NULL, bytes, 0);
+  g_array_free (batch, TRUE);
+}
+
+static gpointer
+read_ahead_thread (gpointer data)
+{
+  ReadAhead *ahead = data;
+
+  g_mutex_lock (&ahead->mutex);
+
+  while (! ahead->stop)
+    {
+      guint first = ahead->issued;
+      guint last  = ahead->wanted;
+
+      // A batch at a time, so there is something to put in order
+      if (last == first || (last - first < ahead->batch && last < ahead->n_files))
+        {
+          g_cond_wait (&ahead->cond, &ahead->mutex);
+          continue;
+        }
+
+      ahead->issued = last;
+      g_mutex_unlock (&ahead->mutex);
+
+      read_ahead_batch (ahead, first, last);
+
+      g_mutex_lock (&ahead->mutex);
+    }
+
+  g_mutex_unlock (&ahead->mutex);
+
+  return NULL;
+}
+
+#endif /* POSIX_FADV_WILLNEED */
+
+/* Starts reading ahead of n_files files, window files past the decoders.
+ * Returns NULL when window is 0 or the system has no way to; the other
+ * calls take NULL too. */
+ReadAhead *
+read_ahead_new (guint          n_files,
+                guint          window,
+                ReadAheadFunc  func,
+                gpointer       user_data)
+{
+#ifdef POSIX_FADV_WILLNEED
+  ReadAhead *ahead;
+
+  if (window == 0 || n_files == 0)
+    return NULL;
+
+  ahead = g_new0 (ReadAhead, 1);
+
+  g_mutex_init (&ahead->mutex);
+  g_cond_init (&ahead->cond);
+
+  ahead->n_files   = n_files;
+  ahead->window    = window;
+  ahead->batch     = MAX (window / 2, 1);
+  ahead->func      = func;
+  ahead->user_data = user_data;
+  ahead->thread    = g_thread_new ("read-ahead", read_ahead_thread, ahead);
+
+  return ahead;
+#else
+  return NULL;
+#endif
+}
+
+/* Says the decoders have been handed every file before index */
+void
+read_ahead_advance (ReadAhead *ahead,
+                    guint      index)
+{
+#ifdef POSIX_FADV_WILLNEED
+  guint wanted;
+
+  if (ahead == NULL)
+    return;
+
+  wanted = MIN (index + ahead->window, ahead->n_files);
+
+  g_mutex_lock (&ahead->mutex);
+  if (wanted > ahead->wanted)
+    {
+      ahead->wanted = wanted;
+      g_cond_signal (&ahead->cond);
+    }
+  g_mutex_unlock (&ahead->mutex);
+#endif
+}
+
+/* Stops after the batch being hinted, the rest is left to the decoders */
+void
+read_ahead_free (ReadAhead *ahead)
+{
+#ifdef POSIX_FADV_WILLNEED
+  if (ahead == NULL)
+    return;
+
+  g_mutex_lock (&ahead->mutex);
+  ahead->stop = TRUE;
+  g_cond_signal (&ahead->cond);
+  g_mutex_unlock (&ahead->mutex);
+
+  g_thread_join (ahead->thread);
+
+  g_cond_clear (&ahead->cond);
+  g_mutex_clear (&ahead->mutex);
+  g_free (ahead);
+#endif
+}
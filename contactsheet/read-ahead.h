@@ -0,0 +1,52 @@
+/* GIMP - The GNU Image Manipulation Program
+ * Copyright (C) 2023 Samuel Oldham
+ * Contact sheet plug-in (C) 2023 Samuel Oldham
+ * e-mail: so9010sami@gmail.com
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#ifndef __CONTACTSHEET_READ_AHEAD_H__
+#define __CONTACTSHEET_READ_AHEAD_H__
+
+#include <glib.h>
+
+/* Keeps the disk busy a window of files ahead of the decoders. A thread
+ * of its own tells the kernel which files are about to be read, with
+ * posix_fadvise (), half a window at a time, and orders each batch by
+ * where the files are on the disk so a spinning disk sweeps instead of
+ * seeking. Only the order of the reads changes, the decoders still take
+ * the files in sheet order. Where there is no posix_fadvise () it does
+ * nothing. */
+typedef struct _ReadAhead ReadAhead;
+
+/* Which file index is going to be read from, which may not be the image
+ * itself, and how many bytes from the start, 0 for all of it. Returns a
+ * path the caller frees, or NULL when there is nothing to read. Called
+ * on the read-ahead thread. */
+typedef gchar * (* ReadAheadFunc) (guint     index,
+                                   goffset  *length,
+                                   gpointer  user_data);
+
+ReadAhead *read_ahead_new     (guint          n_files,
+                               guint          window,
+                               ReadAheadFunc  func,
+                               gpointer       user_data);
+
+void       read_ahead_advance (ReadAhead     *ahead,
+                               guint          index);
+
+void       read_ahead_free    (ReadAhead     *ahead);
+
+#endif /* __CONTACTSHEET_READ_AHEAD_H__ */
@@ -0,0 +1,462 @@
+/* GIMP - The GNU Image Manipulation Program
+ * Copyright (C) 2023 Samuel Oldham
+ * Contact sheet plug-in (C) 2023 Samuel Oldham
+ * e-mail: so9010sami@gmail.com
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Checks the resampler against gdk-pixbuf's own scaler, and its AVX2,
+ * SSE4.1 and scalar kernels against each other, for both filters and for
+ * 8 and 16-bit pixels. The kernels are picked once per process, so the
+ * check runs itself again for each, with CONTACTSHEET_RESAMPLE set, and
+ * compares what those runs wrote. Exits 1 if anything is out of bounds.
+ *
+ *   make check-resample
+ */
+
+#include <math.h>
+#include <stdio.h>
+#include <string.h>
+
+#include <glib.h>
+#include <glib/gstdio.h>
+#include <gdk-pixbuf/gdk-pixbuf.h>
+
+#include "resample.h"
+
+/* Odd sizes, so the vector loops leave pixels over */
+#define CHECK_WIDTH             517
+#define CHECK_HEIGHT            343
+
+/* Most any channel may be off from gdk-pixbuf, in levels of 255. Box is
+ * checked against GDK_INTERP_BILINEAR, which area-averages when shrinking,
+ * and Lanczos-3 against GDK_INTERP_HYPER, whose filter is shaped a little
+ * differently. */
+#define CHECK_TOLERANCE         4
+
+/* Output pixels this near an edge are left out of that comparison.
+ * gdk-pixbuf repeats the edge pixel where the resampler reweights the
+ * taps that are left. */
+#define CHECK_EDGE              4
+
+/* Most the kernels may be off from the scalar ones, in levels of the
+ * output depth, everywhere */
+#define CHECK_KERNEL_TOLERANCE  1
+
+typedef struct
+{
+  gint           width;
+  gint           height;
+  gint           n_channels;
+  ResampleFilter filter;
+  ResampleDepth  src_depth;
+  ResampleDepth  dst_depth;
+} CheckCase;
+
+static const gchar *kernel_names[] = { "scalar", "sse4", "avx2" };
+
+static gchar *write_to = NULL;
+
+static GOptionEntry entries[] =
+{
+  { "write", 'w', G_OPTION_FLAG_HIDDEN, G_OPTION_ARG_FILENAME, &write_to,
+    "Scale every case with this process's kernels into FILE", "FILE" },
+  { NULL }
+};
+
+/* Every case, in the order the outputs are written */
+static GArray *
+check_cases (void)
+{
+  static const gint sizes[][2] = { { 131, 87 }, { 300, 200 } };
+  static const ResampleDepth depths[][2] =
+  {
+    { RESAMPLE_U8,  RESAMPLE_U8 },
+    { RESAMPLE_U16, RESAMPLE_U8 },
+    { RESAMPLE_U16, RESAMPLE_U16 }
+  };
+  GArray *cases = g_array_new (FALSE, FALSE, sizeof (CheckCase));
+  guint   s, d;
+  gint    n, f;
+
+  for (s = 0; s < G_N_ELEMENTS (sizes); s++)
+    for (n = 3; n <= 4; n++)
+      for (f = RESAMPLE_BOX; f <= RESAMPLE_LANCZOS3; f++)
+        for (d = 0; d < G_N_ELEMENTS (depths); d++)
+          {
+            CheckCase c = { sizes[s][0], sizes[s][1], n, f, depths[d][0], depths[d][1] };
+
+            g_array_append_val (cases, c);
+          }
+
+  return cases;
+}
+
+static gsize
+check_bytes (const CheckCase *c)
+{
+  return (gsize) c->width * c->height * c->n_channels *
+         (c->dst_depth == RESAMPLE_U16 ? 2 : 1);
+}
+
+/* Smooth, so the filters' different shapes matter little, with alpha
+ * kept well clear of 0. In 0 to 255. */
+static gdouble
+check_level (gint x,
+             gint y,
+             gint channel)
+{
+  switch (channel)
+    {
+    case 0:
+      return 40 + 160.0 * x / (CHECK_WIDTH - 1) + 30 * sin (2 * G_PI * y / 173);
+    case 1:
+      return 128 + 60 * sin (2 * G_PI * x / 197) * cos (2 * G_PI * y / 151);
+    case 2:
+      return 200 - 150.0 * y / (CHECK_HEIGHT - 1) + 25 * cos (2 * G_PI * (x + y) / 229);
+    default:
+      return 190 + 55 * cos (2 * G_PI * x / 211) * sin (2 * G_PI * y / 163);
+    }
+}
+
+/* The test image at either depth. The 16-bit one carries the bits the
+ * 8-bit one rounds off. */
+static guchar *
+check_image (gint          n_channels,
+             ResampleDepth depth)
+{
+  guchar  *pixels = g_new (guchar, (gsize) CHECK_WIDTH * CHECK_HEIGHT * n_channels * 2);
+  guint16 *pixels16 = (guint16 *) pixels;
+  gint     x, y, c;
+
+  for (y = 0; y < CHECK_HEIGHT; y++)
+    for (x = 0; x < CHECK_WIDTH; x++)
+      for (c = 0; c < n_channels; c++)
+        {
+          gsize  i     = ((gsize) y * CHECK_WIDTH + x) * n_channels + c;
+          gdouble level = check_level (x, y, c);
+
+          if (depth == RESAMPLE_U16)
+            pixels16[i] = lrint (level * 257);
+          else
+            pixels[i] = lrint (level);
+        }
+
+  return pixels;
+}
+
+/* One output value in levels of 255 */
+static gdouble
+check_value (const guchar  *pixels,
+             ResampleDepth  depth,
+             gsize          i)
+{
+  if (depth == RESAMPLE_U16)
+    return ((const guint16 *) pixels)[i] / 257.0;
+
+  return pixels[i];
+}
+
+/* The child's side: every case through this process's kernels, into one file */
+static gboolean
+check_write (const gchar *path,
+             GArray      *cases)
+{
+  GByteArray *out = g_byte_array_new ();
+  GError     *error = NULL;
+  gboolean    written;
+  guint       i;
+
+  for (i = 0; i < cases->len; i++)
+    {
+      const CheckCase *c = &g_array_index (cases, CheckCase, i);
+      guchar          *src = check_image (c->n_channels, c->src_depth);
+      gsize            offset = out->len;
+      gint             bpp = c->src_depth == RESAMPLE_U16 ? 2 : 1;
+
+      g_byte_array_set_size (out, offset + check_bytes (c));
+      resample_pixels (src, c->src_depth, CHECK_WIDTH, CHECK_HEIGHT,
+                       CHECK_WIDTH * c->n_channels * bpp,
+                       out->data + offset, c->dst_depth, c->width, c->height,
+                       c->width * c->n_channels * (c->dst_depth == RESAMPLE_U16 ? 2 : 1),
+                       c->n_channels, c->filter);
+      g_free (src);
+    }
+
+  written = g_file_set_contents (path, (const gchar *) out->data, out->len, &error);
+  if (! written)
+    {
+      g_printerr ("contactsheet-resample-check: %s\n", error->message);
+      g_error_free (error);
+    }
+
+  g_byte_array_free (out, TRUE);
+
+  return written;
+}
+
+/* Runs this program again with the named kernels. Returns what they
+ * wrote, or NULL with skipped set if the CPU has not got them. */
+static guchar *
+check_spawn (const gchar *self,
+             const gchar *kernels,
+             const gchar *folder,
+             gsize        expected,
+             gboolean    *skipped)
+{
+  gchar   *path = g_strdup_printf ("%s/%s.raw", folder, kernels);
+  gchar   *argv[] = { (gchar *) self, "--write", path, NULL };
+  gchar  **env = g_get_environ ();
+  gchar   *name = NULL;
+  gchar   *contents = NULL;
+  gsize    length = 0;
+  gint     status = 0;
+  GError  *error = NULL;
+
+  *skipped = FALSE;
+
+  // The best set is what the resampler picks when not held back
+  if (strcmp (kernels, "avx2") == 0)
+    env = g_environ_unsetenv (env, "CONTACTSHEET_RESAMPLE");
+  else
+    env = g_environ_setenv (env, "CONTACTSHEET_RESAMPLE", kernels, TRUE);
+
+  if (! g_spawn_sync (NULL, argv, env, G_SPAWN_DEFAULT, NULL, NULL,
+                      &name, NULL, &status, &error) ||
+      ! g_spawn_check_exit_status (status, &error))
+    {
+      g_printerr ("contactsheet-resample-check: %s: %s\n", kernels, error->message);
+      g_error_free (error);
+    }
+  else if (strcmp (g_strstrip (name), kernels) != 0)
+    {
+      *skipped = TRUE;
+    }
+  else if (! g_file_get_contents (path, &contents, &length, &error))
+    {
+      g_printerr ("contactsheet-resample-check: %s\n", error->message);
+      g_error_free (error);
+    }
+  else if (length != expected)
+    {
+      g_printerr ("contactsheet-resample-check: %s wrote %" G_GSIZE_FORMAT
+                  " bytes, not %" G_GSIZE_FORMAT "\n", kernels, length, expected);
+      g_clear_pointer (&contents, g_free);
+    }
+
+  g_unlink (path);
+  g_free (name);
+  g_strfreev (env);
+  g_free (path);
+
+  return (guchar *) contents;
+}
+
+/* The same case scaled by gdk-pixbuf, from the 8-bit image */
+static GdkPixbuf *
+check_reference (const CheckCase *c)
+{
+  guchar    *pixels = check_image (c->n_channels, RESAMPLE_U8);
+  GdkPixbuf *src;
+  GdkPixbuf *dst;
+
+  src = gdk_pixbuf_new_from_data (pixels, GDK_COLORSPACE_RGB, c->n_channels == 4, 8,
+                                  CHECK_WIDTH, CHECK_HEIGHT, CHECK_WIDTH * c->n_channels,
+                                  (GdkPixbufDestroyNotify) g_free, NULL);
+  dst = gdk_pixbuf_scale_simple (src, c->width, c->height,
+                                 c->filter == RESAMPLE_BOX ? GDK_INTERP_BILINEAR
+                                                           : GDK_INTERP_HYPER);
+  g_object_unref (src);
+
+  return dst;
+}
+
+/* The largest difference of any channel from gdk-pixbuf, edges left out */
+static gdouble
+check_against_reference (const CheckCase *c,
+                         const guchar    *pixels)
+{
+  GdkPixbuf    *reference = check_reference (c);
+  const guchar *ref = gdk_pixbuf_read_pixels (reference);
+  gint          stride = gdk_pixbuf_get_rowstride (reference);
+  gdouble       worst = 0.0;
+  gint          x, y, k;
+
+  for (y = CHECK_EDGE; y < c->height - CHECK_EDGE; y++)
+    for (x = CHECK_EDGE; x < c->width - CHECK_EDGE; x++)
+      for (k = 0; k < c->n_channels; k++)
+        {
+          gsize   i = ((gsize) y * c->width + x) * c->n_channels + k;
+          gdouble diff = fabs (check_value (pixels, c->dst_depth, i) -
+                               ref[y * stride + x * c->n_channels + k]);
+
+          worst = MAX (worst, diff);
+        }
+
+  g_object_unref (reference);
+
+  return worst;
+}
+
+/* The largest difference of any channel between two kernels, in levels of
+ * the output depth */
+static guint
+check_against_kernels (const CheckCase *c,
+                       const guchar    *pixels,
+                       const guchar    *scalar)
+{
+  gsize i;
+  gsize n = (gsize) c->width * c->height * c->n_channels;
+  guint worst = 0;
+
+  for (i = 0; i < n; i++)
+    {
+      gint a = c->dst_depth == RESAMPLE_U16 ? ((const guint16 *) pixels)[i] : pixels[i];
+      gint b = c->dst_depth == RESAMPLE_U16 ? ((const guint16 *) scalar)[i] : scalar[i];
+
+      worst = MAX (worst, (guint) ABS (a - b));
+    }
+
+  return worst;
+}
+
+static const gchar *
+check_describe (const CheckCase *c)
+{
+  static gchar description[64];
+
+  g_snprintf (description, sizeof (description), "%s %s %d-bit to %d-bit %dx%d",
+              c->filter == RESAMPLE_BOX ? "box" : "lanczos3",
+              c->n_channels == 4 ? "RGBA" : "RGB",
+              c->src_depth == RESAMPLE_U16 ? 16 : 8,
+              c->dst_depth == RESAMPLE_U16 ? 16 : 8,
+              c->width, c->height);
+
+  return description;
+}
+
+int
+main (int    argc,
+      char **argv)
+{
+  GOptionContext *context;
+  GError         *error = NULL;
+  GArray         *cases;
+  gchar          *folder;
+  guchar         *scalar = NULL;
+  gsize           total = 0;
+  gboolean        passed = TRUE;
+  guint           k;
+  guint           i;
+
+  context = g_option_context_new ("- check the resampler's kernels");
+  g_option_context_add_main_entries (context, entries, NULL);
+  if (! g_option_context_parse (context, &argc, &argv, &error))
+    {
+      g_printerr ("contactsheet-resample-check: %s\n", error->message);
+      return 1;
+    }
+  g_option_context_free (context);
+
+  cases = check_cases ();
+
+  if (write_to != NULL)
+    {
+      if (! check_write (write_to, cases))
+        return 1;
+
+      g_print ("%s\n", resample_kernel_name ());
+      return 0;
+    }
+
+  for (i = 0; i < cases->len; i++)
+    total += check_bytes (&g_array_index (cases, CheckCase, i));
+
+  folder = g_dir_make_tmp ("contactsheet-resample-XXXXXX", &error);
+  if (folder == NULL)
+    {
+      g_printerr ("contactsheet-resample-check: %s\n", error->message);
+      return 1;
+    }
+
+  g_print ("tolerance %d levels of 255 from gdk-pixbuf inside a %d px border, "
+           "%d level between kernels\n",
+           CHECK_TOLERANCE, CHECK_EDGE, CHECK_KERNEL_TOLERANCE);
+
+  // Scalar first, the others are held to it
+  for (k = 0; k < G_N_ELEMENTS (kernel_names); k++)
+    {
+      const gchar *kernels = kernel_names[k];
+      guchar      *pixels;
+      gboolean     skipped;
+      gdouble      worst_reference = 0.0;
+      guint        worst_kernels = 0;
+      gsize        offset = 0;
+
+      pixels = check_spawn (argv[0], kernels, folder, total, &skipped);
+      if (skipped)
+        {
+          g_print ("%-6s not on this CPU, skipped\n", kernels);
+          continue;
+        }
+
+      if (pixels == NULL)
+        {
+          passed = FALSE;
+          if (scalar == NULL)
+            break;
+          continue;
+        }
+
+      for (i = 0; i < cases->len; i++)
+        {
+          const CheckCase *c = &g_array_index (cases, CheckCase, i);
+          gdouble          reference = check_against_reference (c, pixels + offset);
+          guint            others = 0;
+
+          if (scalar != NULL)
+            others = check_against_kernels (c, pixels + offset, scalar + offset);
+
+          if (reference > CHECK_TOLERANCE || others > CHECK_KERNEL_TOLERANCE)
+            {
+              g_print ("%-6s %s: %.1f from gdk-pixbuf, %u from scalar\n",
+                       kernels, check_describe (c), reference, others);
+              passed = FALSE;
+            }
+
+          worst_reference = MAX (worst_reference, reference);
+          worst_kernels = MAX (worst_kernels, others);
+          offset += check_bytes (c);
+        }
+
+      g_print ("%-6s %u cases, worst %.1f from gdk-pixbuf, %u from scalar\n",
+               kernels, cases->len, worst_reference, worst_kernels);
+
+      if (scalar == NULL)
+        scalar = pixels;
+      else
+        g_free (pixels);
+    }
+
+  g_rmdir (folder);
+  g_free (folder);
+  g_free (scalar);
+  g_array_free (cases, TRUE);
+
+  g_print ("%s\n", passed ? "passed" : "FAILED");
+
+  return passed ? 0 : 1;
+}
@@ -0,0 +1,763 @@
+/* GIMP - The GNU Image Manipulation Program
+ * Copyright (C) 2023 Samuel Oldham
+ * Contact sheet plug-in (C) 2023 Samuel Oldham
+ * e-mail: so9010sami@gmail.com
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Separable image downscaling for the thumbnails.
+ *
+ * Every source row is widened to premultiplied float RGBA, filtered
+ * horizontally into a ring of rows, and each output row is then filtered
+ * vertically out of the ring and narrowed back down. Only the ring, as
+ * tall as the vertical filter, is held, never the whole intermediate.
+ */
+
+#include <math.h>
+#include <string.h>
+
+#include "resample.h"
+
+#if (defined (__x86_64__) || defined (__i386__)) && defined (__GNUC__)
+#define RESAMPLE_X86 1
+#include <immintrin.h>
+#endif
+
+/* Source pixels either side of the centre Lanczos reaches, at 1:1 */
+#define LANCZOS_SUPPORT 3.0
+
+/* The filter along one axis. Every output pixel has the same number of
+ * taps, the weights of the ones past its footprint are 0, so the kernels
+ * run one loop shape. */
+typedef struct
+{
+  gint    n_taps;
+  gint   *start;                  /* First source pixel of each output pixel */
+  gfloat *weights;                /* n_taps per output pixel, summing to 1 */
+} ResampleTable;
+
+typedef struct
+{
+  const gchar *name;
+
+  /* One source row to premultiplied float RGBA in 0..1 */
+  void (* widen)  (const guchar        *src,
+                   ResampleDepth        depth,
+                   gint                 width,
+                   gint                 n_channels,
+                   gfloat              *dst);
+
+  /* One widened row through the horizontal filter */
+  void (* row)    (const gfloat        *src,
+                   gfloat              *dst,
+                   gint                 width,
+                   const ResampleTable *table);
+
+  /* n floats of dst out of n_taps filtered rows */
+  void (* column) (const gfloat       **rows,
+                   const gfloat        *weights,
+                   gint                 n_taps,
+                   gfloat              *dst,
+                   gint                 n);
+} ResampleKernels;
+
+static gdouble
+lanczos3 (gdouble x)
+{
+  if (x == 0.0)
+    return 1.0;
+
+  if (x <= -LANCZOS_SUPPORT || x >= LANCZOS_SUPPORT)
+    return 0.0;
+
+  x *= G_PI;
+
+  return LANCZOS_SUPPORT * sin (x) * sin (x / LANCZOS_SUPPORT) / (x * x);
+}
+
+static void
+resample_table_init (ResampleTable  *table,
+                     gint            n_in,
+                     gint            n_out,
+                     ResampleFilter  filter)
+{
+  gdouble scale   = (gdouble) n_out / n_in;
+  gdouble fscale  = MIN (scale, 1.0);     /* Shrinking stretches the filter */
+  gdouble support = (filter == RESAMPLE_BOX ? 0.5 : LANCZOS_SUPPORT) / fscale;
+  gint    i;
+
+  table->n_taps  = MIN ((gint) ceil (support * 2) + 1, n_in);
+  table->start   = g_new (gint, n_out);
+  table->weights = g_new0 (gfloat, (gsize) n_out * table->n_taps);
+
+  for (i = 0; i < n_out; i++)
+    {
+      gdouble  center = (i + 0.5) / scale;  /* In source pixels, edges on integers */
+      gfloat  *weights = table->weights + (gsize) i * table->n_taps;
+      gdouble  sum = 0.0;
+      gint     first;
+      gint     j;
+
+      first = (gint) floor (center - support);
+      first = CLAMP (first, 0, n_in - table->n_taps);
+      table->start[i] = first;
+
+      for (j = 0; j < table->n_taps; j++)
+        {
+          gdouble x = first + j + 0.5;
+          gdouble weight;
+
+          if (filter == RESAMPLE_BOX)
+            {
+              /* How much of the source pixel the output pixel covers */
+              gdouble lo = MAX (x - 0.5, center - support);
+              gdouble hi = MIN (x + 0.5, center + support);
+
+              weight = MAX (hi - lo, 0.0);
+            }
+          else
+            {
+              weight = lanczos3 ((x - center) * fscale);
+            }
+
+          weights[j] = weight;
+          sum += weight;
+        }
+
+      // Taps that fell off the edge are left out, the rest make up for them
+      if (sum != 0.0)
+        {
+          for (j = 0; j < table->n_taps; j++)
+            weights[j] /= sum;
+        }
+      else
+        {
+          weights[CLAMP ((gint) center - first, 0, table->n_taps - 1)] = 1.0f;
+        }
+    }
+}
+
+static void
+resample_table_clear (ResampleTable *table)
+{
+  g_free (table->start);
+  g_free (table->weights);
+}
+
+static void
+resample_widen_scalar (const guchar  *src,
+                       ResampleDepth  depth,
+                       gint           width,
+                       gint           n_channels,
+                       gfloat        *dst)
+{
+  const guint16 *src16 = (const guint16 *) src;
+  gint           x;
+
+  // Split by layout, so the per-pixel loop has no branches
+  if (depth == RESAMPLE_U8 && n_channels == 3)
+    {
+      for (x = 0; x < width; x++, src += 3, dst += 4)
+        {
+          dst[0] = src[0] * (1.0f / 255);
+          dst[1] = src[1] * (1.0f / 255);
+          dst[2] = src[2] * (1.0f / 255);
+          dst[3] = 1.0f;
+        }
+    }
+  else if (depth == RESAMPLE_U8)
+    {
+      for (x = 0; x < width; x++, src += 4, dst += 4)
+        {
+          gfloat alpha = src[3] * (1.0f / 255);
+
+          dst[0] = src[0] * (1.0f / 255) * alpha;
+          dst[1] = src[1] * (1.0f / 255) * alpha;
+          dst[2] = src[2] * (1.0f / 255) * alpha;
+          dst[3] = alpha;
+        }
+    }
+  else
+    {
+      for (x = 0; x < width; x++, src16 += n_channels, dst += 4)
+        {
+          gfloat alpha = n_channels == 4 ? src16[3] * (1.0f / 65535) : 1.0f;
+
+          dst[0] = src16[0] * (1.0f / 65535) * alpha;
+          dst[1] = src16[1] * (1.0f / 65535) * alpha;
+          dst[2] = src16[2] * (1.0f / 65535) * alpha;
+          dst[3] = alpha;
+        }
+    }
+}
+
+static void
+resample_row_scalar (const gfloat        *src,
+                     gfloat              *dst,
+                     gint                 width,
+                     const ResampleTable *table)
+{
+  gint i;
+  gint k;
+
+  for (i = 0; i < width; i++)
+    {
+      const gfloat *s = src + 4 * table->start[i];
+      const gfloat *w = table->weights + (gsize) i * table->n_taps;
+      gfloat        acc[4] = { 0.0f, 0.0f, 0.0f, 0.0f };
+
+      for (k = 0; k < table->n_taps; k++)
+        {
+          acc[0] += w[k] * s[4 * k];
+          acc[1] += w[k] * s[4 * k + 1];
+          acc[2] += w[k] * s[4 * k + 2];
+          acc[3] += w[k] * s[4 * k + 3];
+        }
+
+      memcpy (dst + 4 * i, acc, sizeof (acc));
+    }
+}
+
+static void
+resample_column_scalar (const gfloat **rows,
+                        const gfloat  *weights,
+                        gint           n_taps,
+                        gfloat        *dst,
+                        gint           n)
+{
+  gint i;
+  gint k;
+
+  for (i = 0; i < n; i++)
+    dst[i] = weights[0] * rows[0][i];
+
+  for (k = 1; k < n_taps; k++)
+    for (i = 0; i < n; i++)
+      dst[i] += weights[k] * rows[k][i];
+}
+
+#ifdef RESAMPLE_X86
+
+__attribute__ ((target ("sse4.1")))
+static void
+resample_widen_sse4 (const guchar  *src,
+                     ResampleDepth  depth,
+                     gint           width,
+                     gint           n_channels,
+                     gfloat        *dst)
+{
+  __m128 scale = _mm_set1_ps (depth == RESAMPLE_U16 ? 1.0f / 65535 : 1.0f / 255);
+  gint   x;
+
+  if (depth == RESAMPLE_U16 && n_channels != 4)
+    {
+      resample_widen_scalar (src, depth, width, n_channels, dst);
+      return;
+    }
+
+  // RGB gets an opaque alpha byte, so it needs no premultiply
+  if (n_channels == 3)
+    {
+      for (x = 0; x < width; x++, src += 3)
+        {
+          guint32 bytes = (guint32) src[0] | ((guint32) src[1] << 8) |
+                          ((guint32) src[2] << 16) | (0xffu << 24);
+
+          _mm_storeu_ps (dst + 4 * x,
+                         _mm_mul_ps (_mm_cvtepi32_ps (_mm_cvtepu8_epi32 (_mm_cvtsi32_si128 ((gint) bytes))),
+                                     scale));
+        }
+      return;
+    }
+
+  for (x = 0; x < width; x++)
+    {
+      __m128i pixel;
+      __m128  v;
+
+      if (depth == RESAMPLE_U16)
+        {
+          pixel = _mm_cvtepu16_epi32 (_mm_loadl_epi64 ((const __m128i *) (src + 8 * x)));
+        }
+      else
+        {
+          gint32 bytes;
+
+          memcpy (&bytes, src + 4 * x, 4);
+          pixel = _mm_cvtepu8_epi32 (_mm_cvtsi32_si128 (bytes));
+        }
+
+      v = _mm_mul_ps (_mm_cvtepi32_ps (pixel), scale);
+
+      // Premultiplied, with alpha itself put back
+      v = _mm_blend_ps (_mm_mul_ps (v, _mm_shuffle_ps (v, v, _MM_SHUFFLE (3, 3, 3, 3))), v, 0x8);
+
+      _mm_storeu_ps (dst + 4 * x, v);
+    }
+}
+
+__attribute__ ((target ("sse4.1")))
+static void
+resample_row_sse4 (const gfloat        *src,
+                   gfloat              *dst,
+                   gint                 width,
+                   const ResampleTable *table)
+{
+  gint i;
+  gint k;
+
+  for (i = 0; i < width; i++)
+    {
+      const gfloat *s    = src + 4 * table->start[i];
+      const gfloat *w    = table->weights + (gsize) i * table->n_taps;
+      __m128        even = _mm_setzero_ps ();
+      __m128        odd  = _mm_setzero_ps ();
+
+      // Two sums, so each add does not wait on the one before
+      for (k = 0; k + 2 <= table->n_taps; k += 2)
+        {
+          even = _mm_add_ps (even, _mm_mul_ps (_mm_set1_ps (w[k]), _mm_loadu_ps (s + 4 * k)));
+          odd  = _mm_add_ps (odd, _mm_mul_ps (_mm_set1_ps (w[k + 1]), _mm_loadu_ps (s + 4 * k + 4)));
+        }
+
+      if (k < table->n_taps)
+        even = _mm_add_ps (even, _mm_mul_ps (_mm_set1_ps (w[k]), _mm_loadu_ps (s + 4 * k)));
+
+      _mm_storeu_ps (dst + 4 * i, _mm_add_ps (even, odd));
+    }
+}
+
+__attribute__ ((target ("sse4.1")))
+static void
+resample_column_sse4 (const gfloat **rows,
+                      const gfloat  *weights,
+                      gint           n_taps,
+                      gfloat        *dst,
+                      gint           n)
+{
+  gint i;
+  gint k;
+
+  // n is whole pixels, four floats each
+  for (i = 0; i < n; i += 4)
+    {
+      __m128 acc = _mm_setzero_ps ();
+
+      for (k = 0; k < n_taps; k++)
+        acc = _mm_add_ps (acc, _mm_mul_ps (_mm_set1_ps (weights[k]), _mm_loadu_ps (rows[k] + i)));
+
+      _mm_storeu_ps (dst + i, acc);
+    }
+}
+
+__attribute__ ((target ("avx2,fma")))
+static void
+resample_widen_avx2 (const guchar  *src,
+                     ResampleDepth  depth,
+                     gint           width,
+                     gint           n_channels,
+                     gfloat        *dst)
+{
+  __m256 scale = _mm256_set1_ps (depth == RESAMPLE_U16 ? 1.0f / 65535 : 1.0f / 255);
+  gint   x;
+
+  if (n_channels != 4)
+    {
+      resample_widen_sse4 (src, depth, width, n_channels, dst);
+      return;
+    }
+
+  // Two pixels at a time, the odd one out goes through the SSE4.1 kernel
+  for (x = 0; x + 2 <= width; x += 2)
+    {
+      __m256i pixels;
+      __m256  v;
+
+      if (depth == RESAMPLE_U16)
+        pixels = _mm256_cvtepu16_epi32 (_mm_loadu_si128 ((const __m128i *) (src + 8 * x)));
+      else
+        pixels = _mm256_cvtepu8_epi32 (_mm_loadl_epi64 ((const __m128i *) (src + 4 * x)));
+
+      v = _mm256_mul_ps (_mm256_cvtepi32_ps (pixels), scale);
+      v = _mm256_blend_ps (_mm256_mul_ps (v, _mm256_permute_ps (v, _MM_SHUFFLE (3, 3, 3, 3))), v, 0x88);
+
+      _mm256_storeu_ps (dst + 4 * x, v);
+    }
+
+  if (x < width)
+    resample_widen_sse4 (src + (depth == RESAMPLE_U16 ? 8 : 4) * x, depth,
+                         width - x, n_channels, dst + 4 * x);
+}
+
+__attribute__ ((target ("avx2,fma")))
+static void
+resample_row_avx2 (const gfloat        *src,
+                   gfloat              *dst,
+                   gint                 width,
+                   const ResampleTable *table)
+{
+  gint i;
+  gint k;
+
+  for (i = 0; i < width; i++)
+    {
+      const gfloat *s   = src + 4 * table->start[i];
+      const gfloat *w   = table->weights + (gsize) i * table->n_taps;
+      __m256        acc = _mm256_setzero_ps ();
+      __m128        sum;
+
+      // Two taps, two neighbouring source pixels, per step
+      for (k = 0; k + 2 <= table->n_taps; k += 2)
+        {
+          __m256 weight = _mm256_insertf128_ps (_mm256_castps128_ps256 (_mm_set1_ps (w[k])),
+                                                _mm_set1_ps (w[k + 1]), 1);
+
+          acc = _mm256_fmadd_ps (weight, _mm256_loadu_ps (s + 4 * k), acc);
+        }
+
+      sum = _mm_add_ps (_mm256_castps256_ps128 (acc), _mm256_extractf128_ps (acc, 1));
+
+      if (k < table->n_taps)
+        sum = _mm_fmadd_ps (_mm_set1_ps (w[k]), _mm_loadu_ps (s + 4 * k), sum);
+
+      _mm_storeu_ps (dst + 4 * i, sum);
+    }
+}
+
+__attribute__ ((target ("avx2,fma")))
+static void
+resample_column_avx2 (const gfloat **rows,
+                      const gfloat  *weights,
+                      gint           n_taps,
+                      gfloat        *dst,
+                      gint           n)
+{
+  gint i;
+  gint k;
+
+  for (i = 0; i + 8 <= n; i += 8)
+    {
+      __m256 acc = _mm256_setzero_ps ();
+
+      for (k = 0; k < n_taps; k++)
+        acc = _mm256_fmadd_ps (_mm256_set1_ps (weights[k]), _mm256_loadu_ps (rows[k] + i), acc);
+
+      _mm256_storeu_ps (dst + i, acc);
+    }
+
+  // An odd number of pixels leaves one
+  if (i < n)
+    {
+      __m128 acc = _mm_setzero_ps ();
+
+      for (k = 0; k < n_taps; k++)
+        acc = _mm_fmadd_ps (_mm_set1_ps (weights[k]), _mm_loadu_ps (rows[k] + i), acc);
+
+      _mm_storeu_ps (dst + i, acc);
+    }
+}
+
+static const ResampleKernels resample_kernels_sse4 =
+{
+  "sse4", resample_widen_sse4, resample_row_sse4, resample_column_sse4
+};
+
+static const ResampleKernels resample_kernels_avx2 =
+{
+  "avx2", resample_widen_avx2, resample_row_avx2, resample_column_avx2
+};
+
+#endif /* RESAMPLE_X86 */
+
+static const ResampleKernels resample_kernels_scalar =
+{
+  "scalar", resample_widen_scalar, resample_row_scalar, resample_column_scalar
+};
+
+/* Picked once, the best the CPU runs unless the environment says less */
+static const ResampleKernels *
+resample_kernels (void)
+{
+  static gsize chosen = 0;
+
+  if (g_once_init_enter (&chosen))
+    {
+      const ResampleKernels *kernels = &resample_kernels_scalar;
+#ifdef RESAMPLE_X86
+      const gchar           *limit   = g_getenv ("CONTACTSHEET_RESAMPLE");
+
+      __builtin_cpu_init ();
+
+      if (g_strcmp0 (limit, "scalar") == 0)
+        ;
+      else if (g_strcmp0 (limit, "sse4") != 0 &&
+               __builtin_cpu_supports ("avx2") && __builtin_cpu_supports ("fma"))
+        kernels = &resample_kernels_avx2;
+      else if (__builtin_cpu_supports ("sse4.1"))
+        kernels = &resample_kernels_sse4;
+#endif
+
+      g_once_init_leave (&chosen, (gsize) kernels);
+    }
+
+  return (const ResampleKernels *) chosen;
+}
+
+const gchar *
+resample_kernel_name (void)
+{
+  return resample_kernels ()->name;
+}
+
+/* One filtered row back to the output depth, undoing the premultiply */
+static void
+resample_narrow (const gfloat  *src,
+                 gint           width,
+                 gint           n_channels,
+                 ResampleDepth  depth,
+                 guchar        *dst)
+{
+  guint16 *dst16 = (guint16 *) dst;
+  gfloat   max   = depth == RESAMPLE_U16 ? 65535.0f : 255.0f;
+  gint     x;
+  gint     c;
+
+  for (x = 0; x < width; x++)
+    {
+      const gfloat *p     = src + 4 * x;
+      gfloat        alpha = CLAMP (p[3], 0.0f, 1.0f);
+      gfloat        v[4];
+
+      for (c = 0; c < 3; c++)
+        v[c] = alpha > 0.0f ? CLAMP (p[c] / alpha, 0.0f, 1.0f) : 0.0f;
+      v[3] = alpha;
+
+      for (c = 0; c < n_channels; c++)
+        {
+          if (depth == RESAMPLE_U16)
+            dst16[n_channels * x + c] = v[c] * max + 0.5f;
+          else
+            dst[n_channels * x + c] = v[c] * max + 0.5f;
+        }
+    }
+}
+
+struct _ResampleStream
+{
+  const ResampleKernels *kernels;
+  ResampleTable          horiz;
+  ResampleTable          vert;
+  gint                   src_width;
+  gint                   src_height;
+  ResampleDepth          src_depth;
+  gint                   dst_width;
+  gint                   dst_height;
+  ResampleDepth          dst_depth;
+  gint                   n_channels;
+
+  gfloat                *wide;
+  gfloat                *ring;    /* The last vert.n_taps source rows, filtered across */
+  const gfloat         **rows;
+  gfloat                *out;
+  guchar                *narrow;  /* One output row at dst_depth */
+
+  gint                   received; /* Source rows pushed so far */
+  gint                   y;        /* Next output row */
+
+  ResampleRowFunc        func;
+  gpointer               user_data;
+};
+
+/* Scales an image that arrives a few rows at a time, as
+ * resample_pixels () does, handing each output row to func as soon as
+ * the source rows under it are in. Only as many source rows as the
+ * filter spans are held. */
+ResampleStream *
+resample_stream_new (gint             src_width,
+                     gint             src_height,
+                     ResampleDepth    src_depth,
+                     gint             dst_width,
+                     gint             dst_height,
+                     ResampleDepth    dst_depth,
+                     gint             n_channels,
+                     ResampleFilter   filter,
+                     ResampleRowFunc  func,
+                     gpointer         user_data)
+{
+  ResampleStream *stream;
+  gsize           row_floats = 4 * (gsize) dst_width;
+
+  g_return_val_if_fail (n_channels == 3 || n_channels == 4, NULL);
+  g_return_val_if_fail (src_width > 0 && src_height > 0 && dst_width > 0 && dst_height > 0, NULL);
+
+  stream = g_new0 (ResampleStream, 1);
+
+  stream->kernels    = resample_kernels ();
+  stream->src_width  = src_width;
+  stream->src_height = src_height;
+  stream->src_depth  = src_depth;
+  stream->dst_width  = dst_width;
+  stream->dst_height = dst_height;
+  stream->dst_depth  = dst_depth;
+  stream->n_channels = n_channels;
+  stream->func       = func;
+  stream->user_data  = user_data;
+
+  resample_table_init (&stream->horiz, src_width, dst_width, filter);
+  resample_table_init (&stream->vert, src_height, dst_height, filter);
+
+  stream->wide   = g_new (gfloat, 4 * (gsize) src_width);
+  stream->ring   = g_new (gfloat, row_floats * stream->vert.n_taps);
+  stream->rows   = g_new (const gfloat *, stream->vert.n_taps);
+  stream->out    = g_new (gfloat, row_floats);
+  stream->narrow = g_new (guchar, (gsize) dst_width * n_channels *
+                                  (dst_depth == RESAMPLE_U16 ? 2 : 1));
+
+  return stream;
+}
+
+/* Feeds the next n_rows source rows, stride bytes apart */
+void
+resample_stream_push (ResampleStream *stream,
+                      const guchar   *src,
+                      gint            n_rows,
+                      gint            stride)
+{
+  const ResampleKernels *kernels    = stream->kernels;
+  const ResampleTable   *vert       = &stream->vert;
+  gsize                  row_floats = 4 * (gsize) stream->dst_width;
+  gint                   i;
+  gint                   k;
+
+  for (i = 0; i < n_rows && stream->received < stream->src_height; i++)
+    {
+      gint row = stream->received++;
+
+      /* Rows between the footprints of two output rows are never needed.
+       * The slot written over belongs to a row every later output row
+       * starts past. */
+      if (stream->y >= stream->dst_height || row < vert->start[stream->y])
+        continue;
+
+      kernels->widen (src + (gsize) i * stride, stream->src_depth,
+                      stream->src_width, stream->n_channels, stream->wide);
+      kernels->row (stream->wide, stream->ring + (row % vert->n_taps) * row_floats,
+                    stream->dst_width, &stream->horiz);
+
+      while (stream->y < stream->dst_height &&
+             vert->start[stream->y] + vert->n_taps - 1 <= row)
+        {
+          gint first = vert->start[stream->y];
+
+          for (k = 0; k < vert->n_taps; k++)
+            stream->rows[k] = stream->ring + ((first + k) % vert->n_taps) * row_floats;
+
+          kernels->column (stream->rows, vert->weights + (gsize) stream->y * vert->n_taps,
+                           vert->n_taps, stream->out, row_floats);
+
+          resample_narrow (stream->out, stream->dst_width, stream->n_channels,
+                           stream->dst_depth, stream->narrow);
+          stream->func (stream->narrow, stream->y, stream->user_data);
+          stream->y++;
+        }
+    }
+}
+
+void
+resample_stream_free (ResampleStream *stream)
+{
+  g_free (stream->narrow);
+  g_free (stream->out);
+  g_free (stream->rows);
+  g_free (stream->ring);
+  g_free (stream->wide);
+  resample_table_clear (&stream->vert);
+  resample_table_clear (&stream->horiz);
+  g_free (stream);
+}
+
+typedef struct
+{
+  guchar *dst;
+  gint    stride;
+  gsize   row_bytes;
+} ResampleTarget;
+
+static void
+resample_store_row (const guchar *row,
+                    gint          y,
+                    gpointer      user_data)
+{
+  ResampleTarget *target = user_data;
+
+  memcpy (target->dst + (gsize) y * target->stride, row, target->row_bytes);
+}
+
+void
+resample_pixels (const guchar   *src,
+                 ResampleDepth   src_depth,
+                 gint            src_width,
+                 gint            src_height,
+                 gint            src_stride,
+                 guchar         *dst,
+                 ResampleDepth   dst_depth,
+                 gint            dst_width,
+                 gint            dst_height,
+                 gint            dst_stride,
+                 gint            n_channels,
+                 ResampleFilter  filter)
+{
+  ResampleStream *stream;
+  ResampleTarget  target;
+
+  target.dst       = dst;
+  target.stride    = dst_stride;
+  target.row_bytes = (gsize) dst_width * n_channels * (dst_depth == RESAMPLE_U16 ? 2 : 1);
+
+  stream = resample_stream_new (src_width, src_height, src_depth,
+                                dst_width, dst_height, dst_depth,
+                                n_channels, filter,
+                                resample_store_row, &target);
+  if (stream == NULL)
+    return;
+
+  resample_stream_push (stream, src, src_height, src_stride);
+  resample_stream_free (stream);
+}
+
+/* A new 8-bit pixbuf of src scaled to width by height */
+GdkPixbuf *
+resample_pixbuf (const GdkPixbuf *src,
+                 gint             width,
+                 gint             height,
+                 ResampleFilter   filter)
+{
+  GdkPixbuf *dst;
+
+  dst = gdk_pixbuf_new (GDK_COLORSPACE_RGB, gdk_pixbuf_get_has_alpha (src), 8,
+                        width, height);
+  if (dst == NULL)
+    return NULL;
+
+  resample_pixels (gdk_pixbuf_read_pixels (src), RESAMPLE_U8,
+                   gdk_pixbuf_get_width (src), gdk_pixbuf_get_height (src),
+                   gdk_pixbuf_get_rowstride (src),
+                   gdk_pixbuf_get_pixels (dst), RESAMPLE_U8,
+                   width, height, gdk_pixbuf_get_rowstride (dst),
+                   gdk_pixbuf_get_n_channels (src), filter);
+
+  return dst;
+}
@@ -0,0 +1,90 @@
+/* GIMP - The GNU Image Manipulation Program
+ * Copyright (C) 2023 Samuel Oldham
+ * Contact sheet plug-in (C) 2023 Samuel Oldham
+ * e-mail: so9010sami@gmail.com
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#ifndef __CONTACTSHEET_RESAMPLE_H__
+#define __CONTACTSHEET_RESAMPLE_H__
+
+#include <glib.h>
+#include <gdk-pixbuf/gdk-pixbuf.h>
+
+/* How images are shrunk to their cell */
+typedef enum
+{
+  RESAMPLE_BOX,                   /* Area averaging, fast, for drafts */
+  RESAMPLE_LANCZOS3               /* Sharper, for print */
+} ResampleFilter;
+
+typedef enum
+{
+  RESAMPLE_U8,
+  RESAMPLE_U16                    /* Native endian */
+} ResampleDepth;
+
+/* Scales RGB or RGBA pixels, 3 or 4 channels, from src to dst. The
+ * depths may differ, so a 16-bit image can be shrunk straight to 8 bits.
+ * Alpha is premultiplied while filtering. The inner loops use AVX2 or
+ * SSE4.1 when the CPU has them, CONTACTSHEET_RESAMPLE=scalar or sse4 in
+ * the environment holds them back. Safe to call from any thread. */
+void         resample_pixels      (const guchar   *src,
+                                   ResampleDepth   src_depth,
+                                   gint            src_width,
+                                   gint            src_height,
+                                   gint            src_stride,
+                                   guchar         *dst,
+                                   ResampleDepth   dst_depth,
+                                   gint            dst_width,
+                                   gint            dst_height,
+                                   gint            dst_stride,
+                                   gint            n_channels,
+                                   ResampleFilter  filter);
+
+/* Scaling rows as they come, for images never held whole */
+typedef struct _ResampleStream ResampleStream;
+
+typedef void (* ResampleRowFunc) (const guchar *row,
+                                  gint          y,
+                                  gpointer      user_data);
+
+ResampleStream *resample_stream_new  (gint             src_width,
+                                      gint             src_height,
+                                      ResampleDepth    src_depth,
+                                      gint             dst_width,
+                                      gint             dst_height,
+                                      ResampleDepth    dst_depth,
+                                      gint             n_channels,
+                                      ResampleFilter   filter,
+                                      ResampleRowFunc  func,
+                                      gpointer         user_data);
+
+void            resample_stream_push (ResampleStream  *stream,
+                                      const guchar    *src,
+                                      gint             n_rows,
+                                      gint             stride);
+
+void            resample_stream_free (ResampleStream  *stream);
+
+GdkPixbuf   *resample_pixbuf      (const GdkPixbuf *src,
+                                   gint            width,
+                                   gint            height,
+                                   ResampleFilter  filter);
+
+/* The kernels in use, "avx2", "sse4" or "scalar" */
+const gchar *resample_kernel_name (void);
+
+#endif /* __CONTACTSHEET_RESAMPLE_H__ */
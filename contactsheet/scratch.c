@@ -0,0 +1,154 @@
+/* GIMP - The GNU Image Manipulation Program
+ * Copyright (C) 2023 Samuel Oldham
+ * Contact sheet plug-in (C) 2023 Samuel Oldham
+ * e-mail: so9010sami@gmail.com
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Per-sheet scratch memory.
+ */
+
+#include <string.h>
+
+#include "scratch.h"
+
+/* Everything handed out is aligned for any type */
+#define SCRATCH_ALIGN  16
+
+struct _Scratch
+{
+  GPtrArray *blocks;              /* Of block_size bytes each, kept across resets */
+  GPtrArray *large;               /* Allocations bigger than a block, freed on reset */
+  gsize      block_size;
+  guint      current;             /* Block being handed out of */
+  gsize      used;                /* Bytes of it handed out */
+};
+
+Scratch *
+scratch_new (gsize block_size)
+{
+  Scratch *scratch = g_new0 (Scratch, 1);
+
+  scratch->blocks     = g_ptr_array_new_with_free_func (g_free);
+  scratch->large      = g_ptr_array_new_with_free_func (g_free);
+  scratch->block_size = MAX (block_size, 256);
+
+  return scratch;
+}
+
+/* Returns size bytes that stay valid until the next scratch_reset () */
+gpointer
+scratch_alloc (Scratch *scratch,
+               gsize    size)
+{
+  guchar *block;
+
+  size = (size + SCRATCH_ALIGN - 1) & ~(gsize) (SCRATCH_ALIGN - 1);
+
+  if (size > scratch->block_size)
+    {
+      block = g_malloc (size);
+      g_ptr_array_add (scratch->large, block);
+      return block;
+    }
+
+  if (scratch->blocks->len == 0 || scratch->used + size > scratch->block_size)
+    {
+      if (scratch->blocks->len > 0)
+        scratch->current++;
+      scratch->used = 0;
+
+      if (scratch->current == scratch->blocks->len)
+        g_ptr_array_add (scratch->blocks, g_malloc (scratch->block_size));
+    }
+
+  block = g_ptr_array_index (scratch->blocks, scratch->current);
+  scratch->used += size;
+
+  return block + scratch->used - size;
+}
+
+gchar *
+scratch_strdup (Scratch     *scratch,
+                const gchar *str)
+{
+  gsize  len  = strlen (str);
+  gchar *copy = scratch_alloc (scratch, len + 1);
+
+  memcpy (copy, str, len + 1);
+
+  return copy;
+}
+
+/* The last component of path, which is a file name and not a folder */
+gchar *
+scratch_basename (Scratch     *scratch,
+                  const gchar *path)
+{
+  const gchar *base = strrchr (path, G_DIR_SEPARATOR);
+
+#ifdef G_OS_WIN32
+  {
+    const gchar *slash = strrchr (path, '/');
+
+    if (base == NULL || (slash != NULL && slash > base))
+      base = slash;
+  }
+#endif
+
+  return scratch_strdup (scratch, base != NULL ? base + 1 : path);
+}
+
+gchar *
+scratch_printf (Scratch     *scratch,
+                const gchar *format,
+                ...)
+{
+  va_list  args;
+  gchar   *text;
+  gint     len;
+
+  va_start (args, format);
+  len = g_vsnprintf (NULL, 0, format, args);
+  va_end (args);
+
+  text = scratch_alloc (scratch, len + 1);
+
+  va_start (args, format);
+  g_vsnprintf (text, len + 1, format, args);
+  va_end (args);
+
+  return text;
+}
+
+/* Takes back everything handed out since the last reset */
+void
+scratch_reset (Scratch *scratch)
+{
+  scratch->current = 0;
+  scratch->used    = 0;
+
+  if (scratch->large->len > 0)
+    g_ptr_array_set_size (scratch->large, 0);
+}
+
+void
+scratch_free (Scratch *scratch)
+{
+  g_ptr_array_free (scratch->large, TRUE);
+  g_ptr_array_free (scratch->blocks, TRUE);
+  g_free (scratch);
+}
@@ -0,0 +1,51 @@
+/* GIMP - The GNU Image Manipulation Program
+ * Copyright (C) 2023 Samuel Oldham
+ * Contact sheet plug-in (C) 2023 Samuel Oldham
+ * e-mail: so9010sami@gmail.com
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#ifndef __CONTACTSHEET_SCRATCH_H__
+#define __CONTACTSHEET_SCRATCH_H__
+
+#include <glib.h>
+
+/* Memory for things that only live until a sheet is done, handed out by
+ * bumping a pointer through blocks and given back all at once. The blocks
+ * are kept when it is reset, so after the first sheet a run allocates
+ * nothing new for them however many files it goes through. Not thread
+ * safe, each user keeps its own. */
+typedef struct _Scratch Scratch;
+
+Scratch  *scratch_new      (gsize        block_size);
+
+gpointer  scratch_alloc    (Scratch     *scratch,
+                            gsize        size);
+
+gchar    *scratch_strdup   (Scratch     *scratch,
+                            const gchar *str);
+
+gchar    *scratch_basename (Scratch     *scratch,
+                            const gchar *path);
+
+gchar    *scratch_printf   (Scratch     *scratch,
+                            const gchar *format,
+                            ...) G_GNUC_PRINTF (2, 3);
+
+void      scratch_reset    (Scratch     *scratch);
+
+void      scratch_free     (Scratch     *scratch);
+
+#endif /* __CONTACTSHEET_SCRATCH_H__ */
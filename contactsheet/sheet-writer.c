@@ -0,0 +1,487 @@
+/* GIMP - The GNU Image Manipulation Program
+ * Copyright (C) 2023 Samuel Oldham
+ * Contact sheet plug-in (C) 2023 Samuel Oldham
+ * e-mail: so9010sami@gmail.com
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Background sheet export.
+ */
+
+#include <errno.h>
+
+#include <glib/gstdio.h>
+
+#include "sheet-writer.h"
+#include "stream-encode.h"
+#include "trace.h"
+
+typedef struct
+{
+  GdkPixbuf   *pixbuf;
+  gchar      **filenames;           /* Full resolution, then one per tier */
+  SheetStream *stream;              /* Set for a band, pixbuf NULL at the end */
+  gint         n_rows;              /* Rows of a band that belong to the sheet */
+} SheetJob;
+
+typedef struct
+{
+  gint            resolution;
+  ResampleFilter  filter;
+} SheetTier;
+
+struct _SheetWriter
+{
+  GThread     *thread;
+  GMutex       mutex;
+  GCond        cond;
+  GQueue       jobs;
+  gboolean     closing;           /* No more jobs will be pushed */
+  guint        failed;            /* Sheets that could not be written */
+  guint        depth;             /* Sheets held before a push blocks */
+
+  SheetOutput  output;
+  gint         resolution;
+  GArray      *tiers;             /* SheetTier, in the order they were added */
+};
+
+struct _SheetStream
+{
+  SheetWriter     *writer;
+  gchar          **filenames;
+  gint             width;
+  gint             height;
+
+  /* Opened by the writer thread with the first band: one encoder per
+   * file, and a resampler per tier feeding encoders[i + 1] */
+  StreamEncoder  **encoders;
+  ResampleStream **tiers;
+  guint            n_tiers;
+};
+
+const gchar *
+sheet_writer_extension (SheetOutput output)
+{
+  switch (output)
+    {
+    case SHEET_OUTPUT_JPEG:
+      return "jpg";
+
+    case SHEET_OUTPUT_TIFF:
+      return "tif";
+
+    case SHEET_OUTPUT_PDF:
+      return "pdf";
+
+    default:
+      return "png";
+    }
+}
+
+static gboolean
+sheet_writer_save (SheetWriter *writer,
+                   GdkPixbuf   *pixbuf,
+                   const gchar *filename,
+                   gint         resolution)
+{
+  GError   *error = NULL;
+  gchar     dpi[16];
+  gchar    *part;
+  gboolean  saved;
+  gint64    start = TRACE_START ();
+
+  /* Written next to it and renamed into place, so a viewer watching the
+   * sheet never reads half of it, however often it is written again */
+  part = g_strconcat (filename, ".part", NULL);
+
+  g_snprintf (dpi, sizeof (dpi), "%d", resolution);
+
+  switch (writer->output)
+    {
+    case SHEET_OUTPUT_JPEG:
+      saved = gdk_pixbuf_save (pixbuf, part, "jpeg", &error,
+                               "quality", "92",
+                               "x-dpi",   dpi,
+                               "y-dpi",   dpi,
+                               NULL);
+      break;
+
+    case SHEET_OUTPUT_TIFF:
+      saved = gdk_pixbuf_save (pixbuf, part, "tiff", &error,
+                               "x-dpi",   dpi,
+                               "y-dpi",   dpi,
+                               NULL);
+      break;
+
+    default:
+      saved = gdk_pixbuf_save (pixbuf, part, "png", &error,
+                               "x-dpi",   dpi,
+                               "y-dpi",   dpi,
+                               NULL);
+      break;
+    }
+
+  if (saved && g_rename (part, filename) != 0)
+    {
+      g_set_error (&error, G_FILE_ERROR, g_file_error_from_errno (errno),
+                   "%s", g_strerror (errno));
+      saved = FALSE;
+    }
+
+  if (! saved)
+    {
+      g_printerr ("contactsheet: could not write %s: %s\n",
+                  filename, error ? error->message : "unknown error");
+      g_clear_error (&error);
+      g_unlink (part);
+    }
+  g_free (part);
+
+  TRACE_END ("writer", "encode", start, filename, trace_file_size (filename), 0);
+
+  return saved;
+}
+
+/* Writes the sheet and then each tier. Every tier is shrunk from the
+ * full sheet rather than from the one before, so errors do not add up. */
+static gboolean
+sheet_writer_save_job (SheetWriter *writer,
+                       SheetJob    *job)
+{
+  gboolean saved;
+  gint     width  = gdk_pixbuf_get_width (job->pixbuf);
+  gint     height = gdk_pixbuf_get_height (job->pixbuf);
+  guint    i;
+
+  saved = sheet_writer_save (writer, job->pixbuf, job->filenames[0], writer->resolution);
+
+  for (i = 0; i < writer->tiers->len && job->filenames[i + 1] != NULL; i++)
+    {
+      SheetTier *tier = &g_array_index (writer->tiers, SheetTier, i);
+      GdkPixbuf *pixbuf;
+      gint64     start = TRACE_START ();
+
+      pixbuf = resample_pixbuf (job->pixbuf,
+                                MAX (1, (width  * tier->resolution + writer->resolution / 2) / writer->resolution),
+                                MAX (1, (height * tier->resolution + writer->resolution / 2) / writer->resolution),
+                                tier->filter);
+      TRACE_END ("writer", "tier", start, job->filenames[i + 1], 0, 0);
+
+      if (pixbuf == NULL)
+        {
+          g_printerr ("contactsheet: could not shrink %s to %d dpi\n",
+                      job->filenames[0], tier->resolution);
+          saved = FALSE;
+          continue;
+        }
+
+      if (! sheet_writer_save (writer, pixbuf, job->filenames[i + 1], tier->resolution))
+        saved = FALSE;
+
+      g_object_unref (pixbuf);
+    }
+
+  return saved;
+}
+
+static void
+sheet_stream_tier_row (const guchar *row,
+                       gint          y,
+                       gpointer      user_data)
+{
+  stream_encoder_write (user_data, row, 1, 0);
+}
+
+static void
+sheet_stream_open (SheetStream *stream)
+{
+  SheetWriter *writer = stream->writer;
+  guint        n_files = g_strv_length (stream->filenames);
+  guint        i;
+
+  stream->n_tiers  = MIN (writer->tiers->len, n_files - 1);
+  stream->encoders = g_new0 (StreamEncoder *, stream->n_tiers + 1);
+  stream->tiers    = g_new0 (ResampleStream *, stream->n_tiers);
+
+  stream->encoders[0] = stream_encoder_new (writer->output, stream->filenames[0],
+                                            stream->width, stream->height,
+                                            writer->resolution);
+
+  for (i = 0; i < stream->n_tiers; i++)
+    {
+      SheetTier *tier   = &g_array_index (writer->tiers, SheetTier, i);
+      gint       width  = MAX (1, (stream->width  * tier->resolution + writer->resolution / 2) / writer->resolution);
+      gint       height = MAX (1, (stream->height * tier->resolution + writer->resolution / 2) / writer->resolution);
+
+      stream->encoders[i + 1] = stream_encoder_new (writer->output, stream->filenames[i + 1],
+                                                    width, height, tier->resolution);
+      stream->tiers[i] = resample_stream_new (stream->width, stream->height, RESAMPLE_U8,
+                                              width, height, RESAMPLE_U8, 3, tier->filter,
+                                              sheet_stream_tier_row,
+                                              stream->encoders[i + 1]);
+    }
+}
+
+/* Encodes a band of a streamed sheet, or ends every file of it once the
+ * last band is in. Only the end reports whether the sheet was saved. */
+static gboolean
+sheet_writer_stream_job (SheetWriter *writer,
+                         SheetJob    *job)
+{
+  SheetStream *stream = job->stream;
+  gboolean     saved  = TRUE;
+  gint64       start  = TRACE_START ();
+  guint        i;
+
+  if (stream->encoders == NULL)
+    sheet_stream_open (stream);
+
+  if (job->pixbuf != NULL)
+    {
+      const guchar *pixels = gdk_pixbuf_read_pixels (job->pixbuf);
+      gint          stride = gdk_pixbuf_get_rowstride (job->pixbuf);
+
+      stream_encoder_write (stream->encoders[0], pixels, job->n_rows, stride);
+
+      for (i = 0; i < stream->n_tiers; i++)
+        resample_stream_push (stream->tiers[i], pixels, job->n_rows, stride);
+
+      TRACE_END ("writer", "band", start, stream->filenames[0], job->n_rows, 0);
+
+      return TRUE;
+    }
+
+  for (i = 0; i < stream->n_tiers; i++)
+    resample_stream_free (stream->tiers[i]);
+
+  for (i = 0; i <= stream->n_tiers; i++)
+    if (! stream_encoder_finish (stream->encoders[i]))
+      saved = FALSE;
+
+  TRACE_END ("writer", "encode", start, stream->filenames[0],
+             trace_file_size (stream->filenames[0]), 0);
+
+  g_free (stream->encoders);
+  g_free (stream->tiers);
+  g_strfreev (stream->filenames);
+  g_free (stream);
+
+  return saved;
+}
+
+static gpointer
+sheet_writer_thread (gpointer data)
+{
+  SheetWriter *writer = data;
+  SheetJob    *job;
+
+  g_mutex_lock (&writer->mutex);
+
+  while (TRUE)
+    {
+      while (g_queue_is_empty (&writer->jobs) && ! writer->closing)
+        g_cond_wait (&writer->cond, &writer->mutex);
+
+      /* The job stays queued while it is written, so it counts toward
+       * the depth and the pusher waits for it */
+      job = g_queue_peek_head (&writer->jobs);
+      if (job == NULL)
+        break;
+
+      g_mutex_unlock (&writer->mutex);
+
+      if (job->stream != NULL)
+        {
+          if (! sheet_writer_stream_job (writer, job))
+            g_atomic_int_inc (&writer->failed);
+        }
+      else if (! sheet_writer_save_job (writer, job))
+        {
+          g_atomic_int_inc (&writer->failed);
+        }
+
+      g_clear_object (&job->pixbuf);
+      g_strfreev (job->filenames);
+      g_free (job);
+
+      g_mutex_lock (&writer->mutex);
+      g_queue_pop_head (&writer->jobs);
+      g_cond_broadcast (&writer->cond);
+    }
+
+  g_mutex_unlock (&writer->mutex);
+
+  return NULL;
+}
+
+SheetWriter *
+sheet_writer_new (SheetOutput output,
+                  gint        resolution,
+                  guint       depth)
+{
+  SheetWriter *writer = g_new0 (SheetWriter, 1);
+
+  g_mutex_init (&writer->mutex);
+  g_cond_init (&writer->cond);
+  g_queue_init (&writer->jobs);
+
+  writer->output     = output;
+  writer->depth      = depth;
+  writer->resolution = resolution;
+  writer->tiers      = g_array_new (FALSE, FALSE, sizeof (SheetTier));
+
+  writer->thread = g_thread_new ("contactsheet-writer", sheet_writer_thread, writer);
+
+  return writer;
+}
+
+/* Also writes every sheet at resolution, shrunk with filter. Tiers are
+ * added before the first push, in the order their filenames are given. */
+void
+sheet_writer_add_tier (SheetWriter    *writer,
+                       gint            resolution,
+                       ResampleFilter  filter)
+{
+  SheetTier tier = { resolution, filter };
+
+  g_return_if_fail (resolution > 0);
+
+  g_array_append_val (writer->tiers, tier);
+}
+
+/* Hands job to the writer thread, then waits until the writer holds no
+ * more than its depth */
+static void
+sheet_writer_queue (SheetWriter *writer,
+                    SheetJob    *job)
+{
+  g_mutex_lock (&writer->mutex);
+
+  g_queue_push_tail (&writer->jobs, job);
+  g_cond_broadcast (&writer->cond);
+
+  while (g_queue_get_length (&writer->jobs) > writer->depth)
+    g_cond_wait (&writer->cond, &writer->mutex);
+
+  g_mutex_unlock (&writer->mutex);
+}
+
+/* Queues pixbuf to be saved as filename, taking over the reference. Blocks
+ * until the writer holds no more than its depth. No tiers are written. */
+void
+sheet_writer_push (SheetWriter *writer,
+                   GdkPixbuf   *pixbuf,
+                   const gchar *filename)
+{
+  const gchar *filenames[] = { filename, NULL };
+
+  sheet_writer_push_tiers (writer, pixbuf, filenames);
+}
+
+/* Like sheet_writer_push (), with filenames holding the full resolution
+ * file and then one per tier, NULL-terminated. */
+void
+sheet_writer_push_tiers (SheetWriter         *writer,
+                         GdkPixbuf           *pixbuf,
+                         const gchar * const *filenames)
+{
+  SheetJob *job = g_new0 (SheetJob, 1);
+
+  job->pixbuf    = pixbuf;
+  job->filenames = g_strdupv ((gchar **) filenames);
+
+  sheet_writer_queue (writer, job);
+}
+
+/* Starts a sheet of width x height that is handed over in bands, top to
+ * bottom, rather than whole. filenames are as for sheet_writer_push_tiers ().
+ * Each file is written as the bands arrive, so only the queued bands and
+ * the encoders' own rows are ever held. Only PNG, JPEG and TIFF stream. */
+SheetStream *
+sheet_writer_begin_stream (SheetWriter         *writer,
+                           const gchar * const *filenames,
+                           gint                 width,
+                           gint                 height)
+{
+  SheetStream *stream;
+
+  g_return_val_if_fail (writer->output == SHEET_OUTPUT_PNG  ||
+                        writer->output == SHEET_OUTPUT_JPEG ||
+                        writer->output == SHEET_OUTPUT_TIFF, NULL);
+
+  stream = g_new0 (SheetStream, 1);
+  stream->writer    = writer;
+  stream->filenames = g_strdupv ((gchar **) filenames);
+  stream->width     = width;
+  stream->height    = height;
+
+  return stream;
+}
+
+/* Queues the top n_rows rows of band, an RGB pixbuf as wide as the sheet,
+ * as the next rows of the sheet. Takes a reference of its own and blocks
+ * like sheet_writer_push (). */
+void
+sheet_stream_push_band (SheetStream *stream,
+                        GdkPixbuf   *band,
+                        gint         n_rows)
+{
+  SheetJob *job = g_new0 (SheetJob, 1);
+
+  g_return_if_fail (gdk_pixbuf_get_width (band) == stream->width);
+  g_return_if_fail (gdk_pixbuf_get_n_channels (band) == 3);
+
+  job->pixbuf = g_object_ref (band);
+  job->stream = stream;
+  job->n_rows = MIN (n_rows, gdk_pixbuf_get_height (band));
+
+  sheet_writer_queue (stream->writer, job);
+}
+
+/* Ends the sheet once its bands are written and frees stream. A sheet
+ * given fewer rows than its height counts as failed and is removed. */
+void
+sheet_stream_end (SheetStream *stream)
+{
+  SheetJob *job = g_new0 (SheetJob, 1);
+
+  job->stream = stream;
+
+  sheet_writer_queue (stream->writer, job);
+}
+
+/* Waits for every queued sheet to be written, returns how many failed */
+guint
+sheet_writer_free (SheetWriter *writer)
+{
+  guint failed;
+
+  g_mutex_lock (&writer->mutex);
+  writer->closing = TRUE;
+  g_cond_broadcast (&writer->cond);
+  g_mutex_unlock (&writer->mutex);
+
+  g_thread_join (writer->thread);
+
+  failed = writer->failed;
+
+  g_array_free (writer->tiers, TRUE);
+  g_cond_clear (&writer->cond);
+  g_mutex_clear (&writer->mutex);
+  g_free (writer);
+
+  return failed;
+}
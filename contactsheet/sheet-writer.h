@@ -0,0 +1,86 @@
+/* GIMP - The GNU Image Manipulation Program
+ * Copyright (C) 2023 Samuel Oldham
+ * Contact sheet plug-in (C) 2023 Samuel Oldham
+ * e-mail: so9010sami@gmail.com
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#ifndef __CONTACTSHEET_SHEET_WRITER_H__
+#define __CONTACTSHEET_SHEET_WRITER_H__
+
+#include <glib.h>
+#include <gdk-pixbuf/gdk-pixbuf.h>
+
+#include "resample.h"
+
+/* Where finished sheets go */
+typedef enum
+{
+  SHEET_OUTPUT_DISPLAY,           /* Left open in GIMP */
+  SHEET_OUTPUT_PNG,
+  SHEET_OUTPUT_JPEG,
+  SHEET_OUTPUT_TIFF,
+  SHEET_OUTPUT_PDF                /* Every sheet a page of one vector document,
+                                   * drawn through sheet_new_for_cairo () */
+} SheetOutput;
+
+/* Encodes finished sheets to disk on a thread of its own, so the next
+ * sheet can be composed meanwhile. At most depth sheets are held, counting
+ * the one being written; pushing more blocks, which keeps memory flat. A
+ * depth of 0 writes each sheet before the push returns.
+ *
+ * Tiers are lower resolutions every sheet is also written at. They are
+ * shrunk from the full sheet on the writer thread, so the images are
+ * only decoded and composed once however many are wanted. */
+typedef struct _SheetWriter SheetWriter;
+
+/* A sheet too big to hold whole, handed to the writer in bands */
+typedef struct _SheetStream SheetStream;
+
+/* Sheets held when memory is not tight */
+#define SHEET_WRITER_DEPTH  2
+
+SheetWriter *sheet_writer_new       (SheetOutput  output,
+                                     gint         resolution,
+                                     guint        depth);
+
+void         sheet_writer_add_tier  (SheetWriter    *writer,
+                                     gint            resolution,
+                                     ResampleFilter  filter);
+
+const gchar *sheet_writer_extension (SheetOutput  output);
+
+void         sheet_writer_push      (SheetWriter *writer,
+                                     GdkPixbuf   *pixbuf,
+                                     const gchar *filename);
+
+void         sheet_writer_push_tiers (SheetWriter         *writer,
+                                      GdkPixbuf           *pixbuf,
+                                      const gchar * const *filenames);
+
+SheetStream *sheet_writer_begin_stream (SheetWriter         *writer,
+                                        const gchar * const *filenames,
+                                        gint                 width,
+                                        gint                 height);
+
+void         sheet_stream_push_band (SheetStream *stream,
+                                     GdkPixbuf   *band,
+                                     gint         n_rows);
+
+void         sheet_stream_end       (SheetStream *stream);
+
+guint        sheet_writer_free      (SheetWriter *writer);
+
+#endif /* __CONTACTSHEET_SHEET_WRITER_H__ */
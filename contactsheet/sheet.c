@@ -0,0 +1,373 @@
+/* GIMP - The GNU Image Manipulation Program
+ * Copyright (C) 2023 Samuel Oldham
+ * Contact sheet plug-in (C) 2023 Samuel Oldham
+ * e-mail: so9010sami@gmail.com
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Direct compositing. Each cell is put together in a small cairo surface,
+ * thumbnail and caption, and written into the sheet's buffer in one go.
+ * Captions share one Pango layout for the whole run.
+ */
+
+#include <pango/pangocairo.h>
+
+#include "sheet.h"
+
+struct _SheetText
+{
+  PangoContext         *context;
+  PangoLayout          *layout;
+  PangoFontDescription *font;
+};
+
+struct _Sheet
+{
+  GeglBuffer           *buffer;           /* Either a GIMP layer's buffer */
+  GdkPixbuf            *pixbuf;           /* or a sheet kept in memory */
+  cairo_t              *cr;               /* or a page of a document */
+  gboolean              page_started;     /* The page's background is painted */
+  const Babl           *format;
+  SheetStyle            style;
+  SheetText            *text;
+};
+
+SheetText *
+sheet_text_new (const SheetStyle *style)
+{
+  SheetText *text = g_new0 (SheetText, 1);
+
+  text->context = pango_font_map_create_context (pango_cairo_font_map_get_default ());
+  text->layout  = pango_layout_new (text->context);
+
+  text->font = pango_font_description_from_string (style->fontname);
+  pango_font_description_set_absolute_size (text->font,
+                                            style->caption_size * PANGO_SCALE);
+
+  pango_layout_set_font_description (text->layout, text->font);
+  pango_layout_set_alignment (text->layout, PANGO_ALIGN_CENTER);
+  pango_layout_set_ellipsize (text->layout, PANGO_ELLIPSIZE_END);
+
+  return text;
+}
+
+/* Height of one line of caption, in pixels */
+gint
+sheet_text_get_height (SheetText *text)
+{
+  gint height;
+
+  pango_layout_set_width (text->layout, -1);
+  pango_layout_set_text (text->layout, "Ag", -1);
+  pango_layout_get_pixel_size (text->layout, NULL, &height);
+
+  return height;
+}
+
+void
+sheet_text_free (SheetText *text)
+{
+  g_object_unref (text->layout);
+  g_object_unref (text->context);
+  pango_font_description_free (text->font);
+  g_free (text);
+}
+
+static Sheet *
+sheet_alloc (const SheetStyle *style,
+             SheetText        *text)
+{
+  Sheet *sheet = g_new0 (Sheet, 1);
+
+  sheet->style = *style;
+  sheet->text  = text;
+
+  return sheet;
+}
+
+Sheet *
+sheet_new (GeglBuffer       *buffer,
+           const SheetStyle *style,
+           SheetText        *text)
+{
+  Sheet *sheet = sheet_alloc (style, text);
+
+  sheet->buffer = g_object_ref (buffer);
+  sheet->format = babl_format ("cairo-RGB24");
+
+  return sheet;
+}
+
+Sheet *
+sheet_new_for_pixbuf (GdkPixbuf        *pixbuf,
+                      const SheetStyle *style,
+                      SheetText        *text)
+{
+  Sheet *sheet = sheet_alloc (style, text);
+
+  sheet->pixbuf = g_object_ref (pixbuf);
+
+  gdk_pixbuf_fill (pixbuf,
+                   ((guint32) style->background[0] << 24) |
+                   ((guint32) style->background[1] << 16) |
+                   ((guint32) style->background[2] << 8) | 0xff);
+
+  return sheet;
+}
+
+Sheet *
+sheet_new_for_cairo (cairo_t          *cr,
+                     const SheetStyle *style,
+                     SheetText        *text)
+{
+  Sheet *sheet = sheet_alloc (style, text);
+
+  sheet->cr = cairo_reference (cr);
+
+  return sheet;
+}
+
+/* Copies the finished cell surface into the in-memory sheet at x, y */
+static void
+sheet_put_surface (GdkPixbuf       *pixbuf,
+                   cairo_surface_t *surface,
+                   gint             x,
+                   gint             y)
+{
+  const guchar *src_pixels = cairo_image_surface_get_data (surface);
+  gint          src_stride = cairo_image_surface_get_stride (surface);
+  guchar       *dst_pixels = gdk_pixbuf_get_pixels (pixbuf);
+  gint          dst_stride = gdk_pixbuf_get_rowstride (pixbuf);
+  gint          n_channels = gdk_pixbuf_get_n_channels (pixbuf);
+  gint          width      = MIN (cairo_image_surface_get_width (surface),
+                                  gdk_pixbuf_get_width (pixbuf) - x);
+  gint          height     = MIN (cairo_image_surface_get_height (surface),
+                                  gdk_pixbuf_get_height (pixbuf) - y);
+  gint          row;
+  gint          col;
+
+  for (row = 0; row < height; row++)
+    {
+      const guint32 *src = (const guint32 *) (src_pixels + (gsize) row * src_stride);
+      guchar        *dst = dst_pixels + (gsize) (y + row) * dst_stride + (gsize) x * n_channels;
+
+      for (col = 0; col < width; col++, dst += n_channels)
+        {
+          dst[0] = (src[col] >> 16) & 0xff;
+          dst[1] = (src[col] >> 8) & 0xff;
+          dst[2] = src[col] & 0xff;
+        }
+    }
+}
+
+/* Copies thumb into the cell surface at x, y, blending any alpha over the
+ * background colour */
+static void
+sheet_blit_pixbuf (cairo_surface_t  *surface,
+                   GdkPixbuf        *thumb,
+                   gint              x,
+                   gint              y,
+                   const SheetStyle *style)
+{
+  guchar       *dst_pixels = cairo_image_surface_get_data (surface);
+  gint          dst_stride = cairo_image_surface_get_stride (surface);
+  gint          dst_width  = cairo_image_surface_get_width (surface);
+  gint          dst_height = cairo_image_surface_get_height (surface);
+  const guchar *src_pixels = gdk_pixbuf_get_pixels (thumb);
+  gint          src_stride = gdk_pixbuf_get_rowstride (thumb);
+  gint          n_channels = gdk_pixbuf_get_n_channels (thumb);
+  gboolean      has_alpha  = gdk_pixbuf_get_has_alpha (thumb);
+  gint          width      = MIN (gdk_pixbuf_get_width (thumb), dst_width - x);
+  gint          height     = MIN (gdk_pixbuf_get_height (thumb), dst_height - y);
+  gint          row;
+  gint          col;
+
+  cairo_surface_flush (surface);
+
+  for (row = 0; row < height; row++)
+    {
+      const guchar *src = src_pixels + (gsize) row * src_stride;
+      guint32      *dst = (guint32 *) (dst_pixels + (gsize) (y + row) * dst_stride) + x;
+
+      for (col = 0; col < width; col++, src += n_channels)
+        {
+          guint r = src[0];
+          guint g = src[1];
+          guint b = src[2];
+
+          if (has_alpha && src[3] != 255)
+            {
+              guint a = src[3];
+
+              r = (r * a + style->background[0] * (255 - a) + 127) / 255;
+              g = (g * a + style->background[1] * (255 - a) + 127) / 255;
+              b = (b * a + style->background[2] * (255 - a) + 127) / 255;
+            }
+
+          dst[col] = 0xff000000 | (r << 16) | (g << 8) | b;
+        }
+    }
+
+  cairo_surface_mark_dirty (surface);
+}
+
+/* Draws the caption centred across the cell, under the thumbnail. The
+ * layout is the run's, only its text and width change between cells. */
+static void
+sheet_draw_caption (Sheet       *sheet,
+                    cairo_t     *cr,
+                    gint         cell_width,
+                    gint         thumb_height,
+                    const gchar *caption)
+{
+  PangoLayout *layout;
+
+  // Runs without captions have no text to lay them out with
+  if (sheet->text == NULL || caption == NULL || caption[0] == '\0')
+    return;
+
+  layout = sheet->text->layout;
+
+  pango_cairo_update_layout (cr, layout);
+  pango_layout_set_width (layout, cell_width * PANGO_SCALE);
+  pango_layout_set_text (layout, caption, -1);
+
+  cairo_set_source_rgb (cr,
+                        sheet->style.foreground[0] / 255.0,
+                        sheet->style.foreground[1] / 255.0,
+                        sheet->style.foreground[2] / 255.0);
+  cairo_move_to (cr, 0, thumb_height);
+  pango_cairo_show_layout (cr, layout);
+}
+
+/* Draws a cell onto a document page. The thumbnail goes in as an image of
+ * its own, at the size it was decoded to, and the caption as text. */
+static void
+sheet_draw_vector_cell (Sheet       *sheet,
+                        gint         x,
+                        gint         y,
+                        gint         cell_width,
+                        gint         cell_height,
+                        GdkPixbuf   *thumb,
+                        const gchar *caption)
+{
+  cairo_t *cr           = sheet->cr;
+  gint     thumb_height = 0;
+
+  // Painted with the first cell, so a sheet nothing lands on leaves no page
+  if (! sheet->page_started)
+    {
+      cairo_set_source_rgb (cr,
+                            sheet->style.background[0] / 255.0,
+                            sheet->style.background[1] / 255.0,
+                            sheet->style.background[2] / 255.0);
+      cairo_paint (cr);
+      sheet->page_started = TRUE;
+    }
+
+  cairo_save (cr);
+  cairo_translate (cr, x, y);
+  cairo_rectangle (cr, 0, 0, cell_width, cell_height);
+  cairo_clip (cr);
+
+  if (thumb != NULL)
+    {
+      cairo_surface_t *image;
+      gint             thumb_width = gdk_pixbuf_get_width (thumb);
+
+      thumb_height = gdk_pixbuf_get_height (thumb);
+
+      image = cairo_image_surface_create (CAIRO_FORMAT_RGB24, thumb_width, thumb_height);
+      sheet_blit_pixbuf (image, thumb, 0, 0, &sheet->style);
+
+      cairo_set_source_surface (cr, image, MAX ((cell_width - thumb_width) / 2, 0), 0);
+      cairo_paint (cr);
+      cairo_surface_destroy (image);
+    }
+
+  sheet_draw_caption (sheet, cr, cell_width, thumb_height, caption);
+
+  cairo_restore (cr);
+}
+
+/* Composes one cell, thumbnail centred along the top and the caption
+ * centred under it, and writes it into the sheet at x, y */
+void
+sheet_add_cell (Sheet       *sheet,
+                gint         x,
+                gint         y,
+                gint         cell_width,
+                gint         cell_height,
+                GdkPixbuf   *thumb,
+                const gchar *caption)
+{
+  cairo_surface_t *surface;
+  cairo_t         *cr;
+  gint             thumb_height = 0;
+
+  if (sheet->cr != NULL)
+    {
+      sheet_draw_vector_cell (sheet, x, y, cell_width, cell_height, thumb, caption);
+      return;
+    }
+
+  surface = cairo_image_surface_create (CAIRO_FORMAT_RGB24, cell_width, cell_height);
+  cr = cairo_create (surface);
+
+  cairo_set_source_rgb (cr,
+                        sheet->style.background[0] / 255.0,
+                        sheet->style.background[1] / 255.0,
+                        sheet->style.background[2] / 255.0);
+  cairo_paint (cr);
+
+  if (thumb != NULL)
+    {
+      thumb_height = gdk_pixbuf_get_height (thumb);
+
+      sheet_blit_pixbuf (surface, thumb,
+                         MAX ((cell_width - gdk_pixbuf_get_width (thumb)) / 2, 0), 0,
+                         &sheet->style);
+    }
+
+  sheet_draw_caption (sheet, cr, cell_width, thumb_height, caption);
+
+  cairo_destroy (cr);
+  cairo_surface_flush (surface);
+
+  if (sheet->buffer != NULL)
+    gegl_buffer_set (sheet->buffer,
+                     GEGL_RECTANGLE (x, y, cell_width, cell_height), 0,
+                     sheet->format,
+                     cairo_image_surface_get_data (surface),
+                     cairo_image_surface_get_stride (surface));
+  else
+    sheet_put_surface (sheet->pixbuf, surface, x, y);
+
+  cairo_surface_destroy (surface);
+}
+
+void
+sheet_free (Sheet *sheet)
+{
+  if (sheet->buffer != NULL)
+    {
+      gegl_buffer_flush (sheet->buffer);
+      g_object_unref (sheet->buffer);
+    }
+  g_clear_object (&sheet->pixbuf);
+  g_clear_pointer (&sheet->cr, cairo_destroy);
+  g_free (sheet);
+}
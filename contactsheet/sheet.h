@@ -0,0 +1,80 @@
+/* GIMP - The GNU Image Manipulation Program
+ * Copyright (C) 2023 Samuel Oldham
+ * Contact sheet plug-in (C) 2023 Samuel Oldham
+ * e-mail: so9010sami@gmail.com
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#ifndef __CONTACTSHEET_SHEET_H__
+#define __CONTACTSHEET_SHEET_H__
+
+#include <glib.h>
+#include <gdk-pixbuf/gdk-pixbuf.h>
+#include <gegl.h>
+#include <cairo.h>
+
+/* How the cells of a sheet look */
+typedef struct
+{
+  const gchar *fontname;          /* Caption font, as a Pango description */
+  gdouble      caption_size;      /* Caption size in pixels */
+  guchar       foreground[3];     /* Caption colour */
+  guchar       background[3];     /* Sheet colour */
+} SheetStyle;
+
+/* Caption layout kept for a whole run, so the font is loaded once and
+ * every sheet reuses the same Pango context */
+typedef struct _SheetText SheetText;
+
+SheetText *sheet_text_new  (const SheetStyle *style);
+
+gint       sheet_text_get_height
+                           (SheetText        *text);
+
+void       sheet_text_free (SheetText        *text);
+
+/* A sheet being composed straight into the pixels of one buffer, without
+ * a layer per cell */
+typedef struct _Sheet Sheet;
+
+Sheet *sheet_new      (GeglBuffer       *buffer,
+                       const SheetStyle *style,
+                       SheetText        *text);
+
+/* Same, into an RGB pixbuf that never becomes a GIMP image, for sheets
+ * that only go to disk */
+Sheet *sheet_new_for_pixbuf
+                      (GdkPixbuf        *pixbuf,
+                       const SheetStyle *style,
+                       SheetText        *text);
+
+/* Same, drawn on the current page of cr, which is in sheet pixels. On a
+ * PDF surface thumbnails are embedded at cell size and captions stay text. */
+Sheet *sheet_new_for_cairo
+                      (cairo_t          *cr,
+                       const SheetStyle *style,
+                       SheetText        *text);
+
+void   sheet_add_cell (Sheet            *sheet,
+                       gint              x,
+                       gint              y,
+                       gint              cell_width,
+                       gint              cell_height,
+                       GdkPixbuf        *thumb,
+                       const gchar      *caption);
+
+void   sheet_free     (Sheet            *sheet);
+
+#endif /* __CONTACTSHEET_SHEET_H__ */
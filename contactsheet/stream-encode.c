@@ -0,0 +1,416 @@
+/* GIMP - The GNU Image Manipulation Program
+ * Copyright (C) 2023 Samuel Oldham
+ * Contact sheet plug-in (C) 2023 Samuel Oldham
+ * e-mail: so9010sami@gmail.com
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+/*
+ * Streaming PNG, JPEG and tiled TIFF encoders for sheets composed in bands.
+ */
+
+#include <errno.h>
+#include <stdio.h>
+#include <string.h>
+#include <setjmp.h>
+
+#include <glib/gstdio.h>
+#include <png.h>
+#include <jpeglib.h>
+#include <tiffio.h>
+
+#include "stream-encode.h"
+
+#define STREAM_TIFF_TILE   256
+
+/* Same quality the whole-sheet writer asks gdk-pixbuf for */
+#define STREAM_JPEG_QUALITY  92
+
+typedef struct
+{
+  struct jpeg_error_mgr pub;
+  jmp_buf               setjmp_buffer;
+} StreamJpegError;
+
+struct _StreamEncoder
+{
+  SheetOutput  output;
+  gchar       *filename;
+  gchar       *part;              /* Written to, renamed to filename when done */
+  gint         width;
+  gint         height;
+  gint         rows;              /* Written so far */
+  gboolean     failed;            /* Anything after this is dropped */
+
+  FILE        *fp;
+
+  png_structp  png;
+  png_infop    png_info;
+
+  struct jpeg_compress_struct jpeg;
+  StreamJpegError             jpeg_error;
+
+  TIFF        *tiff;
+  guchar      *tile_rows;         /* One row of tiles, filled before it is cut up */
+  guchar      *tile;
+  gint         tile_top;          /* Image row tile_rows starts at */
+  gint         tile_fill;         /* Rows of tile_rows filled */
+};
+
+static void
+stream_png_error (png_structp  png,
+                  png_const_charp message)
+{
+  g_printerr ("contactsheet: %s\n", message);
+  png_longjmp (png, 1);
+}
+
+static void
+stream_png_warning (png_structp     png,
+                    png_const_charp message)
+{
+}
+
+static void
+stream_jpeg_error_exit (j_common_ptr cinfo)
+{
+  StreamJpegError *err = (StreamJpegError *) cinfo->err;
+
+  (* cinfo->err->output_message) (cinfo);
+  longjmp (err->setjmp_buffer, 1);
+}
+
+static gboolean
+stream_encoder_begin_png (StreamEncoder *encoder,
+                          gint           resolution)
+{
+  png_uint_32 ppm = resolution / 0.0254 + 0.5;
+
+  encoder->png = png_create_write_struct (PNG_LIBPNG_VER_STRING, NULL,
+                                          stream_png_error, stream_png_warning);
+  if (encoder->png == NULL)
+    return FALSE;
+
+  encoder->png_info = png_create_info_struct (encoder->png);
+  if (encoder->png_info == NULL || setjmp (png_jmpbuf (encoder->png)))
+    return FALSE;
+
+  png_init_io (encoder->png, encoder->fp);
+  png_set_IHDR (encoder->png, encoder->png_info, encoder->width, encoder->height,
+                8, PNG_COLOR_TYPE_RGB, PNG_INTERLACE_NONE,
+                PNG_COMPRESSION_TYPE_DEFAULT, PNG_FILTER_TYPE_DEFAULT);
+  png_set_pHYs (encoder->png, encoder->png_info, ppm, ppm, PNG_RESOLUTION_METER);
+  png_write_info (encoder->png, encoder->png_info);
+
+  return TRUE;
+}
+
+static gboolean
+stream_encoder_begin_jpeg (StreamEncoder *encoder,
+                           gint           resolution)
+{
+  struct jpeg_compress_struct *cinfo = &encoder->jpeg;
+
+  cinfo->err = jpeg_std_error (&encoder->jpeg_error.pub);
+  encoder->jpeg_error.pub.error_exit = stream_jpeg_error_exit;
+
+  if (setjmp (encoder->jpeg_error.setjmp_buffer))
+    return FALSE;
+
+  jpeg_create_compress (cinfo);
+  jpeg_stdio_dest (cinfo, encoder->fp);
+
+  cinfo->image_width      = encoder->width;
+  cinfo->image_height     = encoder->height;
+  cinfo->input_components = 3;
+  cinfo->in_color_space   = JCS_RGB;
+
+  jpeg_set_defaults (cinfo);
+  jpeg_set_quality (cinfo, STREAM_JPEG_QUALITY, TRUE);
+
+  cinfo->density_unit = 1;        /* Dots per inch */
+  cinfo->X_density    = resolution;
+  cinfo->Y_density    = resolution;
+
+  jpeg_start_compress (cinfo, TRUE);
+
+  return TRUE;
+}
+
+static gboolean
+stream_encoder_begin_tiff (StreamEncoder *encoder,
+                           gint           resolution)
+{
+  guint64 bytes = (guint64) encoder->width * encoder->height * 3;
+
+  /* Classic TIFF offsets stop at 4 GB */
+  encoder->tiff = TIFFOpen (encoder->part, bytes > G_MAXUINT32 / 2 ? "w8" : "w");
+  if (encoder->tiff == NULL)
+    return FALSE;
+
+  TIFFSetField (encoder->tiff, TIFFTAG_IMAGEWIDTH, encoder->width);
+  TIFFSetField (encoder->tiff, TIFFTAG_IMAGELENGTH, encoder->height);
+  TIFFSetField (encoder->tiff, TIFFTAG_BITSPERSAMPLE, 8);
+  TIFFSetField (encoder->tiff, TIFFTAG_SAMPLESPERPIXEL, 3);
+  TIFFSetField (encoder->tiff, TIFFTAG_PHOTOMETRIC, PHOTOMETRIC_RGB);
+  TIFFSetField (encoder->tiff, TIFFTAG_PLANARCONFIG, PLANARCONFIG_CONTIG);
+  TIFFSetField (encoder->tiff, TIFFTAG_COMPRESSION, COMPRESSION_ADOBE_DEFLATE);
+  TIFFSetField (encoder->tiff, TIFFTAG_TILEWIDTH, STREAM_TIFF_TILE);
+  TIFFSetField (encoder->tiff, TIFFTAG_TILELENGTH, STREAM_TIFF_TILE);
+  TIFFSetField (encoder->tiff, TIFFTAG_RESOLUTIONUNIT, RESUNIT_INCH);
+  TIFFSetField (encoder->tiff, TIFFTAG_XRESOLUTION, (gfloat) resolution);
+  TIFFSetField (encoder->tiff, TIFFTAG_YRESOLUTION, (gfloat) resolution);
+
+  encoder->tile_rows = g_try_malloc ((gsize) encoder->width * 3 * STREAM_TIFF_TILE);
+  encoder->tile      = g_try_malloc (STREAM_TIFF_TILE * STREAM_TIFF_TILE * 3);
+
+  return encoder->tile_rows != NULL && encoder->tile != NULL;
+}
+
+/* Opens filename for a width by height image. Like the whole-sheet
+ * writer it writes filename.part and only renames it into place once the
+ * last row is out, so an interrupted sheet never appears under the real
+ * name. Failures are reported and remembered, the rows are then dropped
+ * and stream_encoder_finish () returns FALSE. */
+StreamEncoder *
+stream_encoder_new (SheetOutput  output,
+                    const gchar *filename,
+                    gint         width,
+                    gint         height,
+                    gint         resolution)
+{
+  StreamEncoder *encoder = g_new0 (StreamEncoder, 1);
+  gboolean       begun;
+
+  encoder->output   = output;
+  encoder->filename = g_strdup (filename);
+  encoder->part     = g_strconcat (filename, ".part", NULL);
+  encoder->width    = width;
+  encoder->height   = height;
+
+  if (output == SHEET_OUTPUT_TIFF)
+    {
+      begun = stream_encoder_begin_tiff (encoder, resolution);
+    }
+  else
+    {
+      encoder->fp = g_fopen (encoder->part, "wb");
+      if (encoder->fp == NULL)
+        begun = FALSE;
+      else if (output == SHEET_OUTPUT_JPEG)
+        begun = stream_encoder_begin_jpeg (encoder, resolution);
+      else
+        begun = stream_encoder_begin_png (encoder, resolution);
+    }
+
+  if (! begun)
+    {
+      g_printerr ("contactsheet: could not write %s\n", filename);
+      encoder->failed = TRUE;
+    }
+
+  return encoder;
+}
+
+/* Cuts the filled part of tile_rows into tiles, the image's bottom edge
+ * padded with the last row */
+static gboolean
+stream_encoder_flush_tiles (StreamEncoder *encoder)
+{
+  gsize row_bytes = (gsize) encoder->width * 3;
+  gint  x;
+  gint  y;
+
+  for (y = encoder->tile_fill; y < STREAM_TIFF_TILE; y++)
+    memcpy (encoder->tile_rows + y * row_bytes,
+            encoder->tile_rows + (encoder->tile_fill - 1) * row_bytes, row_bytes);
+
+  for (x = 0; x < encoder->width; x += STREAM_TIFF_TILE)
+    {
+      gint n = MIN (STREAM_TIFF_TILE, encoder->width - x);
+
+      memset (encoder->tile, 0, STREAM_TIFF_TILE * STREAM_TIFF_TILE * 3);
+      for (y = 0; y < STREAM_TIFF_TILE; y++)
+        memcpy (encoder->tile + y * STREAM_TIFF_TILE * 3,
+                encoder->tile_rows + y * row_bytes + (gsize) x * 3, (gsize) n * 3);
+
+      if (TIFFWriteTile (encoder->tiff, encoder->tile, x, encoder->tile_top, 0, 0) < 0)
+        return FALSE;
+    }
+
+  encoder->tile_top += STREAM_TIFF_TILE;
+  encoder->tile_fill = 0;
+
+  return TRUE;
+}
+
+static gboolean
+stream_encoder_write_png (StreamEncoder *encoder,
+                          const guchar  *pixels,
+                          gint           n_rows,
+                          gint           stride)
+{
+  gint y;
+
+  if (setjmp (png_jmpbuf (encoder->png)))
+    return FALSE;
+
+  for (y = 0; y < n_rows; y++)
+    png_write_row (encoder->png, pixels + (gsize) y * stride);
+
+  return TRUE;
+}
+
+static gboolean
+stream_encoder_write_jpeg (StreamEncoder *encoder,
+                           const guchar  *pixels,
+                           gint           n_rows,
+                           gint           stride)
+{
+  gint y;
+
+  if (setjmp (encoder->jpeg_error.setjmp_buffer))
+    return FALSE;
+
+  for (y = 0; y < n_rows; y++)
+    {
+      JSAMPROW row = (JSAMPROW) (pixels + (gsize) y * stride);
+
+      jpeg_write_scanlines (&encoder->jpeg, &row, 1);
+    }
+
+  return TRUE;
+}
+
+static gboolean
+stream_encoder_write_tiff (StreamEncoder *encoder,
+                           const guchar  *pixels,
+                           gint           n_rows,
+                           gint           stride)
+{
+  gsize row_bytes = (gsize) encoder->width * 3;
+  gint  y;
+
+  for (y = 0; y < n_rows; y++)
+    {
+      memcpy (encoder->tile_rows + encoder->tile_fill++ * row_bytes,
+              pixels + (gsize) y * stride, row_bytes);
+
+      if (encoder->tile_fill == STREAM_TIFF_TILE &&
+          ! stream_encoder_flush_tiles (encoder))
+        return FALSE;
+    }
+
+  return TRUE;
+}
+
+/* Appends the next n_rows rows, stride bytes apart, of packed RGB */
+void
+stream_encoder_write (StreamEncoder *encoder,
+                      const guchar  *pixels,
+                      gint           n_rows,
+                      gint           stride)
+{
+  gboolean written;
+
+  n_rows = MIN (n_rows, encoder->height - encoder->rows);
+  if (encoder->failed || n_rows <= 0)
+    return;
+
+  switch (encoder->output)
+    {
+    case SHEET_OUTPUT_JPEG:
+      written = stream_encoder_write_jpeg (encoder, pixels, n_rows, stride);
+      break;
+
+    case SHEET_OUTPUT_TIFF:
+      written = stream_encoder_write_tiff (encoder, pixels, n_rows, stride);
+      break;
+
+    default:
+      written = stream_encoder_write_png (encoder, pixels, n_rows, stride);
+      break;
+    }
+
+  encoder->rows += n_rows;
+
+  if (! written)
+    {
+      g_printerr ("contactsheet: could not write %s\n", encoder->filename);
+      encoder->failed = TRUE;
+    }
+}
+
+/* Ends the file and frees encoder. Returns FALSE if anything failed or
+ * fewer rows than the height were written. */
+gboolean
+stream_encoder_finish (StreamEncoder *encoder)
+{
+  gboolean saved = ! encoder->failed && encoder->rows == encoder->height;
+
+  switch (encoder->output)
+    {
+    case SHEET_OUTPUT_JPEG:
+      if (encoder->fp != NULL)
+        {
+          if (setjmp (encoder->jpeg_error.setjmp_buffer))
+            saved = FALSE;
+          else if (saved)
+            jpeg_finish_compress (&encoder->jpeg);
+
+          jpeg_destroy_compress (&encoder->jpeg);
+        }
+      break;
+
+    case SHEET_OUTPUT_TIFF:
+      if (saved && encoder->tile_fill > 0)
+        saved = stream_encoder_flush_tiles (encoder);
+      if (encoder->tiff != NULL)
+        TIFFClose (encoder->tiff);
+      g_free (encoder->tile_rows);
+      g_free (encoder->tile);
+      break;
+
+    default:
+      if (encoder->png != NULL)
+        {
+          if (setjmp (png_jmpbuf (encoder->png)))
+            saved = FALSE;
+          else if (saved)
+            png_write_end (encoder->png, encoder->png_info);
+
+          png_destroy_write_struct (&encoder->png, &encoder->png_info);
+        }
+      break;
+    }
+
+  if (encoder->fp != NULL && fclose (encoder->fp) != 0)
+    saved = FALSE;
+
+  if (saved && g_rename (encoder->part, encoder->filename) != 0)
+    {
+      g_printerr ("contactsheet: could not write %s: %s\n",
+                  encoder->filename, g_strerror (errno));
+      saved = FALSE;
+    }
+
+  if (! saved)
+    g_unlink (encoder->part);
+
+  g_free (encoder->filename);
+  g_free (encoder->part);
+  g_free (encoder);
+
+  return saved;
+}
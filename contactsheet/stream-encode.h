@@ -0,0 +1,44 @@
+/* GIMP - The GNU Image Manipulation Program
+ * Copyright (C) 2023 Samuel Oldham
+ * Contact sheet plug-in (C) 2023 Samuel Oldham
+ * e-mail: so9010sami@gmail.com
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+#ifndef __CONTACTSHEET_STREAM_ENCODE_H__
+#define __CONTACTSHEET_STREAM_ENCODE_H__
+
+#include <glib.h>
+
+#include "sheet-writer.h"
+
+/* Writes an 8-bit RGB image to disk a few rows at a time, top to bottom,
+ * so it never has to be held whole. PNG and JPEG go out row by row,
+ * TIFF in 256 pixel tiles, a row of tiles at a time. */
+typedef struct _StreamEncoder StreamEncoder;
+
+StreamEncoder *stream_encoder_new    (SheetOutput    output,
+                                      const gchar   *filename,
+                                      gint           width,
+                                      gint           height,
+                                      gint           resolution);
+
+void           stream_encoder_write  (StreamEncoder *encoder,
+                                      const guchar  *pixels,
+                                      gint           n_rows,
+                                      gint           stride);
+
+gboolean       stream_encoder_finish (StreamEncoder *encoder);
+
+#endif /* __CONTACTSHEET_STREAM_ENCODE_H__ */
@@ -0,0 +1,371 @@
+/* GIMP - The GNU Image Manipulation Program
+ * Copyright (C) 2023 Samuel Oldham
+ * Contact sheet plug-in (C) 2023 Samuel Oldham
+ * e-mail: so9010sami@gmail.com
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Persistent thumbnail cache, laid out like the freedesktop.org thumbnail
+ * spec (~/.cache/thumbnails/large, x-large and xx-large) so the file
+ * manager and the plug-in can share each others thumbnails. An entry is
+ * only used when the URI, mtime and size stored in it match the file.
+ */
+
+#include <fcntl.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+
+#include <glib/gstdio.h>
+
+#include "thumbnail-cache.h"
+
+/* Stored in every thumbnail the plug-in writes, so it only ever trims its
+ * own out of directories every other application shares */
+#define THUMB_CACHE_SOFTWARE "GIMP contact sheet plug-in"
+
+typedef struct
+{
+  gint         size;              /* Longest side of the thumbnails */
+  const gchar *name;              /* Directory under thumbnails/ */
+} ThumbCacheBucket;
+
+static const ThumbCacheBucket buckets[] =
+{
+  {  256, "large"    },
+  {  512, "x-large"  },
+  { 1024, "xx-large" },
+};
+
+typedef struct
+{
+  gchar   *path;
+  goffset  size;
+  gint64   used;
+} ThumbCacheEntry;
+
+static const gchar *
+thumb_cache_bucket_name (gint size)
+{
+  guint i;
+
+  for (i = 0; i < G_N_ELEMENTS (buckets); i++)
+    if (buckets[i].size == size)
+      return buckets[i].name;
+
+  return NULL;
+}
+
+/* Smallest cache size that covers the box, 0 if the box is bigger than
+ * anything the spec stores */
+gint
+thumb_cache_size_for_box (gint box_width,
+                          gint box_height)
+{
+  gint  longest = MAX (box_width, box_height);
+  guint i;
+
+  for (i = 0; i < G_N_ELEMENTS (buckets); i++)
+    if (longest <= buckets[i].size)
+      return buckets[i].size;
+
+  return 0;
+}
+
+// Works out the spec URI and thumbnail path for file, and stats the original
+static gboolean
+thumb_cache_locate (const gchar  *file,
+                    gint          size,
+                    gchar       **uri,
+                    gchar       **path,
+                    GStatBuf     *st)
+{
+  const gchar *bucket = thumb_cache_bucket_name (size);
+  gchar       *absolute;
+  gchar       *md5;
+  gchar       *name;
+
+  if (bucket == NULL || g_stat (file, st) != 0)
+    return FALSE;
+
+  absolute = g_canonicalize_filename (file, NULL);
+  *uri = g_filename_to_uri (absolute, NULL, NULL);
+  g_free (absolute);
+
+  if (*uri == NULL)
+    return FALSE;
+
+  md5  = g_compute_checksum_for_string (G_CHECKSUM_MD5, *uri, -1);
+  name = g_strconcat (md5, ".png", NULL);
+  *path = g_build_filename (g_get_user_cache_dir (), "thumbnails", bucket, name, NULL);
+
+  g_free (name);
+  g_free (md5);
+
+  return TRUE;
+}
+
+/* Returns the cached thumbnail of file if there is a valid one. A hit
+ * touches the entry, which is what thumb_cache_trim orders on. */
+GdkPixbuf *
+thumb_cache_lookup (const gchar *file,
+                    gint         size)
+{
+  GdkPixbuf   *pixbuf = NULL;
+  GStatBuf     st;
+  gchar       *uri;
+  gchar       *path;
+  const gchar *value;
+  gboolean     valid;
+
+  if (! thumb_cache_locate (file, size, &uri, &path, &st))
+    return NULL;
+
+  pixbuf = gdk_pixbuf_new_from_file (path, NULL);
+
+  if (pixbuf != NULL)
+    {
+      valid = (g_strcmp0 (gdk_pixbuf_get_option (pixbuf, "tEXt::Thumb::URI"), uri) == 0);
+
+      value = gdk_pixbuf_get_option (pixbuf, "tEXt::Thumb::MTime");
+      if (value == NULL || g_ascii_strtoll (value, NULL, 10) != (gint64) st.st_mtime)
+        valid = FALSE;
+
+      /* Size is optional in the spec, but has to match when it is there */
+      value = gdk_pixbuf_get_option (pixbuf, "tEXt::Thumb::Size");
+      if (value != NULL && g_ascii_strtoll (value, NULL, 10) != (gint64) st.st_size)
+        valid = FALSE;
+
+      // Only the plug-in's own entries are ordered for trimming
+      if (! valid)
+        g_clear_object (&pixbuf);
+      else if (g_strcmp0 (gdk_pixbuf_get_option (pixbuf, "tEXt::Software"),
+                          THUMB_CACHE_SOFTWARE) == 0)
+        g_utime (path, NULL);
+    }
+
+  g_free (path);
+  g_free (uri);
+
+  return pixbuf;
+}
+
+/* Where the size thumbnail of file is, without reading it, when there
+ * is one written since file last changed. NULL otherwise. */
+gchar *
+thumb_cache_find (const gchar *file,
+                  gint         size)
+{
+  GStatBuf  st;
+  GStatBuf  cached;
+  gchar    *uri;
+  gchar    *path;
+
+  if (! thumb_cache_locate (file, size, &uri, &path, &st))
+    return NULL;
+
+  g_free (uri);
+
+  if (g_stat (path, &cached) != 0 || cached.st_mtime < st.st_mtime)
+    g_clear_pointer (&path, g_free);
+
+  return path;
+}
+
+/* Saves pixbuf as the size thumbnail of file. Written to a temporary file
+ * and renamed into place so readers never see half a PNG. */
+void
+thumb_cache_store (const gchar *file,
+                   gint         size,
+                   GdkPixbuf   *pixbuf,
+                   gint         src_width,
+                   gint         src_height)
+{
+  GStatBuf  st;
+  gchar    *uri;
+  gchar    *path;
+  gchar    *dir;
+  gchar    *tmp;
+  gchar     mtime[32];
+  gchar     file_size[32];
+  gchar     width[16];
+  gchar     height[16];
+  gint      fd;
+
+  if (! thumb_cache_locate (file, size, &uri, &path, &st))
+    return;
+
+  dir = g_path_get_dirname (path);
+  g_mkdir_with_parents (dir, 0700);
+
+  tmp = g_strconcat (path, ".XXXXXX", NULL);
+  fd  = g_mkstemp_full (tmp, O_WRONLY, 0600);
+
+  if (fd != -1)
+    {
+      close (fd);
+
+      g_snprintf (mtime, sizeof (mtime), "%" G_GINT64_FORMAT, (gint64) st.st_mtime);
+      g_snprintf (file_size, sizeof (file_size), "%" G_GINT64_FORMAT, (gint64) st.st_size);
+      g_snprintf (width, sizeof (width), "%d", src_width);
+      g_snprintf (height, sizeof (height), "%d", src_height);
+
+      if (! gdk_pixbuf_save (pixbuf, tmp, "png", NULL,
+                             "tEXt::Thumb::URI",           uri,
+                             "tEXt::Thumb::MTime",         mtime,
+                             "tEXt::Thumb::Size",          file_size,
+                             "tEXt::Thumb::Image::Width",  width,
+                             "tEXt::Thumb::Image::Height", height,
+                             "tEXt::Software",             THUMB_CACHE_SOFTWARE,
+                             NULL) ||
+          g_rename (tmp, path) != 0)
+        {
+          g_unlink (tmp);
+        }
+    }
+
+  g_free (tmp);
+  g_free (dir);
+  g_free (path);
+  g_free (uri);
+}
+
+static gint
+thumb_cache_entry_compare (gconstpointer a,
+                           gconstpointer b)
+{
+  const ThumbCacheEntry *entry_a = a;
+  const ThumbCacheEntry *entry_b = b;
+
+  return (entry_a->used > entry_b->used) - (entry_a->used < entry_b->used);
+}
+
+/* Whether the thumbnail at path was written by thumb_cache_store, from
+ * its Software text. Only the chunks ahead of the image data are read. */
+static gboolean
+thumb_cache_is_ours (const gchar *path)
+{
+  static const guchar signature[8] = { 0x89, 'P', 'N', 'G', '\r', '\n', 0x1a, '\n' };
+  static const gchar  software[]   = "Software\0" THUMB_CACHE_SOFTWARE;
+  FILE               *fp;
+  guchar              header[8];
+  gchar               text[sizeof (software)];
+  gboolean            ours = FALSE;
+
+  fp = g_fopen (path, "rb");
+  if (fp == NULL)
+    return FALSE;
+
+  if (fread (header, 1, 8, fp) == 8 && memcmp (header, signature, 8) == 0)
+    {
+      while (! ours && fread (header, 1, 8, fp) == 8)
+        {
+          guint32 length = ((guint32) header[0] << 24) | ((guint32) header[1] << 16) |
+                           ((guint32) header[2] << 8)  |  (guint32) header[3];
+
+          if (memcmp (header + 4, "IDAT", 4) == 0 || length > G_MAXINT32)
+            break;
+
+          if (memcmp (header + 4, "tEXt", 4) == 0 && length == sizeof (software) - 1)
+            {
+              if (fread (text, 1, length, fp) != length)
+                break;
+
+              ours   = memcmp (text, software, length) == 0;
+              length = 0;
+            }
+
+          // On past the data and its CRC
+          if (fseek (fp, (long) length + 4, SEEK_CUR) != 0)
+            break;
+        }
+    }
+
+  fclose (fp);
+
+  return ours;
+}
+
+/* Removes the least recently used of the plug-in's own thumbnails until
+ * they take up no more than max_size bytes. Other applications' entries
+ * in the same directories are left alone. */
+void
+thumb_cache_trim (guint64 max_size)
+{
+  GArray  *entries;
+  guint64  total = 0;
+  guint    b;
+  guint    i;
+
+  entries = g_array_new (FALSE, FALSE, sizeof (ThumbCacheEntry));
+
+  for (b = 0; b < G_N_ELEMENTS (buckets); b++)
+    {
+      gchar       *dir_path;
+      GDir        *dir;
+      const gchar *name;
+
+      dir_path = g_build_filename (g_get_user_cache_dir (), "thumbnails", buckets[b].name, NULL);
+      dir = g_dir_open (dir_path, 0, NULL);
+
+      while (dir != NULL && (name = g_dir_read_name (dir)) != NULL)
+        {
+          ThumbCacheEntry entry;
+          GStatBuf        st;
+
+          if (! g_str_has_suffix (name, ".png"))
+            continue;
+
+          entry.path = g_build_filename (dir_path, name, NULL);
+
+          if (g_stat (entry.path, &st) != 0 || ! thumb_cache_is_ours (entry.path))
+            {
+              g_free (entry.path);
+              continue;
+            }
+
+          entry.size = st.st_size;
+          entry.used = st.st_mtime;
+          total += entry.size;
+
+          g_array_append_val (entries, entry);
+        }
+
+      if (dir != NULL)
+        g_dir_close (dir);
+      g_free (dir_path);
+    }
+
+  if (total > max_size)
+    {
+      g_array_sort (entries, thumb_cache_entry_compare);
+
+      for (i = 0; i < entries->len && total > max_size; i++)
+        {
+          ThumbCacheEntry *entry = &g_array_index (entries, ThumbCacheEntry, i);
+
+          if (g_unlink (entry->path) == 0)
+            total -= entry->size;
+        }
+    }
+
+  for (i = 0; i < entries->len; i++)
+    g_free (g_array_index (entries, ThumbCacheEntry, i).path);
+
+  g_array_free (entries, TRUE);
+}
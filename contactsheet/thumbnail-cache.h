@@ -0,0 +1,47 @@
+/* GIMP - The GNU Image Manipulation Program
+ * Copyright (C) 2023 Samuel Oldham
+ * Contact sheet plug-in (C) 2023 Samuel Oldham
+ * e-mail: so9010sami@gmail.com
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#ifndef __CONTACTSHEET_THUMBNAIL_CACHE_H__
+#define __CONTACTSHEET_THUMBNAIL_CACHE_H__
+
+#include <glib.h>
+#include <gdk-pixbuf/gdk-pixbuf.h>
+
+/* Upper bound on what the plug-in's own thumbnails in the cache
+ * directories may take up after a run */
+#define THUMB_CACHE_MAX_SIZE   (G_GUINT64_CONSTANT (1024) << 20)
+
+gint       thumb_cache_size_for_box (gint         box_width,
+                                     gint         box_height);
+
+GdkPixbuf *thumb_cache_lookup       (const gchar *file,
+                                     gint         size);
+
+gchar     *thumb_cache_find         (const gchar *file,
+                                     gint         size);
+
+void       thumb_cache_store        (const gchar *file,
+                                     gint         size,
+                                     GdkPixbuf   *pixbuf,
+                                     gint         src_width,
+                                     gint         src_height);
+
+void       thumb_cache_trim         (guint64      max_size);
+
+#endif /* __CONTACTSHEET_THUMBNAIL_CACHE_H__ */
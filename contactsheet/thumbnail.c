@@ -0,0 +1,653 @@
+/* GIMP - The GNU Image Manipulation Program
+ * Copyright (C) 2023 Samuel Oldham
+ * Contact sheet plug-in (C) 2023 Samuel Oldham
+ * e-mail: so9010sami@gmail.com
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Worker pool that decodes and downscales the images of a contact sheet.
+ */
+
+#include <string.h>
+
+#include "color-profile.h"
+#include "jpeg-load.h"
+#include "raw-preview.h"
+#include "read-ahead.h"
+#include "thumbnail.h"
+#include "thumbnail-cache.h"
+#include "trace.h"
+
+/* How many files per worker are allowed to be decoded ahead of the one the
+ * main thread is waiting on. Keeps memory bounded on big folders. */
+#define THUMB_QUEUE_AHEAD   4
+
+/* Memory a worker needs while decoding a JPEG or a RAW's preview, in
+ * thumbnails. Scaled DCT decoding lands within twice the box on each
+ * side. Other formats are decoded whole first. */
+#define THUMB_DECODE_FACTOR 4
+
+/* How much smaller a thumbnail held as PNG is assumed to be */
+#define THUMB_PACK_RATIO    2
+
+/* How much of a RAW file is read ahead. Only its preview is decoded,
+ * which cameras put near the start, never the sensor data after it. */
+#define THUMB_RAW_AHEAD     (4 << 20)
+
+typedef struct
+{
+  GdkPixbuf *pixbuf;              /* Decoded thumbnail, NULL if the loader failed */
+  GBytes    *packed;              /* Or the thumbnail as PNG, when memory is tight */
+  gsize      bytes;               /* Memory held by either */
+  ExifInfo   exif;                /* Caption values, when there is an index */
+  gboolean   done;                /* Set by the worker once the slot is final */
+} ThumbSlot;
+
+struct _ThumbQueue
+{
+  GThreadPool *pool;
+  GMutex       mutex;
+  GCond        cond;
+
+  GPtrArray   *files;             /* Full paths, in sheet order */
+  ThumbSlot   *slots;             /* One per file */
+  guint        n_pushed;          /* Files handed to the pool so far */
+  guint        ahead;             /* Decode window, in files */
+  gsize        held;              /* Bytes of finished thumbnails not popped yet */
+  gsize        held_limit;        /* Past this they are packed, 0 for no budget */
+  gsize        decode_limit;      /* What the decodes in flight may take together, 0 for no budget */
+  gsize        decoding;          /* What those running now reserved */
+
+  ThumbTarget *targets;           /* One per file */
+  gboolean     use_cache;
+  ResampleFilter filter;
+
+  MetadataIndex *metadata;        /* NULL when no captions are wanted */
+  ReadAhead     *read_ahead;      /* NULL when the files are not read ahead */
+};
+
+/* Keeps a finished thumbnail as fast, lossless PNG until it is popped */
+static GBytes *
+thumb_pack (GdkPixbuf *pixbuf)
+{
+  gchar *data;
+  gsize  size;
+
+  if (! gdk_pixbuf_save_to_buffer (pixbuf, &data, &size, "png", NULL,
+                                   "compression", "1",
+                                   NULL))
+    return NULL;
+
+  return g_bytes_new_take (data, size);
+}
+
+static GdkPixbuf *
+thumb_unpack (GBytes *packed)
+{
+  GdkPixbufLoader *loader = gdk_pixbuf_loader_new_with_type ("png", NULL);
+  GdkPixbuf       *pixbuf = NULL;
+
+  if (gdk_pixbuf_loader_write (loader,
+                               g_bytes_get_data (packed, NULL),
+                               g_bytes_get_size (packed),
+                               NULL) &&
+      gdk_pixbuf_loader_close (loader, NULL))
+    pixbuf = g_object_ref (gdk_pixbuf_loader_get_pixbuf (loader));
+  else
+    gdk_pixbuf_loader_close (loader, NULL);
+
+  g_object_unref (loader);
+
+  return pixbuf;
+}
+
+/* Memory decoding the file at index takes, from the size its header
+ * gave. Only JPEGs and RAW previews are decoded scaled down, anything
+ * else, and a file whose header could not be read, is decoded whole. */
+static gsize
+thumb_queue_decode_bytes (ThumbQueue *queue,
+                          guint       index)
+{
+  const gchar       *file   = g_ptr_array_index (queue->files, index);
+  const ThumbTarget *target = &queue->targets[index];
+  gsize              thumb_bytes = (gsize) target->box_width * target->box_height * 4;
+
+  if (jpeg_is_jpeg (file) || raw_preview_is_raw (file))
+    return THUMB_DECODE_FACTOR * thumb_bytes;
+
+  if (target->src_width > 0 && target->src_height > 0)
+    return (gsize) target->src_width * target->src_height * 4 + thumb_bytes;
+
+  return queue->decode_limit;
+}
+
+static void
+thumb_queue_worker (gpointer data,
+                    gpointer user_data)
+{
+  ThumbQueue  *queue = user_data;
+  guint        index = GPOINTER_TO_UINT (data) - 1;
+  const gchar *file = g_ptr_array_index (queue->files, index);
+  GdkPixbuf   *pixbuf;
+  GBytes      *packed = NULL;
+  gsize        bytes = 0;
+  gsize        held;
+  ExifInfo     exif = { 0, };
+  gsize        reserved = 0;
+  gint64       start;
+
+  /* Waits until its decode fits beside those running. One that is too
+   * big for the whole share runs on its own. */
+  if (queue->decode_limit > 0)
+    {
+      reserved = MIN (thumb_queue_decode_bytes (queue, index), queue->decode_limit);
+
+      g_mutex_lock (&queue->mutex);
+      while (queue->decoding > 0 && queue->decoding + reserved > queue->decode_limit)
+        g_cond_wait (&queue->cond, &queue->mutex);
+      queue->decoding += reserved;
+      g_mutex_unlock (&queue->mutex);
+    }
+
+  if (queue->metadata != NULL)
+    {
+      start = TRACE_START ();
+      metadata_index_get (queue->metadata, file, &exif);
+      TRACE_END ("worker", "exif", start, file, 0, 0);
+    }
+
+  start = TRACE_START ();
+  pixbuf = thumbnail_load (file,
+                           &queue->targets[index],
+                           queue->use_cache,
+                           queue->filter);
+  TRACE_END ("worker", "thumbnail", start, file, trace_file_size (file), 0);
+
+  if (pixbuf != NULL)
+    bytes = (gsize) gdk_pixbuf_get_rowstride (pixbuf) * gdk_pixbuf_get_height (pixbuf);
+
+  /* Past the budget the thumbnail waits packed. Other workers may add
+   * theirs meanwhile, which only makes the limit approximate. */
+  g_mutex_lock (&queue->mutex);
+  held = queue->held;
+  g_mutex_unlock (&queue->mutex);
+
+  if (bytes > 0 && queue->held_limit > 0 && held + bytes > queue->held_limit)
+    {
+      start = TRACE_START ();
+      packed = thumb_pack (pixbuf);
+      if (packed != NULL)
+        {
+          g_clear_object (&pixbuf);
+          bytes = g_bytes_get_size (packed);
+        }
+      TRACE_END ("worker", "pack", start, file, bytes, 0);
+    }
+
+  g_mutex_lock (&queue->mutex);
+  queue->slots[index].pixbuf = pixbuf;
+  queue->slots[index].packed = packed;
+  queue->slots[index].bytes  = bytes;
+  queue->slots[index].exif   = exif;
+  queue->slots[index].done   = TRUE;
+  queue->held += bytes;
+  queue->decoding -= reserved;
+  g_cond_broadcast (&queue->cond);
+  g_mutex_unlock (&queue->mutex);
+}
+
+/* What the worker will read for the file at index: its cached thumbnail
+ * when there is one, otherwise the file, only the start of it for RAWs */
+static gchar *
+thumb_queue_read_path (guint     index,
+                       goffset  *length,
+                       gpointer  user_data)
+{
+  ThumbQueue        *queue  = user_data;
+  const gchar       *file   = g_ptr_array_index (queue->files, index);
+  const ThumbTarget *target = &queue->targets[index];
+
+  *length = 0;
+
+  if (queue->use_cache)
+    {
+      gint   cache_size = thumb_cache_size_for_box (target->box_width, target->box_height);
+      gchar *cached     = cache_size > 0 ? thumb_cache_find (file, cache_size) : NULL;
+
+      if (cached != NULL)
+        return cached;
+    }
+
+  if (raw_preview_is_raw (file))
+    *length = THUMB_RAW_AHEAD;
+
+  return g_strdup (file);
+}
+
+/* Hands files to the pool until the window reaches up to index */
+static void
+thumb_queue_fill (ThumbQueue *queue,
+                  guint       index)
+{
+  guint last = MIN (index + queue->ahead, queue->files->len);
+
+  read_ahead_advance (queue->read_ahead, last);
+
+  while (queue->n_pushed < last)
+    {
+      /* Offset by one so the first file is not pushed as NULL */
+      g_thread_pool_push (queue->pool,
+                          GUINT_TO_POINTER (queue->n_pushed + 1),
+                          NULL);
+      queue->n_pushed++;
+    }
+}
+
+/* Decodes files into thumbnails, each to its own entry of targets, which
+ * is copied. With a budget, in bytes, fewer workers run and fewer files
+ * are decoded ahead so decoding and waiting thumbnails stay within it,
+ * and thumbnails past it wait packed. Each decode first reserves what
+ * the file's size says it needs out of the decoders' share, and waits
+ * for room. A budget of 0 uses every core.
+ * The reads of the next read_ahead files past those being decoded are
+ * started early, 0 leaves each file to its worker. */
+ThumbQueue *
+thumb_queue_new (GPtrArray         *files,
+                 const ThumbTarget *targets,
+                 gboolean           use_cache,
+                 ResampleFilter     filter,
+                 MetadataIndex     *metadata,
+                 gsize              budget,
+                 guint              read_ahead)
+{
+  ThumbQueue *queue;
+  guint       n_threads = MAX (g_get_num_processors (), 1);
+  guint       ahead     = n_threads * THUMB_QUEUE_AHEAD;
+  guint       i;
+
+  queue = g_new0 (ThumbQueue, 1);
+
+  if (budget > 0)
+    {
+      gsize thumb_bytes = 1;
+      gsize decode_bytes;
+
+      /* Sized for the biggest thumbnail */
+      for (i = 0; i < files->len; i++)
+        thumb_bytes = MAX (thumb_bytes, (gsize) targets[i].box_width * targets[i].box_height * 4);
+
+      decode_bytes = THUMB_DECODE_FACTOR * thumb_bytes;
+
+      // Decoders get up to half, the rest holds what they finished
+      n_threads = CLAMP (budget / 2 / decode_bytes, 1, n_threads);
+
+      queue->decode_limit = n_threads * decode_bytes;
+      queue->held_limit   = budget > queue->decode_limit ?
+                            budget - queue->decode_limit : thumb_bytes;
+
+      ahead = CLAMP (queue->held_limit / (thumb_bytes / THUMB_PACK_RATIO + 1),
+                     n_threads, ahead);
+    }
+
+  g_mutex_init (&queue->mutex);
+  g_cond_init (&queue->cond);
+
+  queue->files      = files;
+  queue->slots      = g_new0 (ThumbSlot, MAX (files->len, 1));
+  queue->ahead      = ahead;
+  queue->targets    = g_new0 (ThumbTarget, MAX (files->len, 1));
+  queue->use_cache  = use_cache;
+  queue->filter     = filter;
+  queue->metadata   = metadata;
+
+  if (files->len > 0)
+    memcpy (queue->targets, targets, sizeof (ThumbTarget) * files->len);
+
+  queue->pool = g_thread_pool_new (thumb_queue_worker, queue,
+                                   n_threads, TRUE, NULL);
+  queue->read_ahead = read_ahead_new (files->len, read_ahead,
+                                      thumb_queue_read_path, queue);
+
+  thumb_queue_fill (queue, 0);
+
+  return queue;
+}
+
+/* Waits for the thumbnail of the file at index and takes ownership of it,
+ * exif gets the caption values read alongside it. Returns NULL when the
+ * file could not be decoded here, the caller should then fall back to
+ * loading it through GIMP. */
+GdkPixbuf *
+thumb_queue_pop (ThumbQueue *queue,
+                 guint       index,
+                 ExifInfo   *exif)
+{
+  GdkPixbuf *pixbuf;
+  GBytes    *packed;
+  gint64     start;
+
+  g_return_val_if_fail (index < queue->files->len, NULL);
+
+  thumb_queue_fill (queue, index + 1);
+
+  /* Time the main thread spends waiting on the workers */
+  start = TRACE_START ();
+  g_mutex_lock (&queue->mutex);
+  while (! queue->slots[index].done)
+    g_cond_wait (&queue->cond, &queue->mutex);
+  TRACE_END ("main", "wait", start, NULL, 0, 0);
+
+  pixbuf = queue->slots[index].pixbuf;
+  packed = queue->slots[index].packed;
+  queue->slots[index].pixbuf = NULL;
+  queue->slots[index].packed = NULL;
+  queue->held -= queue->slots[index].bytes;
+  queue->slots[index].bytes = 0;
+  if (exif != NULL)
+    *exif = queue->slots[index].exif;
+  g_mutex_unlock (&queue->mutex);
+
+  if (packed != NULL)
+    {
+      start = TRACE_START ();
+      pixbuf = thumb_unpack (packed);
+      TRACE_END ("main", "unpack", start, NULL, g_bytes_get_size (packed), 0);
+      g_bytes_unref (packed);
+    }
+
+  return pixbuf;
+}
+
+void
+thumb_queue_free (ThumbQueue *queue)
+{
+  guint i;
+
+  /* Let the running jobs finish, drop the ones not started yet */
+  read_ahead_free (queue->read_ahead);
+  g_thread_pool_free (queue->pool, TRUE, TRUE);
+
+  for (i = 0; i < queue->files->len; i++)
+    {
+      g_clear_object (&queue->slots[i].pixbuf);
+      g_clear_pointer (&queue->slots[i].packed, g_bytes_unref);
+    }
+
+  if (queue->use_cache)
+    thumb_cache_trim (THUMB_CACHE_MAX_SIZE);
+
+  g_free (queue->slots);
+  g_free (queue->targets);
+  g_cond_clear (&queue->cond);
+  g_mutex_clear (&queue->mutex);
+  g_free (queue);
+}
+
+// Same proportional fit for the workers and load_fallback, so both paths place images identically
+void
+thumbnail_fit (gint  src_width,
+               gint  src_height,
+               gint  box_width,
+               gint  box_height,
+               gint *width,
+               gint *height)
+{
+  gdouble aspect_ratio = (gdouble) box_width / src_width;
+
+  if ((src_height * aspect_ratio) > box_height)
+    {
+      aspect_ratio = (gdouble) box_height / src_height;
+
+      *width  = src_width * aspect_ratio;
+      *height = src_height * aspect_ratio;
+    }
+  else
+    {
+      *width  = box_width;
+      *height = src_height * aspect_ratio;
+    }
+
+  *width  = MAX (*width, 1);
+  *height = MAX (*height, 1);
+}
+
+typedef struct
+{
+  ThumbTarget    target;
+  gboolean       no_upscale;      /* Keep images smaller than the box as they are */
+  gboolean       turn;            /* Set when the image has to be turned a quarter */
+  gint           src_width;       /* Size of the image in the file */
+  gint           src_height;
+  gint           width;           /* Decode size worked out from the file */
+  gint           height;
+  ResampleFilter filter;          /* What shrinks the decoded image the rest of the way */
+} ThumbSize;
+
+/* Works out the size to decode at, as the pixels are stored, before they
+ * are turned upright or turned for rotate, from the size of the image in
+ * the file */
+static void
+thumbnail_size_func (gint      src_width,
+                     gint      src_height,
+                     gint     *width,
+                     gint     *height,
+                     gpointer  user_data)
+{
+  ThumbSize   *size   = user_data;
+  ThumbTarget *target = &size->target;
+  gboolean     swap   = target->orientation >= 5;
+  gint         upright_width  = swap ? src_height : src_width;
+  gint         upright_height = swap ? src_width  : src_height;
+  gint         fit_width;
+  gint         fit_height;
+
+  size->turn       = (target->rotate && upright_width < upright_height);
+  size->src_width  = src_width;
+  size->src_height = src_height;
+
+  if (target->width > 0 && target->height > 0)
+    {
+      /* The layout's size is the turned one */
+      fit_width  = size->turn ? target->height : target->width;
+      fit_height = size->turn ? target->width  : target->height;
+    }
+  else if (size->no_upscale &&
+           upright_width <= target->box_width && upright_height <= target->box_height)
+    {
+      fit_width  = upright_width;
+      fit_height = upright_height;
+    }
+  else if (size->turn)
+    {
+      /* Fit the turned image, then decode at the unturned size */
+      thumbnail_fit (upright_height, upright_width, target->box_width, target->box_height,
+                     &fit_height, &fit_width);
+    }
+  else
+    {
+      thumbnail_fit (upright_width, upright_height, target->box_width, target->box_height,
+                     &fit_width, &fit_height);
+    }
+
+  *width  = swap ? fit_height : fit_width;
+  *height = swap ? fit_width  : fit_height;
+
+  size->width  = *width;
+  size->height = *height;
+}
+
+/* Turns pixbuf upright from the way its EXIF orientation says it is
+ * stored, taking over the reference */
+static GdkPixbuf *
+thumbnail_orient (GdkPixbuf *pixbuf,
+                  gint       orientation)
+{
+  GdkPixbuf *upright;
+  gchar      value[4];
+
+  if (pixbuf == NULL || orientation <= 1 || orientation > 8)
+    return pixbuf;
+
+  g_snprintf (value, sizeof (value), "%d", orientation);
+  gdk_pixbuf_set_option (pixbuf, "orientation", value);
+
+  upright = gdk_pixbuf_apply_embedded_orientation (pixbuf);
+  g_object_unref (pixbuf);
+
+  return upright;
+}
+
+/* Shrinks pixbuf to width by height with the plug-in's resampler, taking
+ * over the reference */
+static GdkPixbuf *
+thumbnail_scale (GdkPixbuf      *pixbuf,
+                 gint            width,
+                 gint            height,
+                 ResampleFilter  filter)
+{
+  GdkPixbuf *scaled;
+
+  if (gdk_pixbuf_get_width (pixbuf) == width &&
+      gdk_pixbuf_get_height (pixbuf) == height)
+    return pixbuf;
+
+  scaled = resample_pixbuf (pixbuf, width, height, filter);
+  g_object_unref (pixbuf);
+
+  return scaled;
+}
+
+/* Decodes file at the size worked out by thumbnail_size_func, upright but
+ * without turning it for rotate. JPEGs, and RAW files through their
+ * embedded JPEG preview, are decoded at a reduced DCT scale first, other
+ * formats go through gdk-pixbuf at full size. Either is then shrunk the
+ * rest of the way by the resampler, and only then converted from any
+ * embedded colour profile to sRGB and turned upright. */
+static GdkPixbuf *
+thumbnail_decode (const gchar *file,
+                  ThumbSize   *size)
+{
+  GdkPixbuf  *pixbuf = NULL;
+  GBytes     *icc;
+  const Babl *space = NULL;
+  gint        src_width;
+  gint        src_height;
+
+  /* A RAW without a usable preview is left for GIMP to develop. For the
+   * TIFF based ones gdk-pixbuf would only find the small thumbnail in
+   * the first directory. */
+  if (raw_preview_is_raw (file))
+    {
+      pixbuf = raw_preview_load (file, thumbnail_size_func, size);
+      if (pixbuf == NULL)
+        return NULL;
+    }
+  else if (jpeg_is_jpeg (file))
+    pixbuf = jpeg_load_scaled (file, thumbnail_size_func, size);
+
+  if (pixbuf == NULL)
+    {
+      if (gdk_pixbuf_get_file_info (file, &src_width, &src_height) == NULL ||
+          src_width <= 0 || src_height <= 0)
+        return NULL;
+
+      thumbnail_size_func (src_width, src_height, &size->width, &size->height, size);
+
+      pixbuf = gdk_pixbuf_new_from_file (file, NULL);
+    }
+
+  if (pixbuf == NULL)
+    return NULL;
+
+  icc = color_profile_get_icc (pixbuf);
+  if (icc != NULL)
+    {
+      space = color_profile_space (icc);
+      g_bytes_unref (icc);
+    }
+
+  pixbuf = thumbnail_scale (pixbuf, size->width, size->height, size->filter);
+  pixbuf = color_profile_convert_pixbuf (pixbuf, space);
+
+  return thumbnail_orient (pixbuf, size->target.orientation);
+}
+
+/* Decodes file straight to the size target gives it on the sheet, turned
+ * upright and then rotating portrait images a quarter turn anticlockwise
+ * when asked to, like load_fallback does. With use_cache the image comes
+ * from, or goes into, the shared thumbnail cache when the cell is small
+ * enough for it. Runs on the worker threads. */
+GdkPixbuf *
+thumbnail_load (const gchar       *file,
+                const ThumbTarget *target,
+                gboolean           use_cache,
+                ResampleFilter     filter)
+{
+  ThumbSize  size = { *target, FALSE, FALSE, 0, 0, 0, 0, filter };
+  GdkPixbuf *pixbuf = NULL;
+  gint       cache_size = 0;
+
+  if (use_cache)
+    cache_size = thumb_cache_size_for_box (target->box_width, target->box_height);
+
+  if (cache_size > 0)
+    {
+      pixbuf = thumb_cache_lookup (file, cache_size);
+
+      if (pixbuf == NULL)
+        {
+          ThumbSize cached = { { cache_size, cache_size, 0, 0, target->orientation, FALSE },
+                               TRUE, FALSE, 0, 0, 0, 0, filter };
+
+          pixbuf = thumbnail_decode (file, &cached);
+          if (pixbuf != NULL)
+            thumb_cache_store (file, cache_size, pixbuf,
+                               cached.src_width, cached.src_height);
+        }
+
+      /* Derive the cell size from the cached image as if it were the file;
+       * it is stored upright already */
+      if (pixbuf != NULL)
+        {
+          gint width;
+          gint height;
+
+          size.target.orientation = 1;
+          thumbnail_size_func (gdk_pixbuf_get_width (pixbuf),
+                               gdk_pixbuf_get_height (pixbuf),
+                               &width, &height, &size);
+
+          pixbuf = thumbnail_scale (pixbuf, width, height, filter);
+        }
+    }
+
+  if (pixbuf == NULL)
+    pixbuf = thumbnail_decode (file, &size);
+
+  if (pixbuf == NULL)
+    return NULL;
+
+  if (size.turn)
+    {
+      GdkPixbuf *rotated;
+
+      rotated = gdk_pixbuf_rotate_simple (pixbuf, GDK_PIXBUF_ROTATE_COUNTERCLOCKWISE);
+      g_object_unref (pixbuf);
+      pixbuf = rotated;
+    }
+
+  return pixbuf;
+}
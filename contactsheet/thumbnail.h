@@ -0,0 +1,77 @@
+/* GIMP - The GNU Image Manipulation Program
+ * Copyright (C) 2023 Samuel Oldham
+ * Contact sheet plug-in (C) 2023 Samuel Oldham
+ * e-mail: so9010sami@gmail.com
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#ifndef __CONTACTSHEET_THUMBNAIL_H__
+#define __CONTACTSHEET_THUMBNAIL_H__
+
+#include <glib.h>
+#include <gdk-pixbuf/gdk-pixbuf.h>
+
+#include "metadata.h"
+#include "resample.h"
+
+/* Decodes images into cell sized thumbnails, and reads their caption
+ * values, on a pool of worker threads. Nothing in here talks to the PDB,
+ * so it is safe to run off the main thread; the main thread pops the
+ * results back in file order.
+ */
+typedef struct _ThumbQueue ThumbQueue;
+
+/* What one image is decoded to. The layout works it out from the image's
+ * header, so the decoder knows the exact size before reading any pixels;
+ * when the header could not be read the image is fitted into the box. */
+typedef struct
+{
+  gint     box_width;             /* Fitted into this when width is 0 */
+  gint     box_height;
+  gint     width;                 /* Exact size on the sheet, 0 when not known */
+  gint     height;
+  gint     orientation;           /* EXIF orientation, undone so the image is upright */
+  gboolean rotate;                /* Then portrait images are turned a quarter anticlockwise */
+  gint     src_width;             /* Of the image, from its header, 0 when not known */
+  gint     src_height;
+} ThumbTarget;
+
+ThumbQueue *thumb_queue_new  (GPtrArray         *files,
+                              const ThumbTarget *targets,
+                              gboolean           use_cache,
+                              ResampleFilter     filter,
+                              MetadataIndex     *metadata,
+                              gsize              budget,
+                              guint              read_ahead);
+
+GdkPixbuf  *thumb_queue_pop  (ThumbQueue        *queue,
+                              guint              index,
+                              ExifInfo          *exif);
+
+void        thumb_queue_free (ThumbQueue        *queue);
+
+GdkPixbuf  *thumbnail_load   (const gchar       *file,
+                              const ThumbTarget *target,
+                              gboolean           use_cache,
+                              ResampleFilter     filter);
+
+void        thumbnail_fit    (gint               src_width,
+                              gint               src_height,
+                              gint               box_width,
+                              gint               box_height,
+                              gint              *width,
+                              gint              *height);
+
+#endif /* __CONTACTSHEET_THUMBNAIL_H__ */
@@ -0,0 +1,235 @@
+/* GIMP - The GNU Image Manipulation Program
+ * Copyright (C) 2023 Samuel Oldham
+ * Contact sheet plug-in (C) 2023 Samuel Oldham
+ * e-mail: so9010sami@gmail.com
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Trace-event output.
+ */
+
+#include <stdio.h>
+#include <string.h>
+
+#include <glib/gstdio.h>
+
+#include "trace.h"
+
+/* Totals per span name for the summary */
+typedef struct
+{
+  guint   count;
+  gint64  usec;
+  gint64  max_usec;
+  gint64  bytes;
+  guint   pdb_calls;
+} TraceTotal;
+
+gint  trace_enabled   = FALSE;
+guint trace_pdb_calls = 0;
+
+static GMutex      trace_mutex;
+static FILE       *trace_file;
+static gint64      trace_origin;
+static gboolean    trace_first;
+static GHashTable *trace_totals;          /* Span name -> TraceTotal */
+static gint        trace_next_tid;
+static GPrivate    trace_tid;
+
+/* Small numbers per thread read better in the viewer than pthread ids */
+static gint
+trace_thread_id (void)
+{
+  gint tid = GPOINTER_TO_INT (g_private_get (&trace_tid));
+
+  if (tid == 0)
+    {
+      tid = g_atomic_int_add (&trace_next_tid, 1) + 1;
+      g_private_set (&trace_tid, GINT_TO_POINTER (tid));
+    }
+
+  return tid;
+}
+
+static void
+trace_write_string (const gchar *string)
+{
+  const gchar *p;
+
+  fputc ('"', trace_file);
+  for (p = string; *p != '\0'; p++)
+    {
+      if (*p == '"' || *p == '\\')
+        fprintf (trace_file, "\\%c", *p);
+      else if ((guchar) *p < 0x20)
+        fprintf (trace_file, "\\u%04x", (guchar) *p);
+      else
+        fputc (*p, trace_file);
+    }
+  fputc ('"', trace_file);
+}
+
+void
+trace_open (void)
+{
+  const gchar *path = g_getenv ("CONTACTSHEET_TRACE");
+
+  if (path == NULL || path[0] == '\0')
+    return;
+
+  trace_file = g_fopen (path, "w");
+  if (trace_file == NULL)
+    {
+      g_printerr ("contactsheet: could not write the trace to %s\n", path);
+      return;
+    }
+
+  trace_origin  = g_get_monotonic_time ();
+  trace_first   = TRUE;
+  trace_totals  = g_hash_table_new_full (g_str_hash, g_str_equal, NULL, g_free);
+  g_atomic_int_set (&trace_enabled, TRUE);
+
+  fputs ("{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n", trace_file);
+}
+
+gint64
+trace_now (void)
+{
+  return g_get_monotonic_time ();
+}
+
+/* Writes one complete event and adds it to the totals. name has to be a
+ * string that lives for the run, a literal. */
+void
+trace_span (const gchar *category,
+            const gchar *name,
+            gint64       start,
+            const gchar *file,
+            gint64       bytes,
+            guint        pdb_calls)
+{
+  gint64      end = g_get_monotonic_time ();
+  gint        tid = trace_thread_id ();
+  TraceTotal *total;
+
+  g_mutex_lock (&trace_mutex);
+
+  // A span that got past TRACE_END as trace_close () ran
+  if (trace_file == NULL)
+    {
+      g_mutex_unlock (&trace_mutex);
+      return;
+    }
+
+  fprintf (trace_file,
+           "%s{\"name\":\"%s\",\"cat\":\"%s\",\"ph\":\"X\",\"pid\":1,\"tid\":%d,"
+           "\"ts\":%" G_GINT64_FORMAT ",\"dur\":%" G_GINT64_FORMAT ",\"args\":{",
+           trace_first ? "" : ",\n", name, category, tid,
+           start - trace_origin, end - start);
+  trace_first = FALSE;
+
+  fprintf (trace_file, "\"bytes\":%" G_GINT64_FORMAT ",\"pdb_calls\":%u",
+           bytes, pdb_calls);
+  if (file != NULL)
+    {
+      fputs (",\"file\":", trace_file);
+      trace_write_string (file);
+    }
+  fputs ("}}", trace_file);
+
+  total = g_hash_table_lookup (trace_totals, name);
+  if (total == NULL)
+    {
+      total = g_new0 (TraceTotal, 1);
+      g_hash_table_insert (trace_totals, (gpointer) name, total);
+    }
+
+  total->count++;
+  total->usec     += end - start;
+  total->max_usec  = MAX (total->max_usec, end - start);
+  total->bytes    += bytes;
+  total->pdb_calls += pdb_calls;
+
+  g_mutex_unlock (&trace_mutex);
+}
+
+/* Size of file, for spans that read or wrote all of it */
+gint64
+trace_file_size (const gchar *file)
+{
+  GStatBuf st;
+
+  return g_stat (file, &st) == 0 ? st.st_size : 0;
+}
+
+static gint
+trace_compare_usec (gconstpointer a,
+                    gconstpointer b,
+                    gpointer      totals)
+{
+  const TraceTotal *ta = g_hash_table_lookup (totals, *(const gchar *const *) a);
+  const TraceTotal *tb = g_hash_table_lookup (totals, *(const gchar *const *) b);
+
+  return (tb->usec > ta->usec) - (tb->usec < ta->usec);
+}
+
+/* Finishes the file and prints where the time went, slowest stage first.
+ * Worker spans overlap, so their totals can add up to more than the run. */
+void
+trace_close (void)
+{
+  GPtrArray      *names;
+  GHashTableIter  iter;
+  gpointer        key;
+  guint           i;
+
+  if (! g_atomic_int_get (&trace_enabled))
+    return;
+
+  g_atomic_int_set (&trace_enabled, FALSE);
+
+  g_mutex_lock (&trace_mutex);
+
+  fputs ("\n]}\n", trace_file);
+  fclose (trace_file);
+  trace_file = NULL;
+
+  names = g_ptr_array_new ();
+  g_hash_table_iter_init (&iter, trace_totals);
+  while (g_hash_table_iter_next (&iter, &key, NULL))
+    g_ptr_array_add (names, key);
+  g_ptr_array_sort_with_data (names, trace_compare_usec, trace_totals);
+
+  g_printerr ("%-16s %8s %12s %10s %10s %12s %9s\n",
+              "stage", "count", "total ms", "mean ms", "max ms", "bytes", "pdb");
+  for (i = 0; i < names->len; i++)
+    {
+      const gchar      *name  = g_ptr_array_index (names, i);
+      const TraceTotal *total = g_hash_table_lookup (trace_totals, name);
+
+      g_printerr ("%-16s %8u %12.1f %10.2f %10.2f %12" G_GINT64_FORMAT " %9u\n",
+                  name, total->count,
+                  total->usec / 1000.0,
+                  total->usec / 1000.0 / total->count,
+                  total->max_usec / 1000.0,
+                  total->bytes, total->pdb_calls);
+    }
+
+  g_ptr_array_free (names, TRUE);
+  g_clear_pointer (&trace_totals, g_hash_table_destroy);
+
+  g_mutex_unlock (&trace_mutex);
+}
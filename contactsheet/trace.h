@@ -0,0 +1,69 @@
+/* GIMP - The GNU Image Manipulation Program
+ * Copyright (C) 2023 Samuel Oldham
+ * Contact sheet plug-in (C) 2023 Samuel Oldham
+ * e-mail: so9010sami@gmail.com
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#ifndef __CONTACTSHEET_TRACE_H__
+#define __CONTACTSHEET_TRACE_H__
+
+#include <glib.h>
+
+/* Optional timing of each stage of a run, written as Chrome trace-event
+ * JSON that Perfetto or chrome://tracing can open, with a summary per
+ * stage on stderr at the end. Turned on by setting CONTACTSHEET_TRACE to
+ * the file to write. When it is off every TRACE_ macro is one test of
+ * trace_enabled, read atomically as the workers trace too. */
+extern gint trace_enabled;
+
+/* PDB calls made so far, by the main thread, the only one that makes them */
+extern guint trace_pdb_calls;
+
+void   trace_open  (void);
+
+gint64 trace_now   (void);
+
+void   trace_span  (const gchar *category,
+                    const gchar *name,
+                    gint64       start,
+                    const gchar *file,
+                    gint64       bytes,
+                    guint        pdb_calls);
+
+void   trace_close (void);
+
+gint64 trace_file_size (const gchar *file);
+
+/* Start of a span, 0 when tracing is off */
+#define TRACE_START()  (g_atomic_int_get (&trace_enabled) ? trace_now () : 0)
+
+/* Wraps a call into GIMP, each one a PDB round trip, so the spans around
+ * it count it. Evaluates to what call returns. */
+#define TRACE_PDB(call)  (trace_pdb_calls++, (call))
+
+/* For a span to subtract the count at its start from */
+#define TRACE_PDB_CALLS()  (trace_pdb_calls)
+
+/* Ends a span begun with TRACE_START. file may be NULL, bytes is how much
+ * it read or wrote and pdb_calls how many PDB procedures it ran. The
+ * arguments are only evaluated when tracing is on. */
+#define TRACE_END(category, name, start, file, bytes, pdb_calls)          \
+  G_STMT_START {                                                          \
+    if (g_atomic_int_get (&trace_enabled))                                \
+      trace_span (category, name, start, file, bytes, pdb_calls);         \
+  } G_STMT_END
+
+#endif /* __CONTACTSHEET_TRACE_H__ */